@@ -2,6 +2,7 @@
   'targets': [{
     'target_name': 'addon',
     'sources': [ 'src/motion.cc' ],
+    'include_dirs': [ '../src' ],
     'target_defaults': {
       'default_configuration': 'Release',
       'configurations': {
@@ -15,6 +15,7 @@ const planet_fields2 = ['a', 'e', 'i', 'w', 'Om', 'm'];
 const planet_fields3 = ['x', 'y', 'z', 'v_x', 'v_y', 'v_z'];
 
 module.exports = gen_system;
+gen_system.load_system = load_system;
 
 
 function gen_system(pargs) {
@@ -32,7 +33,14 @@ function gen_system(pargs) {
 
 
 function gen_from_config(argv) {
-  const file = readFileSync(argv.config).toString();
+  console.log(load_system(argv.config));
+}
+
+
+// Build the star and its planets from the config file at path. Planet
+// positions are in km and velocities in km/s, relative to the star.
+function load_system(path) {
+  const file = readFileSync(path).toString();
   const config = deep_numberify(ini.parse(file));
   const system = { planet: {} };
 
@@ -57,6 +65,7 @@ function gen_from_config(argv) {
     // First generate if given pos and vel directly.
     if (check_if_vals_exist(p, planet_fields3)) {
       system.planet[n] = {
+        mass: p.mass,
         x: p.x, y: p.y, z: p.z, v_x: p.v_x, v_y: p.v_y, v_z: p.v_z,
       };
 
@@ -76,7 +85,7 @@ function gen_from_config(argv) {
     }
   }
 
-  console.log(system);
+  return system;
 }
 
 
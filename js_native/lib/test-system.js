@@ -1,17 +1,136 @@
 'use strict';
 
+const { readFileSync } = require('fs');
+const { ceil, sqrt } = Math;
+const { AU, DAY, G, YEAR_SEC } = require('./constants.js');
+const { load_system } = require('./gen-system.js');
+const { sec_to_string } = require('./utils.js');
+
 let motion = null;
 
 try {
   const build_type = process.features.debug ? 'Debug' : 'Release';
-  motion = require(`./build/${build_type}/addon`);
+  motion = require(`../build/${build_type}/addon`);
 } catch {
   // TODO(trevnorris): Setup to use JS impl instead of native in case loading
   // native failed.
 }
 
+module.exports = test_system;
+
+
 function test_system(pargs) {
-  const argv = require('minimist')(pargs);
+  const argv = parse_args(pargs);
+
+  if (argv.help || !argv.config) {
+    return console.log(
+      readFileSync(__dirname + '/../help/test-system.txt').toString());
+  }
+  if (!motion) {
+    console.error('native addon not built, run node-gyp rebuild first');
+    process.exit(1);
+  }
+
+  const years = +argv.years;
+  const dt = +argv.dt;
+  if (!(years > 0) || !(dt > 0)) {
+    console.error('years and dt must be numbers > 0');
+    process.exit(1);
+  }
+
+  run_system(load_system(argv.config), years, dt).catch((e) => {
+    console.error(e);
+    process.exit(1);
+  });
 }
 
-module.exports = test_system;
+
+// Integrate the system on the threadpool, checking the planets between
+// batches. The run stops early if any planet is no longer bound to the star.
+async function run_system(system, years, dt) {
+  const names = Object.keys(system.planet);
+  const sys = new motion.System(names.length + 1);
+  const steps = ceil(years * YEAR_SEC / dt);
+  // Check in roughly every ten days of simulated time.
+  const every = ceil(10 * DAY / dt);
+  const GM = G * system.star.mass;
+  const min = [];
+  const max = [];
+  let escaped = -1;
+
+  // The star sits at the origin; planets are stored after it in m and m/s.
+  sys.mass[0] = system.star.mass;
+  names.forEach((n, i) => {
+    const p = system.planet[n];
+    sys.mass[i + 1] = p.mass;
+    sys.pos.set([p.x * 1e3, p.y * 1e3, p.z * 1e3], (i + 1) * 3);
+    sys.vel.set([p.v_x * 1e3, p.v_y * 1e3, p.v_z * 1e3], (i + 1) * 3);
+    min.push(Infinity);
+    max.push(0);
+  });
+
+  function check_orbits() {
+    const { pos, vel } = sys;
+    for (let i = 0; i < names.length; i++) {
+      const j = (i + 1) * 3;
+      const dx = pos[j] - pos[0];
+      const dy = pos[j + 1] - pos[1];
+      const dz = pos[j + 2] - pos[2];
+      const vx = vel[j] - vel[0];
+      const vy = vel[j + 1] - vel[1];
+      const vz = vel[j + 2] - vel[2];
+      const r = sqrt(dx * dx + dy * dy + dz * dz);
+      if (r < min[i]) min[i] = r;
+      if (r > max[i]) max[i] = r;
+      // Specific orbital energy; zero or above and the planet escapes.
+      if ((vx * vx + vy * vy + vz * vz) / 2 - GM / r >= 0)
+        escaped = i;
+    }
+    return escaped < 0;
+  }
+
+  const tty = process.stdout.isTTY;
+  check_orbits();
+  const t = process.hrtime.bigint();
+  const done = await sys.run(steps, dt, every, (n) => {
+    if (tty) {
+      process.stdout.write(`\r${sec_to_string(n * dt)} of ` +
+                           `${sec_to_string(steps * dt)}`);
+    }
+    return check_orbits();
+  });
+  if (escaped < 0)
+    check_orbits();
+  const ms = Number(process.hrtime.bigint() - t) / 1e6;
+
+  if (tty)
+    process.stdout.write('\r\x1b[K');
+  console.log(`${(done * dt / YEAR_SEC).toFixed(2)} years in ` +
+              `${done} steps, ${ms.toFixed(0)} ms`);
+  names.forEach((n, i) => {
+    console.log(`${n.padEnd(16)} ${(min[i] / 1e3 / AU).toFixed(4)} - ` +
+                `${(max[i] / 1e3 / AU).toFixed(4)} AU`);
+  });
+  if (escaped >= 0) {
+    console.log(`unstable: ${names[escaped]} escaped`);
+    process.exitCode = 1;
+  } else {
+    console.log('stable');
+  }
+}
+
+
+function parse_args(pargs) {
+  return require('minimist')(pargs, {
+    alias: {
+      c: 'config',
+      d: 'dt',
+      h: 'help',
+      y: 'years',
+    },
+    default: {
+      dt: 60,
+      years: 10,
+    },
+  });
+}
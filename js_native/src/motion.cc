@@ -1,12 +1,310 @@
+#include "nbody.h"
+
 #include <node.h>
+#include <node_object_wrap.h>
+#include <uv.h>
+
+#include <cmath>
+#include <memory>
 
+using v8::ArrayBuffer;
+using v8::BackingStore;
+using v8::Context;
+using v8::Exception;
+using v8::Float64Array;
 using v8::FunctionCallbackInfo;
+using v8::Function;
+using v8::FunctionTemplate;
+using v8::Global;
+using v8::HandleScope;
+using v8::Isolate;
+using v8::Local;
+using v8::Number;
+using v8::Object;
+using v8::Promise;
+using v8::String;
+using v8::Uint32;
 using v8::Value;
 
-void Method(const FunctionCallbackInfo<Value>& info) {
-}
+// The N-body engine as a JS object:
+//
+//   const sys = new System(n);
+//   sys.mass[i] = m;
+//   sys.pos.set([x, y, z], i * 3);
+//   sys.vel.set([vx, vy, vz], i * 3);
+//   sys.step(3600, 1);
+//
+// mass, pos, vel and acc are Float64Arrays over the engine's own buffers, so
+// whatever JS writes is what the next step integrates, and after a step they
+// already hold the new state. Nothing is copied either way. All four share one
+// ArrayBuffer owned by V8, so they stay valid for as long as JS holds on to
+// them, even after the System itself is collected.
+//
+// Long runs can go on the libuv threadpool instead, so they don't block the
+// event loop:
+//
+//   const done = await sys.run(steps, dt, every, (steps_done) => { ... });
+//
+// The run is split into batches of every steps (all at once if every is 0).
+// Between batches the state is consistent, and the optional callback gets the
+// number of steps done so far and can read the arrays directly. Returning
+// false from it stops the run. The promise resolves to the number of steps
+// done. The arrays must not be written while a run is in progress, and
+// step() and run() throw until it's done.
+class System : public node::ObjectWrap {
+ public:
+  static void Init(Local<Object> exports, Local<Context> context) {
+    Isolate* isolate = context->GetIsolate();
+    Local<FunctionTemplate> t = FunctionTemplate::New(isolate, New);
+    t->SetClassName(String::NewFromUtf8Literal(isolate, "System"));
+    t->InstanceTemplate()->SetInternalFieldCount(1);
+    NODE_SET_PROTOTYPE_METHOD(t, "step", Step);
+    NODE_SET_PROTOTYPE_METHOD(t, "run", Run);
+    exports->Set(context,
+                 String::NewFromUtf8Literal(isolate, "System"),
+                 t->GetFunction(context).ToLocalChecked()).Check();
+  }
+
+ private:
+  // Where each array starts in the shared buffer, in multiples of n doubles:
+  // mass[n], then pos, vel and acc as [n][3].
+  enum { MASS = 0, POS = 1, VEL = 4, ACC = 7, END = 10 };
+
+  System(std::shared_ptr<BackingStore> store, size_t n)
+    : store_(store),
+      nbody_(n, column(n, MASS), column(n, POS), column(n, VEL),
+             column(n, ACC)) { }
+
+  inline double* column(size_t n, size_t start) {
+    return static_cast<double*>(store_->Data()) + start * n;
+  }
+
+  // One asynchronous run, queued a batch at a time.
+  class RunWork : public node::AsyncResource {
+   public:
+    RunWork(Isolate* isolate,
+            Local<Object> self,
+            System* sys,
+            uint64_t steps,
+            double dt,
+            uint64_t every,
+            Local<Promise::Resolver> resolver,
+            Local<Function> callback)
+      : node::AsyncResource(isolate, self, "System.run"),
+        isolate_(isolate),
+        sys_(sys),
+        remaining_(steps),
+        every_(every > 0 ? every : steps),
+        dt_(dt),
+        resolver_(isolate, resolver) {
+      if (!callback.IsEmpty())
+        callback_.Reset(isolate, callback);
+      req_.data = this;
+    }
+
+    // Queue the next batch, or finish if there's nothing left.
+    void next() {
+      batch_ = remaining_ < every_ ? remaining_ : every_;
+      if (batch_ == 0)
+        return finish();
+      uv_queue_work(node::GetCurrentEventLoop(isolate_), &req_, Work, After);
+    }
+
+   private:
+    static void Work(uv_work_t* req) {
+      RunWork* w = static_cast<RunWork*>(req->data);
+      w->sys_->nbody_.run(w->batch_, w->dt_);
+    }
+
+    static void After(uv_work_t* req, int status) {
+      RunWork* w = static_cast<RunWork*>(req->data);
+      HandleScope scope(w->isolate_);
+      w->done_ += w->batch_;
+      w->remaining_ -= w->batch_;
+      if (w->remaining_ > 0 && !w->callback_.IsEmpty()) {
+        Local<Value> argv[] = { Number::New(w->isolate_, w->done_) };
+        Local<Value> ret;
+        if (!w->MakeCallback(w->callback_.Get(w->isolate_), 1, argv)
+                 .ToLocal(&ret) ||
+            ret->IsFalse()) {
+          w->remaining_ = 0;
+        }
+      }
+      w->next();
+    }
+
+    void finish() {
+      Local<Context> context = isolate_->GetCurrentContext();
+      sys_->busy_ = false;
+      {
+        CallbackScope scope(this);
+        resolver_.Get(isolate_)
+            ->Resolve(context, Number::New(isolate_, done_)).Check();
+      }
+      sys_->Unref();
+      delete this;
+    }
+
+    uv_work_t req_;
+    Isolate* isolate_;
+    System* sys_;
+    uint64_t remaining_;
+    uint64_t every_;
+    uint64_t batch_ = 0;
+    uint64_t done_ = 0;
+    double dt_;
+    Global<Promise::Resolver> resolver_;
+    Global<Function> callback_;
+  };
+
+  static inline void expose(Local<Context> context,
+                            Local<Object> self,
+                            Local<String> name,
+                            Local<ArrayBuffer> ab,
+                            size_t n,
+                            size_t start,
+                            size_t end) {
+    Local<Float64Array> view =
+        Float64Array::New(ab, start * n * sizeof(double), (end - start) * n);
+    self->Set(context, name, view).Check();
+  }
+
+  // new System(n)
+  static void New(const FunctionCallbackInfo<Value>& info) {
+    Isolate* isolate = info.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+
+    if (!info.IsConstructCall()) {
+      isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8Literal(isolate, "System must be called with new")));
+      return;
+    }
+    if (!info[0]->IsUint32()) {
+      isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8Literal(isolate, "n must be a body count")));
+      return;
+    }
+
+    size_t n = info[0].As<Uint32>()->Value();
+    Local<ArrayBuffer> ab = ArrayBuffer::New(isolate, END * n * sizeof(double));
+    Local<Object> self = info.This();
+    System* sys = new System(ab->GetBackingStore(), n);
+    sys->Wrap(self);
+
+    expose(context, self, String::NewFromUtf8Literal(isolate, "mass"),
+           ab, n, MASS, POS);
+    expose(context, self, String::NewFromUtf8Literal(isolate, "pos"),
+           ab, n, POS, VEL);
+    expose(context, self, String::NewFromUtf8Literal(isolate, "vel"),
+           ab, n, VEL, ACC);
+    expose(context, self, String::NewFromUtf8Literal(isolate, "acc"),
+           ab, n, ACC, END);
+    info.GetReturnValue().Set(self);
+  }
+
+  // Whether v is a whole number from 0 up to 2^53, so it converts to uint64_t
+  // exactly. NaN and the infinities aren't.
+  static bool count_arg(Local<Value> v, uint64_t* out) {
+    if (!v->IsNumber())
+      return false;
+    double d = v.As<Number>()->Value();
+    if (!std::isfinite(d) || d < 0 || d > 9007199254740992.0 ||
+        std::trunc(d) != d) {
+      return false;
+    }
+    *out = static_cast<uint64_t>(d);
+    return true;
+  }
+
+  // Check the steps and dt arguments shared by step() and run(). Throws and
+  // returns false if they're bad or a run is already going.
+  static bool steps_args(const FunctionCallbackInfo<Value>& info,
+                         System* sys,
+                         uint64_t* steps,
+                         double* dt) {
+    Isolate* isolate = info.GetIsolate();
+
+    if (sys->busy_) {
+      isolate->ThrowException(Exception::Error(
+          String::NewFromUtf8Literal(isolate, "a run is in progress")));
+      return false;
+    }
+    if (!count_arg(info[0], steps)) {
+      isolate->ThrowException(Exception::TypeError(
+          String::NewFromUtf8Literal(isolate, "steps must be an integer >= 0")));
+      return false;
+    }
+    *dt = 1;
+    if (info.Length() > 1 && !info[1]->IsUndefined()) {
+      if (!info[1]->IsNumber() ||
+          !std::isfinite(info[1].As<Number>()->Value())) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8Literal(isolate, "dt must be a finite number")));
+        return false;
+      }
+      *dt = info[1].As<Number>()->Value();
+    }
+    return true;
+  }
+
+  // step(steps[, dt = 1]): advance steps steps of dt seconds each.
+  static void Step(const FunctionCallbackInfo<Value>& info) {
+    System* sys = ObjectWrap::Unwrap<System>(info.This());
+    uint64_t steps;
+    double dt;
+
+    if (!steps_args(info, sys, &steps, &dt))
+      return;
+    sys->nbody_.run(steps, dt);
+  }
+
+  // run(steps[, dt = 1[, every = 0[, callback]]]): like step() but on the
+  // threadpool. Returns a promise.
+  static void Run(const FunctionCallbackInfo<Value>& info) {
+    Isolate* isolate = info.GetIsolate();
+    Local<Context> context = isolate->GetCurrentContext();
+    System* sys = ObjectWrap::Unwrap<System>(info.This());
+    Local<Function> callback;
+    uint64_t every = 0;
+    uint64_t steps;
+    double dt;
+
+    if (!steps_args(info, sys, &steps, &dt))
+      return;
+    if (info.Length() > 2 && !info[2]->IsUndefined()) {
+      if (!count_arg(info[2], &every)) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8Literal(isolate, "every must be an integer >= 0")));
+        return;
+      }
+    }
+    if (info.Length() > 3 && !info[3]->IsUndefined()) {
+      if (!info[3]->IsFunction()) {
+        isolate->ThrowException(Exception::TypeError(
+            String::NewFromUtf8Literal(isolate, "callback must be a function")));
+        return;
+      }
+      callback = info[3].As<Function>();
+    }
+
+    Local<Promise::Resolver> resolver =
+        Promise::Resolver::New(context).ToLocalChecked();
+    info.GetReturnValue().Set(resolver->GetPromise());
+
+    // Keep the System alive and its arrays untouched until the run is done.
+    sys->busy_ = true;
+    sys->Ref();
+    RunWork* w = new RunWork(isolate, info.This(), sys, steps, dt, every,
+                             resolver, callback);
+    w->next();
+  }
+
+  std::shared_ptr<BackingStore> store_;
+  ssm::NBody nbody_;
+  bool busy_ = false;
+};
 
 
 NODE_MODULE_INIT(/* exports, module, context */) {
-  NODE_SET_METHOD(exports, "method", Method);
+  System::Init(exports, context);
 }
@@ -0,0 +1,108 @@
+'use strict';
+
+// Run with:
+//  node-gyp rebuild && node test/test-motion.js
+
+const build_type = process.features.debug ? 'Debug' : 'Release';
+const { System } = require(`../build/${build_type}/addon`);
+
+const AU = 149597870700;
+const G = 6.67408e-11;
+const M = 1.989e30;
+
+let failed = 0;
+
+function check(ok, what) {
+  console.log(`${what.padEnd(48)} ${ok ? 'ok' : 'FAILED'}`);
+  if (!ok)
+    failed = 1;
+}
+
+function throws(fn, message) {
+  try {
+    fn();
+  } catch (e) {
+    return e.message === message;
+  }
+  return false;
+}
+
+// The sun and the earth on a circular orbit.
+function make_system() {
+  const sys = new System(2);
+  sys.mass[0] = M;
+  sys.mass[1] = 5.97e24;
+  sys.pos.set([AU, 0, 0], 3);
+  sys.vel.set([0, Math.sqrt(G * M / AU), 0], 3);
+  return sys;
+}
+
+function same_state(a, b) {
+  return a.pos.every((v, i) => v === b.pos[i]) &&
+         a.vel.every((v, i) => v === b.vel[i]);
+}
+
+function check_step() {
+  const sys = make_system();
+  const pos = sys.pos;
+  // A quarter year in one minute steps.
+  sys.step(365.25 * 1440 / 4, 60);
+  const r = Math.hypot(pos[3], pos[4], pos[5]) / AU;
+  check(pos === sys.pos, 'arrays stay the same objects');
+  check(Math.abs(r - 1) < 1e-3 && pos[4] / AU > 0.99,
+        'step() moves the earth a quarter orbit');
+  const steps_msg = 'steps must be an integer >= 0';
+  check(throws(() => sys.step(-1), steps_msg),
+        'step() rejects negative steps');
+  check(throws(() => sys.step(NaN), steps_msg) &&
+        throws(() => sys.step(Infinity), steps_msg) &&
+        throws(() => sys.step(1.5), steps_msg) &&
+        throws(() => sys.step(2 ** 64), steps_msg),
+        'step() rejects NaN, Infinity and fractions');
+  check(throws(() => sys.step(1, Infinity), 'dt must be a finite number') &&
+        throws(() => sys.step(1, NaN), 'dt must be a finite number'),
+        'step() rejects a non-finite dt');
+  check(throws(() => sys.run(1, 60, 0.5), 'every must be an integer >= 0') &&
+        throws(() => sys.run(1, 60, NaN), 'every must be an integer >= 0'),
+        'run() rejects a fractional or NaN every');
+  check(throws(() => System(2), 'System must be called with new'),
+        'System() needs new');
+}
+
+async function check_run() {
+  const a = make_system();
+  const b = make_system();
+  const progress = [];
+
+  a.step(1000, 60);
+  const p = b.run(1000, 60, 300, (n) => {
+    progress.push(n);
+  });
+  check(p instanceof Promise, 'run() returns a promise');
+  check(throws(() => b.step(1), 'a run is in progress'),
+        'step() throws while running');
+  check(throws(() => b.run(1), 'a run is in progress'),
+        'a second run() throws while running');
+
+  const done = await p;
+  check(done === 1000, 'run() resolves to the steps done');
+  check(progress.join() === '300,600,900', 'progress after each batch');
+  check(same_state(a, b), 'run() matches step()');
+
+  const c = make_system();
+  const stopped = await c.run(1000, 60, 100, (n) => n < 300);
+  check(stopped === 300, 'returning false stops the run');
+
+  const d = make_system();
+  const before = Array.from(d.pos);
+  check(await d.run(0) === 0 && d.pos.every((v, i) => v === before[i]),
+        'run(0) resolves to 0 and leaves the state');
+  check(await d.run(10, 60) === 10, 'run() works again after run(0)');
+}
+
+(async () => {
+  check_step();
+  await check_run();
+  console.log(failed ? 'FAILED' : 'ok');
+  process.exitCode = failed;
+})();
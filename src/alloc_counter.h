@@ -0,0 +1,101 @@
+#ifndef ALLOC_COUNTER_H_
+#define ALLOC_COUNTER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Count of heap allocations through operator new, to check that a loop makes
+// none: read heap_allocations() before and after.
+//
+// Counting is for debug builds. Build with -DSSM_COUNT_ALLOCS and this header
+// replaces the global operator new and delete, so it has to be included by
+// exactly one translation unit of a program, the one with main(). Otherwise
+// heap_allocations() always returns 0 and nothing is replaced.
+
+namespace ssm {
+
+inline std::atomic<uint64_t>& heap_allocation_counter() {
+  static std::atomic<uint64_t> count(0);
+  return count;
+}
+
+inline uint64_t heap_allocations() {
+  return heap_allocation_counter().load(std::memory_order_relaxed);
+}
+
+}  // namespace ssm
+
+#if defined(SSM_COUNT_ALLOCS)
+
+// GCC sees the replacements inlined into the standard containers, and warns
+// that their free() doesn't match operator new. Here it does.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size) {
+  ssm::heap_allocation_counter().fetch_add(1, std::memory_order_relaxed);
+  if (size == 0)
+    size = 1;
+  void* p = std::malloc(size);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  std::free(p);
+}
+
+#if defined(__cpp_aligned_new)
+void* operator new(size_t size, std::align_val_t align) {
+  ssm::heap_allocation_counter().fetch_add(1, std::memory_order_relaxed);
+  size_t a = static_cast<size_t>(align);
+  void* p = std::aligned_alloc(a, (size + a - 1) / a * a);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+  return operator new(size, align);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+#endif
+
+#endif  // SSM_COUNT_ALLOCS
+
+#endif  // ALLOC_COUNTER_H_
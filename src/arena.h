@@ -0,0 +1,186 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace ssm {
+
+// Bump allocator over a chain of blocks. Allocation moves a pointer along the
+// current block, and nothing is freed on its own: reset() drops everything at
+// once and destroys, in reverse order, the objects make() created that have
+// destructors.
+//
+// It's meant for two lifetimes. One arena for the whole simulation holds what
+// used to be a new per body or thread. Another is reset() at the top of each
+// step and holds that step's scratch: reset() keeps the blocks, so once one
+// step has sized them no later step touches the heap. For structures rebuilt
+// every step, such as a tree's nodes, that's one pointer bump per node.
+//
+// Not thread safe. Give each thread its own.
+class Arena {
+ public:
+  explicit Arena(size_t block_size = 64 * 1024) : block_size_(block_size) { }
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  ~Arena() {
+    reset();
+    Block* b = head_;
+    while (b != nullptr) {
+      Block* next = b->next;
+      ::operator delete(b);
+      b = next;
+    }
+  }
+
+  // bytes of uninitialized memory aligned to align, a power of two. Requests
+  // larger than the block size get a block of their own.
+  void* allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+    for (;;) {
+      if (cur_ != nullptr) {
+        uintptr_t p = (reinterpret_cast<uintptr_t>(ptr_) + align - 1) &
+                      ~static_cast<uintptr_t>(align - 1);
+        if (p + bytes <= reinterpret_cast<uintptr_t>(cur_->end())) {
+          ptr_ = reinterpret_cast<char*>(p + bytes);
+          used_ += bytes;
+          return reinterpret_cast<void*>(p);
+        }
+      }
+      next_block(bytes + align);
+    }
+  }
+
+  // A T built from args. Its destructor runs on reset(), if it has one.
+  template <typename T, typename... Args>
+  T* make(Args&&... args) {
+    void* p = allocate(sizeof(T), alignof(T));
+    T* obj = new (p) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      void* d = allocate(sizeof(Dtor), alignof(Dtor));
+      dtors_ = new (d) Dtor{ dtors_, obj, [](void* o) {
+        static_cast<T*>(o)->~T();
+      } };
+    }
+    return obj;
+  }
+
+  // n value-initialized Ts, for arrays of plain data.
+  template <typename T>
+  T* make_array(size_t n) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "make_array is for types without destructors");
+    T* p = static_cast<T*>(allocate(sizeof(T) * n, alignof(T)));
+    for (size_t i = 0; i < n; i++) {
+      new (p + i) T();
+    }
+    return p;
+  }
+
+  // Destroy everything made and start over from the first block. Blocks are
+  // kept for reuse.
+  void reset() {
+    while (dtors_ != nullptr) {
+      Dtor* d = dtors_;
+      dtors_ = d->next;
+      d->fn(d->obj);
+    }
+    cur_ = head_;
+    ptr_ = cur_ != nullptr ? cur_->begin() : nullptr;
+    used_ = 0;
+  }
+
+  // Bytes handed out since the last reset().
+  inline size_t used() const { return used_; }
+  // Bytes held in blocks.
+  inline size_t capacity() const { return capacity_; }
+  // Blocks taken from the heap over the arena's life.
+  inline size_t blocks() const { return blocks_; }
+
+ private:
+  struct Block {
+    Block* next;
+    size_t size;
+    inline char* begin() { return reinterpret_cast<char*>(this + 1); }
+    inline char* end() { return begin() + size; }
+  };
+
+  struct Dtor {
+    Dtor* next;
+    void* obj;
+    void (*fn)(void*);
+  };
+
+  // Move to the next kept block that can hold bytes, or add one.
+  void next_block(size_t bytes) {
+    Block* prev = cur_;
+    Block* b = cur_ != nullptr ? cur_->next : head_;
+    while (b != nullptr && b->size < bytes) {
+      prev = b;
+      b = b->next;
+    }
+    if (b == nullptr) {
+      size_t size = bytes > block_size_ ? bytes : block_size_;
+      b = static_cast<Block*>(::operator new(sizeof(Block) + size));
+      b->next = nullptr;
+      b->size = size;
+      capacity_ += size;
+      blocks_++;
+      if (prev != nullptr)
+        prev->next = b;
+      else
+        head_ = b;
+    }
+    cur_ = b;
+    ptr_ = b->begin();
+  }
+
+  size_t block_size_;
+  Block* head_ = nullptr;
+  Block* cur_ = nullptr;
+  char* ptr_ = nullptr;
+  Dtor* dtors_ = nullptr;
+  size_t used_ = 0;
+  size_t capacity_ = 0;
+  size_t blocks_ = 0;
+};
+
+// Standard allocator over an Arena, for containers that live no longer than
+// it. deallocate() does nothing; the memory comes back on reset().
+template <typename T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+
+  explicit ArenaAllocator(Arena* arena) : arena_(arena) { }
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& o) : arena_(o.arena()) { }
+
+  inline T* allocate(size_t n) {
+    return static_cast<T*>(arena_->allocate(sizeof(T) * n, alignof(T)));
+  }
+  inline void deallocate(T*, size_t) { }
+
+  inline Arena* arena() const { return arena_; }
+
+ private:
+  Arena* arena_;
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() != b.arena();
+}
+
+}  // namespace ssm
+
+#endif  // ARENA_H_
@@ -0,0 +1,627 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++17 -pthread -o bench bench.cc
+//
+// Benchmark every engine and integrator on the same generated systems, from
+// 2 bodies up to millions, and report ns/step, body pairs per second, energy
+// error and state size as a table and as CSV.
+//
+// Each engine is the force loop and body layout of one of the programs:
+//
+//   planets    planets.cc: ssm::Vector per body, each pair visited once
+//   planets2   planets2.cc: ssm::Vector per body, every body against all
+//   threaded   planets-threaded.cc: planets2's loop with bodies split over
+//              threads
+//   nbody      nbody.h: flat arrays, each pair visited once (the Node addon
+//              and libplanetary)
+//   static     static_system.h: nbody's loop unrolled for a body count fixed
+//              at compile time, as planets2 --static. Only built for 2, 10
+//              and 14 bodies; other sizes are skipped.
+//   soa        engine.h with a column per coordinate, each pair visited once
+//   mixed      soa's layout with every body against all, with the distance
+//              terms in float (mixed_precision.h), built for the SSE2, AVX2
+//              or AVX-512 level given by --kernel
+//
+// All but static are configurations of the engine.h template, so they run the
+// same code as the programs that use it.
+//
+// and each integrator is one way of stepping them:
+//
+//   taylor     the programs' own: x += v dt + a dt^2 / 2, v += a dt
+//   verlet     velocity Verlet (kick, drift, kick), as in particles.h
+//
+// both from engine.h.
+//
+// Every run starts with untimed warm-up steps, which also size the timed
+// batches so each takes at least --min-time. The median, minimum and standard
+// deviation over --repeat batches are reported. Sizes whose step would take
+// longer than --max-step, extrapolated from the last size, are skipped.
+//
+// The energy error is measured apart from the timing, from the starting state
+// after --energy-steps steps, so every engine is compared over the same
+// simulated time however many steps its timed batches took.
+
+#include "utils.h"
+#include "alloc_counter.h"
+#include "deps/cxxopts.h"
+#include "checkpoint.h"
+#include "kepler.h"
+#include "math_vector.h"
+#include "engine.h"
+#include "mixed_precision.h"
+#include "nbody.h"
+#include "static_system.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using ssm::Checkpoint;
+using ssm::Vector;
+using std::string;
+using std::vector;
+
+cxxopts::Options* retrieve_options() {
+  auto options = new cxxopts::Options(
+      "bench", "Benchmark every engine and integrator across system sizes");
+  options->add_options()
+    ("h,help", "print help")
+    ("e,engines",
+     "engines to run: planets, planets2, threaded, nbody, static, soa, "
+     "mixed",
+     cxxopts::value<vector<string>>()->default_value(
+         "planets,planets2,threaded,nbody"))
+    ("i,integrators",
+     "integrators to run: taylor, verlet",
+     cxxopts::value<vector<string>>()->default_value("taylor,verlet"))
+    ("n,sizes",
+     "numbers of bodies, including the sun",
+     cxxopts::value<vector<size_t>>()->default_value(
+         "2,10,100,1000,10000,100000,1000000"))
+    ("s,step",
+     "seconds per step",
+     cxxopts::value<double>()->default_value("3600"))
+    ("r,repeat",
+     "timed batches per run",
+     cxxopts::value<size_t>()->default_value("5"))
+    ("w,warmup",
+     "untimed steps before timing",
+     cxxopts::value<size_t>()->default_value("3"))
+    ("min-time",
+     "minimum seconds per timed batch",
+     cxxopts::value<double>()->default_value("0.1"))
+    ("max-step",
+     "skip sizes where one step would take longer than this many seconds",
+     cxxopts::value<double>()->default_value("5"))
+    ("energy-max",
+     "only measure energy error up to this many bodies",
+     cxxopts::value<size_t>()->default_value("20000"))
+    ("energy-steps",
+     "steps to measure energy error over, 0 to skip it",
+     cxxopts::value<size_t>()->default_value("100"))
+    ("threads",
+     "threads for the threaded engine (0 for every core)",
+     cxxopts::value<size_t>()->default_value("0"))
+    ("kernel",
+     "instruction set for the mixed engine: auto, sse2, avx2, avx512",
+     cxxopts::value<string>()->default_value("auto"))
+    ("o,output",
+     "write CSV here instead of after the table",
+     cxxopts::value<string>()->default_value(""));
+  return options;
+}
+
+
+// Interface the integrators drive. Each engine keeps bodies in its own layout.
+class Engine {
+ public:
+  virtual ~Engine() { }
+  virtual void load(const Checkpoint& cp) = 0;
+  // Copy positions and velocities back out, to measure energy.
+  virtual void store(Checkpoint* cp) const = 0;
+  virtual void accelerate() = 0;
+  // x += v * dt + a * c
+  virtual void drift(double dt, double c) = 0;
+  // v += a * dt
+  virtual void kick(double dt) = 0;
+  // Bytes of body state held.
+  virtual size_t bytes() const = 0;
+};
+
+
+// An engine.h configuration that owns its bodies.
+template <typename E>
+class PolicyEngine : public Engine {
+ public:
+  explicit PolicyEngine(size_t threads = 0) { set_threads(&e_, threads); }
+
+  void load(const Checkpoint& cp) override {
+    e_.resize(cp.count());
+    for (size_t i = 0; i < cp.count(); i++) {
+      e_.set_mass(i, cp.mass[i]);
+      for (size_t k = 0; k < 3; k++) {
+        e_.pos(i, k) = cp.pos[i * 3 + k];
+        e_.vel(i, k) = cp.vel[i * 3 + k];
+        e_.acc(i, k) = 0;
+      }
+    }
+  }
+
+  void store(Checkpoint* cp) const override {
+    for (size_t i = 0; i < e_.count(); i++) {
+      for (size_t k = 0; k < 3; k++) {
+        cp->pos[i * 3 + k] = e_.pos(i, k);
+        cp->vel[i * 3 + k] = e_.vel(i, k);
+      }
+    }
+  }
+
+  void accelerate() override { e_.accelerate(); }
+  void drift(double dt, double c) override { e_.drift(dt, c); }
+  void kick(double dt) override { e_.kick(dt); }
+
+  size_t bytes() const override { return e_.count() * sizeof(double) * 10; }
+
+ private:
+  template <typename L, typename F, typename I>
+  static void set_threads(ssm::Engine<L, F, I, ssm::ThreadPool>* e,
+                          size_t threads) {
+    e->parallel().set_threads(threads);
+  }
+  static void set_threads(void*, size_t) { }
+
+  E e_;
+};
+
+// planets.cc's SolarSystem::step(): a struct of Vectors per body, each pair
+// once.
+using PlanetsEngine = PolicyEngine<ssm::Engine<ssm::AoSLayout, ssm::PairForce>>;
+// planets2.cc's System::accelerate(): a packed struct of Vectors per body,
+// every body against all. threaded splits the bodies over a pool, as
+// planets-threaded.cc does.
+using Planets2Engine =
+    PolicyEngine<ssm::Engine<ssm::AoSLayout, ssm::AllForce>>;
+using ThreadedEngine = PolicyEngine<
+    ssm::Engine<ssm::AoSLayout, ssm::AllForce, ssm::TaylorStep,
+                ssm::ThreadPool>>;
+// Coordinate columns, each pair once, and mixed precision forces.
+using SoAEngine = PolicyEngine<ssm::Engine<ssm::SoALayout, ssm::PairForce>>;
+using MixedEngine = PolicyEngine<ssm::Engine<ssm::SoALayout, ssm::MixedForce>>;
+
+
+class NBodyEngine : public Engine {
+ public:
+  void load(const Checkpoint& cp) override {
+    mass_ = cp.mass;
+    pos_ = cp.pos;
+    vel_ = cp.vel;
+    acc_.assign(cp.acc.size(), 0);
+    nbody_.reset(new ssm::NBody(mass_.size(), mass_.data(), pos_.data(),
+                                vel_.data(), acc_.data()));
+  }
+
+  void store(Checkpoint* cp) const override {
+    cp->pos = pos_;
+    cp->vel = vel_;
+  }
+
+  void accelerate() override { nbody_->accelerate(); }
+
+  void drift(double dt, double c) override {
+    for (size_t i = 0; i < pos_.size(); i++) {
+      pos_[i] += vel_[i] * dt + acc_[i] * c;
+    }
+  }
+
+  void kick(double dt) override {
+    for (size_t i = 0; i < vel_.size(); i++) {
+      vel_[i] += acc_[i] * dt;
+    }
+  }
+
+  size_t bytes() const override {
+    return mass_.size() * sizeof(double) * 10;
+  }
+
+ private:
+  vector<double> mass_;
+  vector<double> pos_;
+  vector<double> vel_;
+  vector<double> acc_;
+  std::unique_ptr<ssm::NBody> nbody_;
+};
+
+
+template <size_t N>
+class FixedEngine : public Engine {
+ public:
+  void load(const Checkpoint& cp) override {
+    for (size_t i = 0; i < N; i++) {
+      const double* p = &cp.pos[i * 3];
+      const double* v = &cp.vel[i * 3];
+      fs_.set_gm(i, G * cp.mass[i]);
+      fs_.pos(i).set(p[0], p[1], p[2]);
+      fs_.vel(i).set(v[0], v[1], v[2]);
+      fs_.acc(i).zero();
+    }
+  }
+
+  void store(Checkpoint* cp) const override {
+    for (size_t i = 0; i < N; i++) {
+      for (size_t k = 0; k < 3; k++) {
+        cp->pos[i * 3 + k] = fs_.pos(i)[k];
+        cp->vel[i * 3 + k] = fs_.vel(i)[k];
+      }
+    }
+  }
+
+  void accelerate() override { fs_.accelerate(); }
+
+  void drift(double dt, double c) override {
+    for (size_t i = 0; i < N; i++) {
+      fs_.pos(i) += fs_.vel(i) * dt + fs_.acc(i) * c;
+    }
+  }
+
+  void kick(double dt) override {
+    for (size_t i = 0; i < N; i++) {
+      fs_.vel(i) += fs_.acc(i) * dt;
+    }
+  }
+
+  size_t bytes() const override { return sizeof(fs_); }
+
+ private:
+  ssm::StaticSystem<N> fs_;
+};
+
+// Picks the FixedEngine for the system's size on load().
+class StaticEngine : public Engine {
+ public:
+  static bool supports(size_t n) { return n == 2 || n == 10 || n == 14; }
+
+  void load(const Checkpoint& cp) override {
+    switch (cp.count()) {
+      case 2: impl_.reset(new FixedEngine<2>()); break;
+      case 10: impl_.reset(new FixedEngine<10>()); break;
+      case 14: impl_.reset(new FixedEngine<14>()); break;
+    }
+    impl_->load(cp);
+  }
+
+  void store(Checkpoint* cp) const override { impl_->store(cp); }
+  void accelerate() override { impl_->accelerate(); }
+  void drift(double dt, double c) override { impl_->drift(dt, c); }
+  void kick(double dt) override { impl_->kick(dt); }
+  size_t bytes() const override { return impl_->bytes(); }
+
+ private:
+  std::unique_ptr<Engine> impl_;
+};
+
+
+static Engine* make_engine(const string& name, size_t threads) {
+  if (name == "planets")
+    return new PlanetsEngine();
+  if (name == "planets2")
+    return new Planets2Engine();
+  if (name == "threaded")
+    return new ThreadedEngine(threads);
+  if (name == "soa")
+    return new SoAEngine();
+  if (name == "mixed")
+    return new MixedEngine();
+  if (name == "nbody")
+    return new NBodyEngine();
+  if (name == "static")
+    return new StaticEngine();
+  return nullptr;
+}
+
+
+// Steps the engine with one of the integrators from engine.h.
+class Integrator {
+ public:
+  Integrator(Engine* engine, bool verlet, double dt)
+    : engine_(engine), verlet_(verlet), dt_(dt) { }
+
+  void run(uint64_t steps) {
+    for (uint64_t s = 0; s < steps; s++) {
+      if (verlet_)
+        verlet_step_.step(*engine_, dt_);
+      else
+        taylor_step_.step(*engine_, dt_);
+    }
+  }
+
+ private:
+  Engine* engine_;
+  bool verlet_;
+  double dt_;
+  ssm::TaylorStep taylor_step_;
+  ssm::VerletStep verlet_step_;
+};
+
+
+// The sun and n - 1 bodies on random orbits between 0.4 and 30 AU, with masses
+// from asteroids to super-earths. The same n always gives the same system.
+static void generate(size_t n, Checkpoint* cp) {
+  std::mt19937_64 rng(n);
+  std::uniform_real_distribution<double> semi_major(0.4 * AU, 30 * AU);
+  std::uniform_real_distribution<double> ecc(0, 0.1);
+  std::uniform_real_distribution<double> incl(0, 5);
+  std::uniform_real_distribution<double> degrees(0, 360);
+  std::uniform_real_distribution<double> anomaly(0, 2 * PI);
+  std::uniform_real_distribution<double> log_mass(18, 26);
+  double sun = 1.9885e30;
+
+  cp->resize(n);
+  cp->names[0] = "sun";
+  cp->mass[0] = sun;
+  for (size_t i = 1; i < n; i++) {
+    cp->names[i] = "b" + std::to_string(i);
+    cp->mass[i] = std::pow(10, log_mass(rng));
+    ssm::kep2cart(G * sun, semi_major(rng), ecc(rng), incl(rng),
+                  degrees(rng), degrees(rng), anomaly(rng),
+                  &cp->pos[i * 3], &cp->vel[i * 3]);
+  }
+}
+
+
+static double energy(const Checkpoint& cp) {
+  size_t n = cp.count();
+  double e = 0;
+  for (size_t i = 0; i < n; i++) {
+    const double* pi = &cp.pos[i * 3];
+    const double* vi = &cp.vel[i * 3];
+    e += 0.5 * cp.mass[i] * (vi[0] * vi[0] + vi[1] * vi[1] + vi[2] * vi[2]);
+    for (size_t j = i + 1; j < n; j++) {
+      const double* pj = &cp.pos[j * 3];
+      double dx = pi[0] - pj[0];
+      double dy = pi[1] - pj[1];
+      double dz = pi[2] - pj[2];
+      e -= G * cp.mass[i] * cp.mass[j] / sqrt(dx * dx + dy * dy + dz * dz);
+    }
+  }
+  return e;
+}
+
+
+struct Result {
+  string engine;
+  string integrator;
+  size_t n = 0;
+  bool skipped = false;
+  uint64_t steps = 0;
+  double median = 0;
+  double min = 0;
+  double stddev = 0;
+  double pairs_sec = 0;
+  double energy_error = NAN;
+  size_t bytes = 0;
+};
+
+
+struct Settings {
+  double step;
+  size_t repeat;
+  size_t warmup;
+  double min_time;
+  size_t energy_max;
+  size_t energy_steps;
+  size_t threads;
+};
+
+
+static void run(const Settings& set, const Checkpoint& system, Result* res) {
+  std::unique_ptr<Engine> engine(make_engine(res->engine, set.threads));
+  Integrator integrator(engine.get(), res->integrator == "verlet", set.step);
+  vector<double> times;
+  uint64_t t;
+
+  engine->load(system);
+  res->bytes = engine->bytes();
+
+  t = hrtime();
+  integrator.run(set.warmup);
+  t = hrtime() - t;
+  res->steps = set.warmup;
+
+  double per_step = set.warmup > 0 ? 1.0 * t / set.warmup : 0;
+  uint64_t batch = per_step > 0 ? set.min_time * 1e9 / per_step : 1;
+  batch = std::max<uint64_t>(1, batch);
+  times.reserve(set.repeat);
+  uint64_t allocs = ssm::heap_allocations();
+  for (size_t r = 0; r < set.repeat; r++) {
+    t = hrtime();
+    integrator.run(batch);
+    times.push_back(1.0 * (hrtime() - t) / batch);
+    res->steps += batch;
+  }
+  allocs = ssm::heap_allocations() - allocs;
+  // Warm-up steps may size buffers; timed ones shouldn't allocate at all.
+  // Only counted in builds with SSM_COUNT_ALLOCS (see alloc_counter.h).
+  if (allocs > 0) {
+    fprintf(stderr, "%s/%s at %lu bodies: %lu heap allocations while "
+            "stepping\n", res->engine.c_str(), res->integrator.c_str(),
+            res->n, allocs);
+  }
+
+  std::sort(times.begin(), times.end());
+  double mean = 0;
+  double var = 0;
+  for (double x : times) {
+    mean += x / times.size();
+  }
+  for (double x : times) {
+    var += (x - mean) * (x - mean) / times.size();
+  }
+  res->min = times.front();
+  res->median = times.size() % 2 == 1 ? times[times.size() / 2] :
+      (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2;
+  res->stddev = std::sqrt(var);
+  res->pairs_sec = 0.5 * system.count() * (system.count() - 1) /
+      (res->median / 1e9);
+
+  // Start again from the same state with a fresh integrator, so the error is
+  // always over energy_steps steps and not over however many were timed.
+  if (set.energy_steps > 0 && system.count() <= set.energy_max) {
+    Integrator fresh(engine.get(), res->integrator == "verlet", set.step);
+    Checkpoint end = system;
+    double e0 = energy(system);
+    engine->load(system);
+    fresh.run(set.energy_steps);
+    engine->store(&end);
+    res->energy_error = std::fabs((energy(end) - e0) / e0);
+  }
+}
+
+
+static void print_csv(FILE* fp, const vector<Result>& results) {
+  fprintf(fp, "engine,integrator,n,steps,ns_step_median,ns_step_min,"
+              "ns_step_stddev,pairs_per_sec,energy_error,state_bytes\n");
+  for (auto& r : results) {
+    if (r.skipped) {
+      fprintf(fp, "%s,%s,%lu,0,,,,,,\n",
+              r.engine.c_str(), r.integrator.c_str(), r.n);
+      continue;
+    }
+    fprintf(fp, "%s,%s,%lu,%lu,%.1f,%.1f,%.1f,%.4g,",
+            r.engine.c_str(), r.integrator.c_str(), r.n, r.steps,
+            r.median, r.min, r.stddev, r.pairs_sec);
+    if (!std::isnan(r.energy_error))
+      fprintf(fp, "%.3e", r.energy_error);
+    fprintf(fp, ",%lu\n", r.bytes);
+  }
+}
+
+
+static void print_row(const Result& r) {
+  if (r.skipped) {
+    printf("%-10s %-8s %9lu   skipped\n",
+           r.engine.c_str(), r.integrator.c_str(), r.n);
+    return;
+  }
+  char energy[32] = "-";
+  if (!std::isnan(r.energy_error))
+    snprintf(energy, sizeof(energy), "%.2e", r.energy_error);
+  printf("%-10s %-8s %9lu %14.1f %6.1f%% %12.3g %12s %10.2f\n",
+         r.engine.c_str(), r.integrator.c_str(), r.n, r.median,
+         r.median > 0 ? 100 * r.stddev / r.median : 0, r.pairs_sec, energy,
+         r.bytes / 1e6);
+  fflush(stdout);
+}
+
+
+int main(int argc, char* argv[]) {
+  cxxopts::Options* options = retrieve_options();
+  auto result = options->parse(argc, argv);
+
+  if (result.count("help")) {
+    printf("%s", options->help({""}).c_str());
+    delete options;
+    return 0;
+  }
+  delete options;
+
+  vector<string> engines = result["engines"].as<vector<string>>();
+  vector<string> integrators = result["integrators"].as<vector<string>>();
+  vector<size_t> sizes = result["sizes"].as<vector<size_t>>();
+  string output = result["output"].as<string>();
+  double max_step = result["max-step"].as<double>();
+  Settings set;
+  set.step = result["step"].as<double>();
+  set.repeat = std::max<size_t>(1, result["repeat"].as<size_t>());
+  set.warmup = result["warmup"].as<size_t>();
+  set.min_time = result["min-time"].as<double>();
+  set.energy_max = result["energy-max"].as<size_t>();
+  set.energy_steps = result["energy-steps"].as<size_t>();
+  set.threads = result["threads"].as<size_t>();
+  string kernel = result["kernel"].as<string>();
+  ssm::SimdLevel level;
+  int err = ssm::parse_simd_level(kernel.c_str(), &level);
+  if (err < 0) {
+    fprintf(stderr, "can't use kernel '%s': %s\n", kernel.c_str(),
+            strerror(-err));
+    return 1;
+  }
+  ssm::set_accel_mixed_level(level);
+
+  for (auto& e : engines) {
+    std::unique_ptr<Engine> engine(make_engine(e, 1));
+    if (engine == nullptr) {
+      fprintf(stderr, "unknown engine '%s'\n", e.c_str());
+      return 1;
+    }
+  }
+  for (auto& i : integrators) {
+    if (i != "taylor" && i != "verlet") {
+      fprintf(stderr, "unknown integrator '%s'\n", i.c_str());
+      return 1;
+    }
+  }
+  std::sort(sizes.begin(), sizes.end());
+  sizes.erase(std::remove(sizes.begin(), sizes.end(), 0), sizes.end());
+
+  printf("kernel: %s (cpu supports up to %s)\n\n", ssm::simd_level_name(level),
+         ssm::simd_level_name(ssm::detect_simd_level()));
+  if (set.energy_steps > 0) {
+    printf("energy error after %lu steps of %g s\n\n", set.energy_steps,
+           set.step);
+  }
+  printf("%-10s %-8s %9s %14s %7s %12s %12s %10s\n",
+         "engine", "integr", "n", "ns/step", "+-", "pairs/s", "energy err",
+         "state MB");
+
+  vector<Result> results;
+  Checkpoint system;
+  for (auto& e : engines) {
+    for (auto& i : integrators) {
+      // Time per step at the last size run, to predict the next.
+      double last_ns = 0;
+      size_t last_n = 0;
+      for (size_t n : sizes) {
+        Result r;
+        r.engine = e;
+        r.integrator = i;
+        r.n = n;
+        double scale = last_n > 0 ? 1.0 * n / last_n : 0;
+        if (last_ns * scale * scale > max_step * 1e9 ||
+            (e == "static" && !StaticEngine::supports(n))) {
+          r.skipped = true;
+        } else {
+          if (system.count() != n)
+            generate(n, &system);
+          run(set, system, &r);
+          last_ns = r.median;
+          last_n = n;
+        }
+        print_row(r);
+        results.push_back(r);
+      }
+    }
+  }
+
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  printf("peak rss: %.1f MB\n\n", ru.ru_maxrss / 1e3);
+
+  if (output.empty()) {
+    print_csv(stdout, results);
+    return 0;
+  }
+  FILE* fp = fopen(output.c_str(), "w");
+  if (fp == nullptr) {
+    fprintf(stderr, "can't open '%s': %s\n", output.c_str(), strerror(errno));
+    return 1;
+  }
+  print_csv(fp, results);
+  fclose(fp);
+  return 0;
+}
@@ -0,0 +1,510 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++17 -o bench_vector bench_vector.cc
+//
+// Microbenchmarks for each vector operation the engines use, in every vector
+// representation in the tree:
+//
+//   ssm        ssm::Vector from math_vector.h (vector-math.h's Vector is the
+//              same type)
+//   soa        plain x, y and z arrays, written out by hand
+//   xsimd      xs::batch<double, 4> per vector, as in planets-xsimd.cc (only
+//              when xsimd is installed)
+//
+// Each kernel runs one operation over COUNT vectors that stay in L1, and is
+// kept out of line under its own symbol (bv_<variant>_<op>). Results are per
+// operation: nanoseconds, cycles and retired instructions from the CPU's
+// counters (or TSC ticks if perf events aren't allowed), and the number of
+// instructions the compiler generated for the kernel, read back from the
+// binary with objdump. A change to a header that makes a kernel slower or
+// bigger shows up in the last two columns even when timings are noisy.
+
+#include "utils.h"
+#include "deps/cxxopts.h"
+#include "math_vector.h"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#if __has_include(<xsimd/xsimd.hpp>)
+#include <xsimd/xsimd.hpp>
+#define BENCH_XSIMD 1
+namespace xs = xsimd;
+using db_batch = xs::batch<double, 4>;
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+constexpr size_t COUNT = 1024;
+
+// Every kernel's inputs and outputs. Global so the kernels can't be folded
+// away and the arrays sit at fixed, aligned addresses.
+struct Data {
+  ssm::Vector sa[COUNT];
+  ssm::Vector sb[COUNT];
+  ssm::Vector so[COUNT];
+  alignas(64) double ax[COUNT];
+  alignas(64) double ay[COUNT];
+  alignas(64) double az[COUNT];
+  alignas(64) double bx[COUNT];
+  alignas(64) double by[COUNT];
+  alignas(64) double bz[COUNT];
+  alignas(64) double ox[COUNT];
+  alignas(64) double oy[COUNT];
+  alignas(64) double oz[COUNT];
+  alignas(64) double r[COUNT];
+#ifdef BENCH_XSIMD
+  alignas(32) db_batch xa[COUNT];
+  alignas(32) db_batch xb[COUNT];
+  alignas(32) db_batch xo[COUNT];
+#endif
+  double s = 1.0000001;
+  double m = 5.97e24;
+};
+
+static Data data;
+
+
+#define KERNEL extern "C" __attribute__((noinline)) void
+
+// ssm::Vector
+KERNEL bv_ssm_add(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    d->so[i] = d->sa[i] + d->sb[i];
+  }
+}
+KERNEL bv_ssm_mul(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    d->so[i] = d->sa[i] * d->s;
+  }
+}
+KERNEL bv_ssm_mag_sq(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    d->r[i] = d->sa[i].mag_sq(d->sb[i]);
+  }
+}
+KERNEL bv_ssm_len(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    d->r[i] = d->sa[i].len();
+  }
+}
+KERNEL bv_ssm_dot(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    d->r[i] = d->sa[i].dot(d->sb[i]);
+  }
+}
+KERNEL bv_ssm_angle(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    d->r[i] = d->sa[i].angle_rad(d->sb[i]);
+  }
+}
+// The line in SystemBody::update_acceleration() in planets2.cc.
+KERNEL bv_ssm_accel(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    const ssm::Vector& p = d->sb[i];
+    double rsq = d->sa[i].mag_sq(p);
+    d->so[i] += -G * d->m / (rsq * sqrt(rsq)) * (d->sa[i] - p);
+  }
+}
+
+// Structure of arrays.
+KERNEL bv_soa_add(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    d->ox[i] = d->ax[i] + d->bx[i];
+    d->oy[i] = d->ay[i] + d->by[i];
+    d->oz[i] = d->az[i] + d->bz[i];
+  }
+}
+KERNEL bv_soa_mul(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    d->ox[i] = d->ax[i] * d->s;
+    d->oy[i] = d->ay[i] * d->s;
+    d->oz[i] = d->az[i] * d->s;
+  }
+}
+KERNEL bv_soa_mag_sq(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    double dx = d->ax[i] - d->bx[i];
+    double dy = d->ay[i] - d->by[i];
+    double dz = d->az[i] - d->bz[i];
+    d->r[i] = dx * dx + dy * dy + dz * dz;
+  }
+}
+KERNEL bv_soa_len(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    d->r[i] = sqrt(d->ax[i] * d->ax[i] + d->ay[i] * d->ay[i] +
+                   d->az[i] * d->az[i]);
+  }
+}
+KERNEL bv_soa_dot(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    d->r[i] = d->ax[i] * d->bx[i] + d->ay[i] * d->by[i] + d->az[i] * d->bz[i];
+  }
+}
+KERNEL bv_soa_angle(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    double dot = d->ax[i] * d->bx[i] + d->ay[i] * d->by[i] +
+                 d->az[i] * d->bz[i];
+    double la = d->ax[i] * d->ax[i] + d->ay[i] * d->ay[i] + d->az[i] * d->az[i];
+    double lb = d->bx[i] * d->bx[i] + d->by[i] * d->by[i] + d->bz[i] * d->bz[i];
+    d->r[i] = acos(dot / (sqrt(la) * sqrt(lb)));
+  }
+}
+KERNEL bv_soa_accel(Data* d) {
+  double gm = -G * d->m;
+  for (size_t i = 0; i < COUNT; i++) {
+    double dx = d->ax[i] - d->bx[i];
+    double dy = d->ay[i] - d->by[i];
+    double dz = d->az[i] - d->bz[i];
+    double rsq = dx * dx + dy * dy + dz * dz;
+    double f = gm / (rsq * sqrt(rsq));
+    d->ox[i] += f * dx;
+    d->oy[i] += f * dy;
+    d->oz[i] += f * dz;
+  }
+}
+
+#ifdef BENCH_XSIMD
+// One batch per vector with the fourth lane zero, as planets-xsimd.cc stores
+// bodies.
+KERNEL bv_xsimd_add(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    d->xo[i] = d->xa[i] + d->xb[i];
+  }
+}
+KERNEL bv_xsimd_mul(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    d->xo[i] = d->xa[i] * d->s;
+  }
+}
+KERNEL bv_xsimd_mag_sq(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    db_batch diff = d->xa[i] - d->xb[i];
+    d->r[i] = xs::hadd(diff * diff);
+  }
+}
+KERNEL bv_xsimd_len(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    d->r[i] = sqrt(xs::hadd(d->xa[i] * d->xa[i]));
+  }
+}
+KERNEL bv_xsimd_dot(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    d->r[i] = xs::hadd(d->xa[i] * d->xb[i]);
+  }
+}
+KERNEL bv_xsimd_angle(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    double dot = xs::hadd(d->xa[i] * d->xb[i]);
+    double la = xs::hadd(d->xa[i] * d->xa[i]);
+    double lb = xs::hadd(d->xb[i] * d->xb[i]);
+    d->r[i] = acos(dot / (sqrt(la) * sqrt(lb)));
+  }
+}
+KERNEL bv_xsimd_accel(Data* d) {
+  for (size_t i = 0; i < COUNT; i++) {
+    db_batch diff = d->xa[i] - d->xb[i];
+    double rsq = xs::hadd(diff * diff);
+    d->xo[i] += (-G * d->m / (rsq * sqrt(rsq))) * diff;
+  }
+}
+#endif
+
+
+struct Kernel {
+  const char* variant;
+  const char* op;
+  const char* symbol;
+  void (*fn)(Data*);
+};
+
+#define K(v, o) { #v, #o, "bv_" #v "_" #o, bv_##v##_##o }
+
+static const Kernel kernels[] = {
+  K(ssm, add), K(ssm, mul), K(ssm, mag_sq), K(ssm, len), K(ssm, dot),
+  K(ssm, angle), K(ssm, accel),
+  K(soa, add), K(soa, mul), K(soa, mag_sq), K(soa, len), K(soa, dot),
+  K(soa, angle), K(soa, accel),
+#ifdef BENCH_XSIMD
+  K(xsimd, add), K(xsimd, mul), K(xsimd, mag_sq), K(xsimd, len),
+  K(xsimd, dot), K(xsimd, angle), K(xsimd, accel),
+#endif
+};
+
+#undef K
+
+
+// User space cycle and instruction counters for this thread, read as a group.
+// Falls back to TSC ticks, and no instruction count, where perf events aren't
+// allowed.
+class Counters {
+ public:
+  Counters() {
+    cycles_fd_ = open_counter(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (cycles_fd_ >= 0)
+      insns_fd_ = open_counter(PERF_COUNT_HW_INSTRUCTIONS, cycles_fd_);
+    if (insns_fd_ < 0 && cycles_fd_ >= 0) {
+      close(cycles_fd_);
+      cycles_fd_ = -1;
+    }
+    if (cycles_fd_ >= 0) {
+      ioctl(cycles_fd_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(cycles_fd_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+  }
+
+  ~Counters() {
+    if (insns_fd_ >= 0)
+      close(insns_fd_);
+    if (cycles_fd_ >= 0)
+      close(cycles_fd_);
+  }
+
+  inline bool perf() const { return cycles_fd_ >= 0; }
+
+  // cycles (or TSC ticks) and instructions so far.
+  void read(uint64_t* cycles, uint64_t* insns) const {
+    *cycles = 0;
+    *insns = 0;
+    if (perf()) {
+      uint64_t buf[3];
+      if (::read(cycles_fd_, buf, sizeof(buf)) == sizeof(buf)) {
+        *cycles = buf[1];
+        *insns = buf[2];
+      }
+      return;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    *cycles = __rdtsc();
+#endif
+  }
+
+ private:
+  static int open_counter(uint64_t config, int group) {
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+  }
+
+  int cycles_fd_ = -1;
+  int insns_fd_ = -1;
+};
+
+
+// Instructions generated for each bv_ kernel, counted from objdump's
+// disassembly of this binary. Empty if objdump isn't available.
+static std::map<string, size_t> static_insns(const char* self) {
+  std::map<string, size_t> counts;
+  string cmd = string("objdump -d --no-show-raw-insn ") + self + " 2>/dev/null";
+  FILE* fp = popen(cmd.c_str(), "r");
+  if (fp == nullptr)
+    return counts;
+  char line[512];
+  string current;
+  while (fgets(line, sizeof(line), fp) != nullptr) {
+    const char* open = strchr(line, '<');
+    if (open != nullptr && strstr(line, ">:") != nullptr) {
+      const char* close = strchr(open, '>');
+      current.assign(open + 1, close);
+      if (current.compare(0, 3, "bv_") != 0)
+        current.clear();
+    } else if (!current.empty() && line[0] == ' ' && strchr(line, ':')) {
+      counts[current]++;
+    } else if (line[0] == '\n') {
+      current.clear();
+    }
+  }
+  pclose(fp);
+  return counts;
+}
+
+
+static void fill() {
+  for (size_t i = 0; i < COUNT; i++) {
+    double a[3] = { 1e11 + i * 1e7, 2e10 - i * 3e6, 4e9 + i * 1e5 };
+    double b[3] = { -3e10 + i * 2e6, 7e10 + i * 5e6, -1e9 - i * 2e5 };
+    data.sa[i].set(a[0], a[1], a[2]);
+    data.sb[i].set(b[0], b[1], b[2]);
+    data.ax[i] = a[0];
+    data.ay[i] = a[1];
+    data.az[i] = a[2];
+    data.bx[i] = b[0];
+    data.by[i] = b[1];
+    data.bz[i] = b[2];
+#ifdef BENCH_XSIMD
+    data.xa[i] = db_batch(a[0], a[1], a[2], 0);
+    data.xb[i] = db_batch(b[0], b[1], b[2], 0);
+#endif
+  }
+}
+
+
+cxxopts::Options* retrieve_options() {
+  auto options = new cxxopts::Options(
+      "bench_vector", "Microbenchmark vector operations in every layout");
+  options->add_options()
+    ("h,help", "print help")
+    ("v,variants",
+     "only these variants (ssm, soa, xsimd)",
+     cxxopts::value<vector<string>>()->default_value(""))
+    ("ops",
+     "only these operations (add, mul, mag_sq, len, dot, angle, accel)",
+     cxxopts::value<vector<string>>()->default_value(""))
+    ("r,repeat",
+     "timed batches per kernel; the median is reported",
+     cxxopts::value<size_t>()->default_value("11"))
+    ("min-time",
+     "minimum seconds per timed batch",
+     cxxopts::value<double>()->default_value("0.01"))
+    ("o,output",
+     "also write the results as CSV here",
+     cxxopts::value<string>()->default_value(""));
+  return options;
+}
+
+
+struct Result {
+  const Kernel* kernel;
+  double ns;
+  double cycles;
+  double insns;
+  size_t static_insns;
+};
+
+
+static bool selected(const vector<string>& list, const char* name) {
+  if (list.empty() || (list.size() == 1 && list[0].empty()))
+    return true;
+  return std::find(list.begin(), list.end(), name) != list.end();
+}
+
+
+static double median(vector<double> v) {
+  std::sort(v.begin(), v.end());
+  return v[v.size() / 2];
+}
+
+
+int main(int argc, char* argv[]) {
+  cxxopts::Options* options = retrieve_options();
+  auto result = options->parse(argc, argv);
+
+  if (result.count("help")) {
+    printf("%s", options->help({""}).c_str());
+    delete options;
+    return 0;
+  }
+  delete options;
+
+  vector<string> variants = result["variants"].as<vector<string>>();
+  vector<string> ops = result["ops"].as<vector<string>>();
+  size_t repeat = std::max<size_t>(1, result["repeat"].as<size_t>());
+  double min_time = result["min-time"].as<double>();
+  string output = result["output"].as<string>();
+
+  Counters counters;
+  char self[4096];
+  ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  self[len > 0 ? len : 0] = '\0';
+  std::map<string, size_t> sizes = static_insns(self);
+  vector<Result> results;
+
+  fill();
+  printf("%-6s %-7s %9s %9s %9s %9s\n", "layout", "op", "ns/op",
+         counters.perf() ? "cycles/op" : "tsc/op",
+         counters.perf() ? "insns/op" : "", "insns");
+
+  for (auto& k : kernels) {
+    if (!selected(variants, k.variant) || !selected(ops, k.op))
+      continue;
+
+    // Warm up, and size batches to min_time.
+    uint64_t calls = 1;
+    for (;;) {
+      uint64_t t = hrtime();
+      for (uint64_t c = 0; c < calls; c++) {
+        k.fn(&data);
+      }
+      if (hrtime() - t > min_time * 1e9)
+        break;
+      calls *= 2;
+    }
+
+    vector<double> ns;
+    vector<double> cycles;
+    vector<double> insns;
+    double ops_per_batch = 1.0 * calls * COUNT;
+    for (size_t r = 0; r < repeat; r++) {
+      uint64_t c0;
+      uint64_t i0;
+      uint64_t c1;
+      uint64_t i1;
+      counters.read(&c0, &i0);
+      uint64_t t = hrtime();
+      for (uint64_t c = 0; c < calls; c++) {
+        k.fn(&data);
+      }
+      t = hrtime() - t;
+      counters.read(&c1, &i1);
+      ns.push_back(t / ops_per_batch);
+      cycles.push_back((c1 - c0) / ops_per_batch);
+      insns.push_back((i1 - i0) / ops_per_batch);
+    }
+
+    Result res = { &k, median(ns), median(cycles), median(insns), 0 };
+    auto it = sizes.find(k.symbol);
+    if (it != sizes.end())
+      res.static_insns = it->second;
+    results.push_back(res);
+
+    printf("%-6s %-7s %9.3f %9.2f ", k.variant, k.op, res.ns, res.cycles);
+    if (counters.perf())
+      printf("%9.2f ", res.insns);
+    else
+      printf("%9s ", "");
+    if (res.static_insns > 0)
+      printf("%9lu\n", res.static_insns);
+    else
+      printf("%9s\n", "-");
+  }
+
+  if (output.empty())
+    return 0;
+  FILE* fp = fopen(output.c_str(), "w");
+  if (fp == nullptr) {
+    fprintf(stderr, "can't open '%s': %s\n", output.c_str(), strerror(errno));
+    return 1;
+  }
+  fprintf(fp, "variant,op,ns_op,%s,insns_op,static_insns\n",
+          counters.perf() ? "cycles_op" : "tsc_op");
+  for (auto& r : results) {
+    fprintf(fp, "%s,%s,%.4f,%.3f,", r.kernel->variant, r.kernel->op, r.ns,
+            r.cycles);
+    if (counters.perf())
+      fprintf(fp, "%.3f", r.insns);
+    fprintf(fp, ",%lu\n", r.static_insns);
+  }
+  fclose(fp);
+  return 0;
+}
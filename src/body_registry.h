@@ -0,0 +1,103 @@
+#ifndef BODY_REGISTRY_H_
+#define BODY_REGISTRY_H_
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ssm {
+
+using BodyId = uint32_t;
+constexpr BodyId NO_BODY = UINT32_MAX;
+
+// Stable ids and names for bodies kept in dense arrays. The caller keeps its
+// per body arrays (positions, masses, ...) in slot order, 0 to size() - 1,
+// and the registry maps between slots, ids and names, each in O(1):
+//
+//   - An id is handed out by add() and never reused, so it stays valid to
+//     log or look up after other bodies come and go.
+//   - remove() fills the freed slot with the body from the last slot, so the
+//     arrays stay dense without shifting anything. The caller does the same
+//     to its own arrays, with swap_remove().
+//
+// Names are unique.
+class BodyRegistry {
+ public:
+  // Register name in slot size(). Returns -EEXIST if the name is taken.
+  int add(const std::string& name, BodyId* id) {
+    if (by_name_.find(name) != by_name_.end())
+      return -EEXIST;
+    BodyId next = static_cast<BodyId>(names_.size());
+    by_name_.emplace(name, next);
+    names_.push_back(name);
+    slot_of_.push_back(ids_.size());
+    ids_.push_back(next);
+    *id = next;
+    return 0;
+  }
+
+  // Unregister id, and set *slot to the slot it was in. The body in the last
+  // slot, if that wasn't id, is now in *slot. Returns -ENOENT if id isn't
+  // registered.
+  int remove(BodyId id, size_t* slot) {
+    if (!contains(id))
+      return -ENOENT;
+    size_t s = slot_of_[id];
+    BodyId last = ids_.back();
+    ids_[s] = last;
+    slot_of_[last] = s;
+    ids_.pop_back();
+    slot_of_[id] = NO_SLOT;
+    by_name_.erase(names_[id]);
+    *slot = s;
+    return 0;
+  }
+
+  // Id of the body called name, or NO_BODY.
+  inline BodyId find(const std::string& name) const {
+    auto it = by_name_.find(name);
+    return it == by_name_.end() ? NO_BODY : it->second;
+  }
+
+  inline bool contains(BodyId id) const {
+    return id < slot_of_.size() && slot_of_[id] != NO_SLOT;
+  }
+
+  // Slot of a registered id.
+  inline size_t slot(BodyId id) const { return slot_of_[id]; }
+  // Id of the body in slot.
+  inline BodyId id(size_t slot) const { return ids_[slot]; }
+  // Name of any id ever handed out, registered or not.
+  inline const std::string& name(BodyId id) const { return names_[id]; }
+  // Bodies registered.
+  inline size_t size() const { return ids_.size(); }
+  // Ids handed out so far; every id is below this.
+  inline size_t issued() const { return names_.size(); }
+
+ private:
+  static constexpr size_t NO_SLOT = SIZE_MAX;
+
+  std::unordered_map<std::string, BodyId> by_name_;
+  // By id.
+  std::vector<std::string> names_;
+  std::vector<size_t> slot_of_;
+  // By slot.
+  std::vector<BodyId> ids_;
+};
+
+// Remove v[slot] by moving the last element into it, as BodyRegistry::remove()
+// does with the slots.
+template <typename T>
+inline void swap_remove(std::vector<T>* v, size_t slot) {
+  if (slot + 1 != v->size())
+    (*v)[slot] = std::move(v->back());
+  v->pop_back();
+}
+
+}  // namespace ssm
+
+#endif  // BODY_REGISTRY_H_
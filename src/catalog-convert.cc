@@ -0,0 +1,197 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++17 -pthread -o catalog-convert catalog-convert.cc
+//
+// Convert body catalogs between the text and binary forms (see catalog.h),
+// convert orbital element catalogs to cartesian states, or generate a
+// synthetic asteroid belt to test loading large catalogs.
+
+#include "utils.h"
+#include "deps/cxxopts.h"
+#include "catalog.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+
+using ssm::Checkpoint;
+using ssm::Elements;
+using std::string;
+
+cxxopts::Options* retrieve_options() {
+  auto options = new cxxopts::Options(
+      "catalog-convert", "Convert body catalogs between text and binary");
+  options->add_options()
+    ("h,help", "print help")
+    ("i,input",
+     "catalog to read, text or binary",
+     cxxopts::value<string>()->default_value(""))
+    ("o,output",
+     "catalog to write",
+     cxxopts::value<string>()->default_value(""))
+    ("f,format",
+     "output format: binary, csv, or elements to write orbital elements as is",
+     cxxopts::value<string>()->default_value("binary"))
+    ("e,elements",
+     "the input holds orbital elements of bodies orbiting the sun")
+    ("g,generate",
+     "instead of reading a catalog, generate elements for this many asteroids",
+     cxxopts::value<size_t>()->default_value("0"))
+    ("threads",
+     "threads used to parse and convert (0 for every core)",
+     cxxopts::value<size_t>()->default_value("0"));
+  return options;
+}
+
+
+// Orbital elements of n small bodies in the main asteroid belt.
+static void generate(size_t n, Elements* el) {
+  std::mt19937_64 rng(n);
+  std::uniform_real_distribution<double> semi_major(2.1 * AU, 3.3 * AU);
+  std::uniform_real_distribution<double> ecc(0, 0.2);
+  std::uniform_real_distribution<double> incl(0, 15);
+  std::uniform_real_distribution<double> degrees(0, 360);
+  std::uniform_real_distribution<double> anomaly(0, 2 * PI);
+
+  el->resize(n);
+  for (size_t i = 0; i < n; i++) {
+    el->names[i] = "a" + std::to_string(i + 1);
+    el->mass[i] = 1e15;
+    el->a[i] = semi_major(rng);
+    el->e[i] = ecc(rng);
+    el->i[i] = incl(rng);
+    el->w[i] = degrees(rng);
+    el->Om[i] = degrees(rng);
+    el->E[i] = anomaly(rng);
+  }
+}
+
+
+static int write_elements(const char* path, const Elements& el) {
+  FILE* fp = fopen(path, "w");
+  if (fp == nullptr)
+    return -errno;
+  fprintf(fp, "name,mass,a,e,i,w,Om,E\n");
+  for (size_t i = 0; i < el.count(); i++) {
+    fprintf(fp, "%s,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g\n",
+            el.names[i].c_str(), el.mass[i], el.a[i], el.e[i],
+            el.i[i], el.w[i], el.Om[i], el.E[i]);
+  }
+  int err = ferror(fp) ? -EIO : 0;
+  if (fclose(fp) != 0 && err == 0)
+    err = -errno;
+  return err;
+}
+
+
+static int write_csv(const char* path, const Checkpoint& cp) {
+  FILE* fp = fopen(path, "w");
+  if (fp == nullptr)
+    return -errno;
+  fprintf(fp, "name,mass,x,y,z,vx,vy,vz,ax,ay,az\n");
+  for (size_t i = 0; i < cp.count(); i++) {
+    const double* p = &cp.pos[i * 3];
+    const double* v = &cp.vel[i * 3];
+    const double* a = &cp.acc[i * 3];
+    fprintf(fp, "%s,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g\n",
+            cp.names[i].c_str(), cp.mass[i],
+            p[0], p[1], p[2], v[0], v[1], v[2], a[0], a[1], a[2]);
+  }
+  int err = ferror(fp) ? -EIO : 0;
+  if (fclose(fp) != 0 && err == 0)
+    err = -errno;
+  return err;
+}
+
+
+static void print_load(const char* what, size_t n, uint64_t t) {
+  printf("%s %lu bodies in %.2f ms   %.1f ns/body\n",
+         what, n, t / 1e6, 1.0 * t / (n > 0 ? n : 1));
+}
+
+
+int main(int argc, char* argv[]) {
+  cxxopts::Options* options = retrieve_options();
+  auto result = options->parse(argc, argv);
+  string input = result["input"].as<string>();
+  string output = result["output"].as<string>();
+  string format = result["format"].as<string>();
+  size_t count = result["generate"].as<size_t>();
+  size_t threads = result["threads"].as<size_t>();
+  bool elements = count > 0 || result.count("elements");
+  Checkpoint cp;
+  Elements el;
+  size_t line = 0;
+  uint64_t t;
+  int err;
+
+  if (result.count("help") || (input.empty() && count == 0)) {
+    printf("%s", options->help({""}).c_str());
+    delete options;
+    return 0;
+  }
+  delete options;
+
+  if (format != "binary" && format != "csv" && format != "elements") {
+    fprintf(stderr, "unknown format '%s'\n", format.c_str());
+    return 1;
+  }
+  if (format == "elements" && !elements) {
+    fprintf(stderr, "only orbital elements can be written as elements\n");
+    return 1;
+  }
+
+  t = hrtime();
+  if (count > 0) {
+    generate(count, &el);
+    err = 0;
+  } else if (elements) {
+    err = ssm::load_elements_csv(input.c_str(), &el, &line, threads);
+  } else {
+    err = ssm::load_catalog(input.c_str(), &cp, &line, threads);
+  }
+  t = hrtime() - t;
+  if (err == -EINVAL && line > 0) {
+    fprintf(stderr, "%s:%lu: bad body\n", input.c_str(), line);
+    return 1;
+  } else if (err != 0) {
+    fprintf(stderr, "can't load '%s': %s\n", input.c_str(), strerror(-err));
+    return 1;
+  }
+  if (count == 0)
+    print_load("loaded", elements ? el.count() : cp.count(), t);
+
+  // States are relative to the sun, which goes in the first row.
+  if (elements && format != "elements") {
+    double sun = 1.9885e30;
+    t = hrtime();
+    ssm::elements_to_states(el, G * sun, &cp, 1, threads);
+    cp.names[0] = "sun";
+    cp.mass[0] = sun;
+    std::fill_n(&cp.pos[0], 3, 0);
+    std::fill_n(&cp.vel[0], 3, 0);
+    std::fill_n(&cp.acc[0], 3, 0);
+    print_load("converted", el.count(), hrtime() - t);
+  }
+
+  if (output.empty())
+    return 0;
+
+  t = hrtime();
+  if (format == "elements")
+    err = write_elements(output.c_str(), el);
+  else if (format == "csv")
+    err = write_csv(output.c_str(), cp);
+  else
+    err = cp.save(output.c_str());
+  if (err != 0) {
+    fprintf(stderr, "can't write '%s': %s\n", output.c_str(), strerror(-err));
+    return 1;
+  }
+  printf("wrote %lu bodies to %s in %.2f ms\n",
+         elements && format == "elements" ? el.count() : cp.count(),
+         output.c_str(), (hrtime() - t) / 1e6);
+  return 0;
+}
@@ -0,0 +1,548 @@
+#ifndef CATALOG_H_
+#define CATALOG_H_
+
+#include "checkpoint.h"
+#include "kepler.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if __cplusplus >= 201703L && __has_include(<charconv>)
+#include <charconv>
+#endif
+
+namespace ssm {
+
+// Bulk loading of body catalogs. A catalog holds the same columns as a
+// checkpoint, so it's loaded into a Checkpoint and its native binary form is
+// simply a checkpoint file (see checkpoint.h). Binary catalogs are mapped and
+// copied column by column, and Checkpoint::save() writes one.
+// load_bodies() instead hands each body straight to the caller's own storage,
+// for programs that keep bodies in a layout of their own.
+//
+// The text form is one body per line, SI units:
+//
+//   name,mass,x,y,z,vx,vy,vz[,ax,ay,az]
+//
+// Orbital element catalogs are loaded into Elements instead, and converted to
+// a Checkpoint with elements_to_states():
+//
+//   name,mass,a,e,i,w,Om,E
+//
+// with a in meters, i, w and Om in degrees and E in radians, as kep2cart()
+// takes them.
+//
+// Blank lines, lines starting with '#', and a header line whose first field
+// is "name" are skipped. Missing accelerations are zero.
+//
+// Text files are mapped and split at line boundaries into one piece per
+// thread. A first pass counts the records in each piece so every thread knows
+// which slots it owns, then the pieces are parsed in parallel straight into
+// the preallocated columns.
+struct Elements {
+  void resize(size_t n) {
+    names.resize(n);
+    mass.resize(n);
+    a.resize(n);
+    e.resize(n);
+    i.resize(n);
+    w.resize(n);
+    Om.resize(n);
+    E.resize(n);
+  }
+
+  inline size_t count() const { return mass.size(); }
+
+  std::vector<std::string> names;
+  std::vector<double> mass;
+  std::vector<double> a;
+  std::vector<double> e;
+  std::vector<double> i;
+  std::vector<double> w;
+  std::vector<double> Om;
+  std::vector<double> E;
+};
+
+namespace catalog {
+
+// Pieces smaller than this aren't worth a thread.
+constexpr size_t MIN_CHUNK = 1 << 20;
+
+inline size_t default_threads() {
+  size_t n = std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+// Call fn(0) .. fn(n - 1), each on its own thread. fn(0) runs on the caller.
+template <typename Fn>
+inline void run_parallel(size_t n, Fn fn) {
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < n; t++) {
+    threads.emplace_back(fn, t);
+  }
+  fn(0);
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+// Read only mapping of a whole file.
+class MappedFile {
+ public:
+  MappedFile() { }
+  ~MappedFile() {
+    if (data_ != nullptr)
+      ::munmap(const_cast<char*>(data_), size_);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  int open(const char* path) {
+    struct stat st;
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+      return -errno;
+    if (::fstat(fd, &st) != 0) {
+      int err = -errno;
+      ::close(fd);
+      return err;
+    }
+    size_ = st.st_size;
+    if (size_ == 0) {
+      ::close(fd);
+      return 0;
+    }
+    void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+      return -errno;
+    ::madvise(addr, size_, MADV_WILLNEED);
+    data_ = static_cast<const char*>(addr);
+    return 0;
+  }
+
+  inline const char* begin() const { return data_; }
+  inline const char* end() const { return data_ + size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+inline const char* skip_space(const char* p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  return p;
+}
+
+// Parse a double starting at p. Returns a pointer past it, or nullptr. Uses
+// std::from_chars when built as C++17, which is locale independent and several
+// times faster than strtod. The C++14 fallback copies the field out first since
+// the mapped file isn't NUL terminated.
+inline const char* parse_double(const char* p, const char* end, double* out) {
+  p = skip_space(p, end);
+  if (p < end && *p == '+')
+    p++;
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+  std::from_chars_result r = std::from_chars(p, end, *out);
+  if (r.ec != std::errc())
+    return nullptr;
+  return skip_space(r.ptr, end);
+#else
+  char buf[64];
+  size_t len = std::min<size_t>(end - p, sizeof(buf) - 1);
+  char* e;
+  std::memcpy(buf, p, len);
+  buf[len] = '\0';
+  *out = std::strtod(buf, &e);
+  if (e == buf)
+    return nullptr;
+  return skip_space(p + (e - buf), end);
+#endif
+}
+
+// Parse up to max comma separated doubles from p to eol. Returns how many
+// were read, or 0 if the line is malformed.
+inline size_t parse_fields(const char* p,
+                           const char* eol,
+                           double* v,
+                           size_t max) {
+  size_t fields = 0;
+  while (fields < max) {
+    p = parse_double(p, eol, &v[fields++]);
+    if (p == nullptr)
+      return 0;
+    if (p == eol)
+      return fields;
+    if (*p++ != ',')
+      return 0;
+  }
+  return 0;
+}
+
+// Whether the line holds a record. maybe_header is set until the first record
+// of the file has been seen.
+inline bool is_record(const char* p, const char* eol, bool maybe_header) {
+  p = skip_space(p, eol);
+  if (p == eol || *p == '#')
+    return false;
+  if (maybe_header && eol - p >= 4 && std::memcmp(p, "name", 4) == 0) {
+    const char* q = skip_space(p + 4, eol);
+    return q != eol && *q != ',';
+  }
+  return true;
+}
+
+// Split a record line into its trimmed name, as len bytes at *name, and the
+// rest after the comma. Returns nullptr if there's no comma.
+inline const char* split_name(const char* p,
+                              const char* eol,
+                              const char** name,
+                              size_t* len) {
+  p = skip_space(p, eol);
+  const char* comma = static_cast<const char*>(std::memchr(p, ',', eol - p));
+  if (comma == nullptr)
+    return nullptr;
+  const char* name_end = comma;
+  while (name_end > p && (name_end[-1] == ' ' || name_end[-1] == '\t'))
+    name_end--;
+  *name = p;
+  *len = name_end - p;
+  return comma + 1;
+}
+
+inline const char* split_name(const char* p,
+                              const char* eol,
+                              std::string* name) {
+  const char* n;
+  size_t len;
+  p = split_name(p, eol, &n, &len);
+  if (p != nullptr)
+    name->assign(n, len);
+  return p;
+}
+
+// 1 if path starts with the checkpoint magic, 0 if not, or a negative errno.
+inline int is_binary(const char* path) {
+  char magic[sizeof(CHECKPOINT_MAGIC)];
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return -errno;
+  ssize_t r = ::read(fd, magic, sizeof(magic));
+  ::close(fd);
+  return r == sizeof(magic) &&
+         std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0;
+}
+
+// Call fn(line, eol) for each line in [p, end), with any '\r' stripped, until
+// it returns false.
+template <typename Fn>
+inline void each_line(const char* p, const char* end, Fn fn) {
+  while (p < end) {
+    const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    if (eol == nullptr)
+      eol = end;
+    const char* next = eol + 1;
+    if (eol > p && eol[-1] == '\r')
+      eol--;
+    if (!fn(p, eol))
+      return;
+    p = next;
+  }
+}
+
+// Parse [data, end) using up to threads threads. resize(n) is called once
+// with the total record count, then parse(line, eol, slot) for every record,
+// returning false if it's malformed. Returns 0 or -EINVAL, with bad_line set
+// to the first malformed line.
+template <typename Resize, typename Parse>
+inline int parse_parallel(const char* data,
+                          const char* end,
+                          size_t threads,
+                          Resize resize,
+                          Parse parse,
+                          size_t* bad_line) {
+  if (threads == 0)
+    threads = default_threads();
+  threads = std::max<size_t>(
+      1, std::min<size_t>(threads, (end - data) / MIN_CHUNK));
+
+  // Piece boundaries, each moved forward to just past a newline.
+  std::vector<const char*> bounds(threads + 1, end);
+  bounds[0] = data;
+  for (size_t t = 1; t < threads; t++) {
+    const char* p = std::max(data + (end - data) * t / threads, bounds[t - 1]);
+    const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    bounds[t] = nl == nullptr ? end : nl + 1;
+  }
+
+  // records[t] and lines[t] end up as the first slot and line of piece t.
+  std::vector<size_t> records(threads + 1, 0);
+  std::vector<size_t> lines(threads + 1, 0);
+  run_parallel(threads, [&](size_t t) {
+    size_t n = 0;
+    size_t l = 0;
+    each_line(bounds[t], bounds[t + 1], [&](const char* p, const char* eol) {
+      l++;
+      n += is_record(p, eol, t == 0 && n == 0);
+      return true;
+    });
+    records[t + 1] = n;
+    lines[t + 1] = l;
+  });
+  for (size_t t = 1; t <= threads; t++) {
+    records[t] += records[t - 1];
+    lines[t] += lines[t - 1];
+  }
+  resize(records[threads]);
+
+  std::vector<size_t> bad(threads, 0);
+  run_parallel(threads, [&](size_t t) {
+    size_t slot = records[t];
+    size_t l = lines[t];
+    each_line(bounds[t], bounds[t + 1], [&](const char* p, const char* eol) {
+      l++;
+      if (!is_record(p, eol, t == 0 && slot == 0))
+        return true;
+      if (!parse(p, eol, slot++)) {
+        bad[t] = l;
+        return false;
+      }
+      return true;
+    });
+  });
+  for (size_t t = 0; t < threads; t++) {
+    if (bad[t] != 0) {
+      if (bad_line != nullptr)
+        *bad_line = bad[t];
+      resize(0);
+      return -EINVAL;
+    }
+  }
+  return 0;
+}
+
+}  // namespace catalog
+
+
+// Parse a text catalog held in [data, end) straight into the caller's own
+// body storage. resize(n) is called once with the number of bodies, then
+// set(slot, name, len, mass, pos, vel, acc) for each body, from several
+// threads at once. name is len bytes, not NUL terminated, and pos, vel and
+// acc point to 3 doubles each. Returns 0 or -EINVAL, in which case bad_line
+// (if given) holds the 1 based line that failed, and resize(0) has been
+// called. threads of 0 uses every core.
+template <typename Resize, typename Set>
+inline int parse_bodies_csv(const char* data,
+                            const char* end,
+                            Resize resize,
+                            Set set,
+                            size_t* bad_line = nullptr,
+                            size_t threads = 0) {
+  return catalog::parse_parallel(
+      data, end, threads, resize,
+      [&set](const char* p, const char* eol, size_t n) {
+        static const double zero[3] = { 0, 0, 0 };
+        const char* name;
+        size_t len;
+        double v[10];
+        p = catalog::split_name(p, eol, &name, &len);
+        if (p == nullptr)
+          return false;
+        size_t fields = catalog::parse_fields(p, eol, v, 10);
+        if (fields != 7 && fields != 10)
+          return false;
+        set(n, name, len, v[0], &v[1], &v[4], fields == 10 ? &v[7] : zero);
+        return true;
+      },
+      bad_line);
+}
+
+// Parse a text catalog held in [data, end) into out. Returns 0 or -EINVAL, in
+// which case bad_line (if given) holds the 1 based line that failed. threads
+// of 0 uses every core.
+inline int parse_catalog_csv(const char* data,
+                             const char* end,
+                             Checkpoint* out,
+                             size_t* bad_line = nullptr,
+                             size_t threads = 0) {
+  return parse_bodies_csv(
+      data, end,
+      [out](size_t n) { out->resize(n); },
+      [out](size_t n,
+            const char* name,
+            size_t len,
+            double mass,
+            const double* pos,
+            const double* vel,
+            const double* acc) {
+        out->names[n].assign(name, len);
+        out->mass[n] = mass;
+        std::memcpy(&out->pos[n * 3], pos, sizeof(double) * 3);
+        std::memcpy(&out->vel[n * 3], vel, sizeof(double) * 3);
+        std::memcpy(&out->acc[n * 3], acc, sizeof(double) * 3);
+      },
+      bad_line, threads);
+}
+
+// Parse an orbital element catalog held in [data, end) into out.
+inline int parse_elements_csv(const char* data,
+                              const char* end,
+                              Elements* out,
+                              size_t* bad_line = nullptr,
+                              size_t threads = 0) {
+  return catalog::parse_parallel(
+      data, end, threads,
+      [out](size_t n) { out->resize(n); },
+      [out](const char* p, const char* eol, size_t n) {
+        double v[7];
+        p = catalog::split_name(p, eol, &out->names[n]);
+        if (p == nullptr || catalog::parse_fields(p, eol, v, 7) != 7)
+          return false;
+        out->mass[n] = v[0];
+        out->a[n] = v[1];
+        out->e[n] = v[2];
+        out->i[n] = v[3];
+        out->w[n] = v[4];
+        out->Om[n] = v[5];
+        out->E[n] = v[6];
+        return true;
+      },
+      bad_line);
+}
+
+// Load a text catalog. Returns 0 or a negative errno.
+inline int load_catalog_csv(const char* path,
+                            Checkpoint* out,
+                            size_t* bad_line = nullptr,
+                            size_t threads = 0) {
+  catalog::MappedFile file;
+  int err = file.open(path);
+  if (err != 0)
+    return err;
+  return parse_catalog_csv(file.begin(), file.end(), out, bad_line, threads);
+}
+
+// Load an orbital element catalog. Returns 0 or a negative errno.
+inline int load_elements_csv(const char* path,
+                             Elements* out,
+                             size_t* bad_line = nullptr,
+                             size_t threads = 0) {
+  catalog::MappedFile file;
+  int err = file.open(path);
+  if (err != 0)
+    return err;
+  return parse_elements_csv(file.begin(), file.end(), out, bad_line, threads);
+}
+
+// Load a binary catalog, i.e. a checkpoint file. Returns 0 or a negative
+// errno.
+inline int load_catalog_binary(const char* path, Checkpoint* out) {
+  MappedCheckpoint mcp;
+  int err = mcp.open(path);
+  if (err != 0)
+    return err;
+  size_t n = mcp.count();
+  out->resize(n);
+  std::memcpy(out->mass.data(), mcp.mass(), n * sizeof(double));
+  std::memcpy(out->pos.data(), mcp.pos(), n * 3 * sizeof(double));
+  std::memcpy(out->vel.data(), mcp.vel(), n * 3 * sizeof(double));
+  std::memcpy(out->acc.data(), mcp.acc(), n * 3 * sizeof(double));
+  for (size_t i = 0; i < n; i++) {
+    out->names[i] = mcp.name(i);
+  }
+  out->step = mcp.step();
+  out->time = mcp.time();
+  out->step_sec = mcp.step_sec();
+  return 0;
+}
+
+// Load either form, picking binary if the file starts with the checkpoint
+// magic.
+inline int load_catalog(const char* path,
+                        Checkpoint* out,
+                        size_t* bad_line = nullptr,
+                        size_t threads = 0) {
+  int binary = catalog::is_binary(path);
+  if (binary < 0)
+    return binary;
+  if (binary)
+    return load_catalog_binary(path, out);
+  return load_catalog_csv(path, out, bad_line, threads);
+}
+
+// Load either form straight into the caller's body storage, through resize()
+// and set() as parse_bodies_csv() calls them. Nothing is held per body in
+// between. Returns 0 or a negative errno.
+template <typename Resize, typename Set>
+inline int load_bodies(const char* path,
+                       Resize resize,
+                       Set set,
+                       size_t* bad_line = nullptr,
+                       size_t threads = 0) {
+  int binary = catalog::is_binary(path);
+  if (binary < 0)
+    return binary;
+  if (!binary) {
+    catalog::MappedFile file;
+    int err = file.open(path);
+    if (err != 0)
+      return err;
+    return parse_bodies_csv(file.begin(), file.end(), resize, set, bad_line,
+                            threads);
+  }
+  MappedCheckpoint mcp;
+  int err = mcp.open(path);
+  if (err != 0)
+    return err;
+  size_t n = mcp.count();
+  const uint64_t* off = mcp.name_offsets();
+  resize(n);
+  for (size_t i = 0; i < n; i++) {
+    set(i, mcp.names() + off[i], off[i + 1] - off[i], mcp.mass()[i],
+        mcp.pos() + i * 3, mcp.vel() + i * 3, mcp.acc() + i * 3);
+  }
+  return 0;
+}
+
+// Convert every body in el to a cartesian state about a central body with
+// gravitational parameter mu (G * M), in parallel. Positions and velocities
+// are relative to the central body. Body b goes in row first + b, leaving the
+// rows before it for the caller, e.g. for the central body itself.
+inline void elements_to_states(const Elements& el,
+                               double mu,
+                               Checkpoint* out,
+                               size_t first = 0,
+                               size_t threads = 0) {
+  size_t n = el.count();
+  if (threads == 0)
+    threads = catalog::default_threads();
+  threads = std::max<size_t>(1, std::min<size_t>(threads, n / 4096));
+  out->resize(first + n);
+  catalog::run_parallel(threads, [&](size_t t) {
+    size_t end = n * (t + 1) / threads;
+    for (size_t b = n * t / threads; b < end; b++) {
+      size_t r = first + b;
+      out->names[r] = el.names[b];
+      out->mass[r] = el.mass[b];
+      kep2cart(mu, el.a[b], el.e[b], el.i[b], el.w[b], el.Om[b], el.E[b],
+               &out->pos[r * 3], &out->vel[r * 3]);
+      out->acc[r * 3] = out->acc[r * 3 + 1] = out->acc[r * 3 + 2] = 0;
+    }
+  });
+}
+
+}  // namespace ssm
+
+#endif  // CATALOG_H_
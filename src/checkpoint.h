@@ -0,0 +1,283 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ssm {
+
+// On disk layout, all little endian native doubles:
+//
+//   CheckpointHeader
+//   mass[count]                           (64 byte aligned)
+//   pos[count * 3]   x0 y0 z0 x1 y1 ...   (64 byte aligned)
+//   vel[count * 3]                        (64 byte aligned)
+//   acc[count * 3]                        (64 byte aligned)
+//   name_offsets[count + 1]  uint64_t     (64 byte aligned)
+//   names                    char data, not NUL terminated
+//
+// Columns are laid out so a mapped file can be used in place without any
+// parsing, which keeps restart time independent of the number of bodies.
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t pad;         // Written as 0.
+  uint64_t count;
+  uint64_t step;
+  double time;
+  double step_sec;
+  uint64_t file_size;
+  uint64_t reserved[3];
+};
+
+static_assert(sizeof(CheckpointHeader) == 80, "checkpoint header size");
+
+constexpr char CHECKPOINT_MAGIC[8] = { 'S', 'S', 'M', 'C', 'K', 'P', 'T', 0 };
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+// Offsets of each column for a checkpoint holding count bodies.
+struct CheckpointLayout {
+  explicit CheckpointLayout(uint64_t count) {
+    mass = align(sizeof(CheckpointHeader));
+    pos = align(mass + count * sizeof(double));
+    vel = align(pos + count * 3 * sizeof(double));
+    acc = align(vel + count * 3 * sizeof(double));
+    name_offsets = align(acc + count * 3 * sizeof(double));
+    names = name_offsets + (count + 1) * sizeof(uint64_t);
+  }
+
+  static inline uint64_t align(uint64_t n) { return (n + 63) & ~63ull; }
+
+  uint64_t mass;
+  uint64_t pos;
+  uint64_t vel;
+  uint64_t acc;
+  uint64_t name_offsets;
+  uint64_t names;
+};
+
+// Body state gathered by the engine before saving. Kept around between saves
+// so checkpointing doesn't allocate once it's warmed up.
+class Checkpoint {
+ public:
+  void resize(size_t n) {
+    names.resize(n);
+    mass.resize(n);
+    pos.resize(n * 3);
+    vel.resize(n * 3);
+    acc.resize(n * 3);
+  }
+
+  inline size_t count() const { return mass.size(); }
+
+  // Write atomically: everything goes to path.tmp which is fsync'd and then
+  // renamed over path, so a crash mid write leaves the previous checkpoint
+  // intact. Returns 0 or a negative errno.
+  int save(const char* path) const {
+    std::string tmp = std::string(path) + ".tmp";
+    CheckpointLayout layout(count());
+    CheckpointHeader header;
+    std::vector<uint64_t> offsets(count() + 1);
+    std::string blob;
+    int fd;
+    int err = 0;
+
+    offsets[0] = 0;
+    for (size_t i = 0; i < count(); i++) {
+      blob += names[i];
+      offsets[i + 1] = blob.size();
+    }
+
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.count = count();
+    header.step = step;
+    header.time = time;
+    header.step_sec = step_sec;
+    header.file_size = layout.names + blob.size();
+
+    fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      return -errno;
+
+    if (err == 0)
+      err = write_at(fd, &header, sizeof(header), 0);
+    if (err == 0)
+      err = write_at(fd, mass.data(), mass.size() * sizeof(double),
+                     layout.mass);
+    if (err == 0)
+      err = write_at(fd, pos.data(), pos.size() * sizeof(double), layout.pos);
+    if (err == 0)
+      err = write_at(fd, vel.data(), vel.size() * sizeof(double), layout.vel);
+    if (err == 0)
+      err = write_at(fd, acc.data(), acc.size() * sizeof(double), layout.acc);
+    if (err == 0)
+      err = write_at(fd, offsets.data(), offsets.size() * sizeof(uint64_t),
+                     layout.name_offsets);
+    if (err == 0)
+      err = write_at(fd, blob.data(), blob.size(), layout.names);
+    if (err == 0 && ::ftruncate(fd, header.file_size) != 0)
+      err = -errno;
+    if (err == 0 && ::fsync(fd) != 0)
+      err = -errno;
+    if (::close(fd) != 0 && err == 0)
+      err = -errno;
+    if (err == 0 && ::rename(tmp.c_str(), path) != 0)
+      err = -errno;
+    if (err != 0)
+      ::unlink(tmp.c_str());
+    return err;
+  }
+
+  uint64_t step = 0;
+  double time = 0;
+  double step_sec = 0;
+  std::vector<std::string> names;
+  std::vector<double> mass;
+  std::vector<double> pos;
+  std::vector<double> vel;
+  std::vector<double> acc;
+
+  // pwrite all of data at off. Returns 0 or a negative errno. Also used to
+  // fill in checkpoint files that are written a slice at a time.
+  static int write_at(int fd, const void* data, size_t len, uint64_t off) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+      ssize_t r = ::pwrite(fd, p, len, off);
+      if (r < 0) {
+        if (errno == EINTR)
+          continue;
+        return -errno;
+      }
+      p += r;
+      len -= r;
+      off += r;
+    }
+    return 0;
+  }
+};
+
+// Read only view of a checkpoint file. The columns point straight into the
+// mapping, so opening costs the same regardless of body count.
+class MappedCheckpoint {
+ public:
+  MappedCheckpoint() { }
+  ~MappedCheckpoint() { close(); }
+
+  MappedCheckpoint(const MappedCheckpoint&) = delete;
+  MappedCheckpoint& operator=(const MappedCheckpoint&) = delete;
+
+  // Returns 0, a negative errno, or -EINVAL if the file isn't a checkpoint
+  // this version understands.
+  int open(const char* path) {
+    struct stat st;
+    int fd;
+
+    close();
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+      return -errno;
+    if (::fstat(fd, &st) != 0) {
+      int err = -errno;
+      ::close(fd);
+      return err;
+    }
+    if (static_cast<size_t>(st.st_size) < sizeof(CheckpointHeader)) {
+      ::close(fd);
+      return -EINVAL;
+    }
+    void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+      return -errno;
+    base_ = static_cast<const char*>(addr);
+    size_ = st.st_size;
+
+    // Every body takes at least BODY_BYTES, so count is bounded by division
+    // before the layout is worked out from it and can't overflow.
+    const CheckpointHeader* h = header();
+    if (std::memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != CHECKPOINT_VERSION ||
+        h->file_size != size_ ||
+        h->count > (size_ - sizeof(CheckpointHeader)) / BODY_BYTES ||
+        CheckpointLayout(h->count).names > size_) {
+      close();
+      return -EINVAL;
+    }
+    layout_ = CheckpointLayout(h->count);
+    if (!valid_names()) {
+      close();
+      return -EINVAL;
+    }
+    return 0;
+  }
+
+  void close() {
+    if (base_ != nullptr)
+      ::munmap(const_cast<char*>(base_), size_);
+    base_ = nullptr;
+    size_ = 0;
+  }
+
+  inline const CheckpointHeader* header() const {
+    return reinterpret_cast<const CheckpointHeader*>(base_);
+  }
+  inline uint64_t count() const { return header()->count; }
+  inline uint64_t step() const { return header()->step; }
+  inline double time() const { return header()->time; }
+  inline double step_sec() const { return header()->step_sec; }
+
+  inline const double* mass() const { return column<double>(layout_.mass); }
+  inline const double* pos() const { return column<double>(layout_.pos); }
+  inline const double* vel() const { return column<double>(layout_.vel); }
+  inline const double* acc() const { return column<double>(layout_.acc); }
+
+  inline std::string name(size_t i) const {
+    const uint64_t* off = name_offsets();
+    return std::string(base_ + layout_.names + off[i], off[i + 1] - off[i]);
+  }
+
+  // Raw name table, so names can be copied to another file as is.
+  inline const uint64_t* name_offsets() const {
+    return column<uint64_t>(layout_.name_offsets);
+  }
+  inline const char* names() const { return base_ + layout_.names; }
+
+ private:
+  // mass, pos, vel, acc and a name offset.
+  static constexpr uint64_t BODY_BYTES = (1 + 3 * 3 + 1) * sizeof(uint64_t);
+
+  template <typename T>
+  inline const T* column(uint64_t off) const {
+    return reinterpret_cast<const T*>(base_ + off);
+  }
+
+  // Whether the name offsets start at 0, ascend and end within the file.
+  bool valid_names() const {
+    const uint64_t* off = name_offsets();
+    size_t n = count();
+    for (size_t i = 0; i < n; i++) {
+      if (off[i] > off[i + 1])
+        return false;
+    }
+    return off[0] == 0 && off[n] <= size_ - layout_.names;
+  }
+
+  const char* base_ = nullptr;
+  size_t size_ = 0;
+  CheckpointLayout layout_{0};
+};
+
+}  // namespace ssm
+
+#endif  // CHECKPOINT_H_
@@ -0,0 +1,192 @@
+#ifndef DELTA_CODEC_H_
+#define DELTA_CODEC_H_
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace ssm {
+
+// Lossless compression for smooth columns of doubles, in the spirit of FPC.
+//
+// Each value is predicted from the previous samples, with both a linear
+// (2a - b) and a quadratic (3a - 3b + c) extrapolation of their bit patterns.
+// The residual is the zigzag encoded difference between the value's bit
+// pattern and the closer prediction, which for smooth data has a long run of
+// leading zero bytes. Each value is stored as a 4 bit code (1 bit predictor
+// choice, 3 bits leading zero byte count) in a nibble stream, followed by the
+// remaining low order residual bytes.
+//
+// Encoded column:
+//
+//   nibbles[(n + 1) / 2]    two codes per byte, low nibble first
+//   residual bytes          little endian, only the significant bytes
+//
+// Decoding is a single forward pass with no tables, so it streams at memory
+// speed. Predictions are made with integer arithmetic on the bit patterns
+// rather than in floating point. Neighbouring doubles of the same sign and
+// exponent are linear in their bit pattern, so they predict just as well.
+// The result also doesn't depend on how the compiler contracts or rounds
+// floating point, so files decode exactly on any build.
+namespace delta_codec {
+
+inline uint64_t to_bits(double d) {
+  uint64_t u;
+  std::memcpy(&u, &d, sizeof(u));
+  return u;
+}
+
+inline double from_bits(uint64_t u) {
+  double d;
+  std::memcpy(&d, &u, sizeof(d));
+  return d;
+}
+
+inline uint64_t zigzag(uint64_t v) {
+  return (v << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(v) >> 63);
+}
+
+inline uint64_t unzigzag(uint64_t z) {
+  return (z >> 1) ^ (0 - (z & 1));
+}
+
+inline unsigned leading_zero_bytes(uint64_t v) {
+  return v == 0 ? 8 : __builtin_clzll(v) / 8;
+}
+
+// A leading zero count of 4 is stored as 3 so that 0-8 fits in 3 bits. The
+// one extra byte that costs is rare enough not to matter.
+inline unsigned lzb_to_code(unsigned lzb) {
+  return lzb == 4 ? 3 : lzb > 4 ? lzb - 1 : lzb;
+}
+
+inline unsigned code_to_lzb(unsigned code) {
+  return code >= 4 ? code + 1 : code;
+}
+
+struct Predictor {
+  uint64_t a = 0;
+  uint64_t b = 0;
+  uint64_t c = 0;
+
+  inline uint64_t linear() const { return 2 * a - b; }
+  inline uint64_t quadratic() const { return 3 * a - 3 * b + c; }
+  inline void update(uint64_t v) {
+    c = b;
+    b = a;
+    a = v;
+  }
+};
+
+}  // namespace delta_codec
+
+
+// Append n encoded doubles to out. Returns the number of bytes appended.
+inline size_t delta_encode(const double* in, size_t n, std::vector<char>* out) {
+  using namespace delta_codec;
+  size_t start = out->size();
+  size_t nib = start;
+  Predictor p;
+
+  out->resize(start + (n + 1) / 2, 0);
+  for (size_t i = 0; i < n; i++) {
+    uint64_t v = to_bits(in[i]);
+    uint64_t r1 = zigzag(v - p.linear());
+    uint64_t r2 = zigzag(v - p.quadratic());
+    unsigned which = r2 < r1 ? 1 : 0;
+    uint64_t r = which ? r2 : r1;
+    unsigned code = lzb_to_code(leading_zero_bytes(r));
+    unsigned len = 8 - code_to_lzb(code);
+    unsigned char nibble = (which << 3) | code;
+
+    (*out)[nib + i / 2] |= static_cast<char>(i % 2 ? nibble << 4 : nibble);
+    for (unsigned j = 0; j < len; j++) {
+      out->push_back(static_cast<char>(r >> (j * 8)));
+    }
+    p.update(v);
+  }
+  return out->size() - start;
+}
+
+// Decode n doubles from in into out. Returns a pointer just past the encoded
+// column, or nullptr if it would read past end.
+inline const char* delta_decode(const char* in,
+                                const char* end,
+                                size_t n,
+                                double* out) {
+  using namespace delta_codec;
+  const unsigned char* nib = reinterpret_cast<const unsigned char*>(in);
+  const unsigned char* res = nib + (n + 1) / 2;
+  const unsigned char* stop = reinterpret_cast<const unsigned char*>(end);
+  Predictor p;
+
+  if (res > stop)
+    return nullptr;
+  for (size_t i = 0; i < n; i++) {
+    unsigned nibble = i % 2 ? nib[i / 2] >> 4 : nib[i / 2] & 0xf;
+    unsigned len = 8 - code_to_lzb(nibble & 7);
+    uint64_t r = 0;
+    if (res + len > stop)
+      return nullptr;
+    for (unsigned j = 0; j < len; j++) {
+      r |= static_cast<uint64_t>(res[j]) << (j * 8);
+    }
+    res += len;
+    uint64_t v = (nibble & 8 ? p.quadratic() : p.linear()) + unzigzag(r);
+    out[i] = from_bits(v);
+    p.update(v);
+  }
+  return reinterpret_cast<const char*>(res);
+}
+
+
+// Steps are integers that usually advance by a constant, so store the zigzag
+// varint of the delta of deltas. Both differences wrap as uint64_t, so any
+// jump round trips.
+inline size_t delta_encode(const uint64_t* in,
+                           size_t n,
+                           std::vector<char>* out) {
+  size_t start = out->size();
+  uint64_t prev = 0;
+  uint64_t prev_delta = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t delta = in[i] - prev;
+    uint64_t z = delta_codec::zigzag(delta - prev_delta);
+    while (z >= 0x80) {
+      out->push_back(static_cast<char>(z | 0x80));
+      z >>= 7;
+    }
+    out->push_back(static_cast<char>(z));
+    prev = in[i];
+    prev_delta = delta;
+  }
+  return out->size() - start;
+}
+
+inline const char* delta_decode(const char* in,
+                                const char* end,
+                                size_t n,
+                                uint64_t* out) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(in);
+  const unsigned char* stop = reinterpret_cast<const unsigned char*>(end);
+  uint64_t prev = 0;
+  uint64_t prev_delta = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t z = 0;
+    unsigned shift = 0;
+    do {
+      if (p >= stop || shift > 63)
+        return nullptr;
+      z |= static_cast<uint64_t>(*p & 0x7f) << shift;
+      shift += 7;
+    } while (*p++ & 0x80);
+    prev_delta += delta_codec::unzigzag(z);
+    prev += prev_delta;
+    out[i] = prev;
+  }
+  return reinterpret_cast<const char*>(p);
+}
+
+}  // namespace ssm
+
+#endif  // DELTA_CODEC_H_
@@ -0,0 +1,474 @@
+#ifndef ENGINE_H_
+#define ENGINE_H_
+
+#include "arena.h"
+#include "math_vector.h"
+#include "mixed_precision.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace ssm {
+
+constexpr double ENGINE_G = 6.67408e-11;
+
+// Direct summation engine assembled from four policies, all resolved at
+// compile time:
+//
+//   Layout      where the bodies live: FlatLayout (arrays owned by someone
+//               else), SoALayout (a column per coordinate) or AoSLayout (a
+//               struct of Vectors per body)
+//   Force       how accelerations are found: PairForce (each pair once),
+//               AllForce (each body against every other, so bodies can be
+//               split over threads) or MixedForce (AllForce with
+//               accel_mixed(), SoALayout only)
+//   Integrator  how a step is taken from accelerate(), drift() and kick():
+//               TaylorStep (x += v dt + a dt^2 / 2, v += a dt) or VerletStep
+//   Parallel    Serial, or ThreadPool to split the force over threads
+//
+// Each policy only talks to the others through a few inline calls, so the
+// compiler sees the same code a hand written loop would give. NBody is
+// Engine<FlatLayout>, planets steps with AoSLayout and PairForce, planets2 and
+// planets-threaded with AoSLayout and AllForce, and bench runs the other
+// combinations.
+//
+// A layout gives count(), mass(i), and pos(i, k), vel(i, k) and acc(i, k) as
+// references to coordinate k of body i. The layouts that own their bodies
+// also have resize(n) and set_mass(i, m).
+//
+// A force is given the layout, the parallel policy and an Arena that's reset
+// before every accelerate(). Anything it needs for one evaluation only, such
+// as a tree's nodes, goes there, so the stepping loop makes no heap
+// allocations once the arena has grown to fit.
+
+// Bodies in arrays the engine doesn't own: mass[n], and pos, vel and acc as n
+// rows of x, y, z.
+class FlatLayout {
+ public:
+  static constexpr bool columns = false;
+
+  FlatLayout(size_t n, double* mass, double* pos, double* vel, double* acc)
+    : n_(n), mass_(mass), pos_(pos), vel_(vel), acc_(acc) { }
+
+  inline size_t count() const { return n_; }
+  inline double mass(size_t i) const { return mass_[i]; }
+  inline double& pos(size_t i, size_t k) const { return pos_[i * 3 + k]; }
+  inline double& vel(size_t i, size_t k) const { return vel_[i * 3 + k]; }
+  inline double& acc(size_t i, size_t k) const { return acc_[i * 3 + k]; }
+
+  inline double* mass() const { return mass_; }
+  inline double* pos() const { return pos_; }
+  inline double* vel() const { return vel_; }
+  inline double* acc() const { return acc_; }
+
+ private:
+  size_t n_;
+  double* mass_;
+  double* pos_;
+  double* vel_;
+  double* acc_;
+};
+
+// A column of each coordinate, as planets-xsimd and particles.h keep them.
+class SoALayout {
+ public:
+  static constexpr bool columns = true;
+
+  void resize(size_t n) {
+    mass_.resize(n);
+    for (size_t k = 0; k < 3; k++) {
+      pos_[k].resize(n);
+      vel_[k].resize(n);
+      acc_[k].resize(n);
+    }
+  }
+
+  inline size_t count() const { return mass_.size(); }
+  inline double mass(size_t i) const { return mass_[i]; }
+  inline void set_mass(size_t i, double m) { mass_[i] = m; }
+  inline double& pos(size_t i, size_t k) { return pos_[k][i]; }
+  inline double& vel(size_t i, size_t k) { return vel_[k][i]; }
+  inline double& acc(size_t i, size_t k) { return acc_[k][i]; }
+  inline double pos(size_t i, size_t k) const { return pos_[k][i]; }
+  inline double vel(size_t i, size_t k) const { return vel_[k][i]; }
+
+  inline const double* mass_column() const { return mass_.data(); }
+  inline const double* pos_column(size_t k) const { return pos_[k].data(); }
+
+ private:
+  std::vector<double> mass_;
+  std::vector<double> pos_[3];
+  std::vector<double> vel_[3];
+  std::vector<double> acc_[3];
+};
+
+// A struct per body, as planets2's SystemBody keeps them.
+class AoSLayout {
+ public:
+  static constexpr bool columns = false;
+
+  struct Body {
+    double mass = 0;
+    Vector pos;
+    Vector vel;
+    Vector acc;
+  };
+
+  void resize(size_t n) { bodies_.resize(n); }
+
+  // The rows themselves, for owners that add and remove bodies one at a time.
+  inline Body& body(size_t i) { return bodies_[i]; }
+  inline const Body& body(size_t i) const { return bodies_[i]; }
+  inline std::vector<Body>& bodies() { return bodies_; }
+
+  // Take body i out in O(1) and return its state. The last body moves into
+  // row i, as BodyRegistry::remove() moves the last slot.
+  Body remove(size_t i) {
+    Body b = bodies_[i];
+    if (i + 1 != bodies_.size())
+      bodies_[i] = bodies_.back();
+    bodies_.pop_back();
+    return b;
+  }
+
+  inline size_t count() const { return bodies_.size(); }
+  inline double mass(size_t i) const { return bodies_[i].mass; }
+  inline void set_mass(size_t i, double m) { bodies_[i].mass = m; }
+  inline double& pos(size_t i, size_t k) { return bodies_[i].pos[k]; }
+  inline double& vel(size_t i, size_t k) { return bodies_[i].vel[k]; }
+  inline double& acc(size_t i, size_t k) { return bodies_[i].acc[k]; }
+  inline double pos(size_t i, size_t k) const { return bodies_[i].pos[k]; }
+  inline double vel(size_t i, size_t k) const { return bodies_[i].vel[k]; }
+
+ private:
+  std::vector<Body> bodies_;
+};
+
+
+// Runs every body in one call on the calling thread.
+class Serial {
+ public:
+  static constexpr bool concurrent = false;
+
+  template <typename F>
+  inline void for_range(size_t n, F&& f) { f(0, n); }
+};
+
+// Splits the bodies into one slice per thread. Workers are started on first
+// use and stay parked between calls. threads of 0 means every core.
+class ThreadPool {
+ public:
+  static constexpr bool concurrent = true;
+
+  explicit ThreadPool(size_t threads = 0) : threads_(threads) { }
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+      generation_++;
+    }
+    wake_.notify_all();
+    for (auto& t : pool_) {
+      t.join();
+    }
+  }
+
+  // Only takes effect before the first for_range().
+  inline void set_threads(size_t threads) { threads_ = threads; }
+
+  template <typename F>
+  void for_range(size_t n, F&& f) {
+    if (!started_)
+      start();
+    size_t threads = pool_.size() + 1;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      n_ = n;
+      fn_ = const_cast<void*>(static_cast<const void*>(&f));
+      call_ = [](void* fn, size_t b, size_t e) {
+        (*static_cast<typename std::remove_reference<F>::type*>(fn))(b, e);
+      };
+      pending_ = pool_.size();
+      generation_++;
+    }
+    wake_.notify_all();
+    f(0, n / threads);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return pending_ == 0; });
+  }
+
+ private:
+  void start() {
+    started_ = true;
+    size_t threads = threads_;
+    if (threads == 0)
+      threads = std::max<unsigned>(1, std::thread::hardware_concurrency());
+    for (size_t t = 1; t < threads; t++) {
+      pool_.emplace_back([this, t, threads]() { work(t, threads); });
+    }
+  }
+
+  void work(size_t t, size_t threads) {
+    uint64_t seen = 0;
+    for (;;) {
+      size_t n;
+      void* fn;
+      void (*call)(void*, size_t, size_t);
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [&]() { return generation_ != seen; });
+        seen = generation_;
+        if (stop_)
+          return;
+        n = n_;
+        fn = fn_;
+        call = call_;
+      }
+      call(fn, n * t / threads, n * (t + 1) / threads);
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--pending_ == 0)
+        done_.notify_one();
+    }
+  }
+
+  size_t threads_;
+  bool started_ = false;
+  std::vector<std::thread> pool_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  uint64_t generation_ = 0;
+  size_t pending_ = 0;
+  bool stop_ = false;
+  size_t n_ = 0;
+  void* fn_ = nullptr;
+  void (*call_)(void*, size_t, size_t) = nullptr;
+};
+
+
+// Each pair visited once, updating both bodies: half the work of AllForce,
+// but a body's acceleration is written from every pair it's in, so it can't
+// be split over threads.
+class PairForce {
+ public:
+  static constexpr bool splits = false;
+
+  template <typename L, typename P>
+  inline void accelerate(L& l, P&, Arena&) {
+    size_t n = l.count();
+    for (size_t i = 0; i < n; i++) {
+      for (size_t k = 0; k < 3; k++) {
+        l.acc(i, k) = 0;
+      }
+    }
+    // Body i is held in locals over its row: through the layout's references
+    // the compiler can't tell it apart from body j's acceleration, and would
+    // reload and store it on every pair. The sums are taken in the same order.
+    for (size_t i = 0; i < n; i++) {
+      double xi = l.pos(i, 0);
+      double yi = l.pos(i, 1);
+      double zi = l.pos(i, 2);
+      double mi = l.mass(i);
+      double ax = l.acc(i, 0);
+      double ay = l.acc(i, 1);
+      double az = l.acc(i, 2);
+      for (size_t j = i + 1; j < n; j++) {
+        double dx = xi - l.pos(j, 0);
+        double dy = yi - l.pos(j, 1);
+        double dz = zi - l.pos(j, 2);
+        double rsq = dx * dx + dy * dy + dz * dz;
+        double f = ENGINE_G / (rsq * std::sqrt(rsq));
+        double fi = -f * l.mass(j);
+        double fj = f * mi;
+        ax += fi * dx;
+        ay += fi * dy;
+        az += fi * dz;
+        l.acc(j, 0) += fj * dx;
+        l.acc(j, 1) += fj * dy;
+        l.acc(j, 2) += fj * dz;
+      }
+      l.acc(i, 0) = ax;
+      l.acc(i, 1) = ay;
+      l.acc(i, 2) = az;
+    }
+  }
+};
+
+// Every body against every other. Each body's acceleration only depends on
+// positions, so slices of bodies can run on separate threads.
+class AllForce {
+ public:
+  static constexpr bool splits = true;
+
+  template <typename L, typename P>
+  inline void accelerate(L& l, P& par, Arena&) {
+    size_t n = l.count();
+    par.for_range(n, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        double ax = 0;
+        double ay = 0;
+        double az = 0;
+        for (size_t j = 0; j < n; j++) {
+          if (j == i)
+            continue;
+          double dx = l.pos(i, 0) - l.pos(j, 0);
+          double dy = l.pos(i, 1) - l.pos(j, 1);
+          double dz = l.pos(i, 2) - l.pos(j, 2);
+          double rsq = dx * dx + dy * dy + dz * dz;
+          double f = -ENGINE_G * l.mass(j) / (rsq * std::sqrt(rsq));
+          ax += f * dx;
+          ay += f * dy;
+          az += f * dz;
+        }
+        l.acc(i, 0) = ax;
+        l.acc(i, 1) = ay;
+        l.acc(i, 2) = az;
+      }
+    });
+  }
+};
+
+// AllForce with the distance terms from accel_mixed() (see
+// mixed_precision.h), so each force is within MIXED_INV_R3_MAX_ERROR of
+// AllForce's. Needs the coordinate columns of SoALayout.
+class MixedForce {
+ public:
+  static constexpr bool splits = true;
+
+  template <typename L, typename P>
+  inline void accelerate(L& l, P& par, Arena& scratch) {
+    static_assert(L::columns, "MixedForce needs a layout with columns");
+    size_t n = l.count();
+    double* gm = scratch.make_array<double>(n);
+    for (size_t i = 0; i < n; i++) {
+      gm[i] = ENGINE_G * l.mass(i);
+    }
+    const double* x = l.pos_column(0);
+    const double* y = l.pos_column(1);
+    const double* z = l.pos_column(2);
+    par.for_range(n, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; i++) {
+        double lo[3];
+        double hi[3];
+        // Bodies before and after i, so i never meets itself.
+        accel_mixed(i, x, y, z, gm, x[i], y[i], z[i], lo);
+        accel_mixed(n - i - 1, x + i + 1, y + i + 1, z + i + 1, gm + i + 1,
+                    x[i], y[i], z[i], hi);
+        for (size_t k = 0; k < 3; k++) {
+          l.acc(i, k) = lo[k] + hi[k];
+        }
+      }
+    });
+  }
+};
+
+
+// The scheme planets2 and NBody use.
+class TaylorStep {
+ public:
+  template <typename E>
+  inline void step(E& e, double dt) {
+    e.accelerate();
+    e.drift(dt, dt * dt * 0.5);
+    e.kick(dt);
+  }
+
+  inline void reset() { }
+};
+
+// Velocity Verlet (kick, drift, kick). The acceleration at the end of one
+// step is reused at the start of the next, so after changing positions by
+// hand call the engine's reset().
+class VerletStep {
+ public:
+  template <typename E>
+  inline void step(E& e, double dt) {
+    if (!primed_) {
+      e.accelerate();
+      primed_ = true;
+    }
+    e.kick(dt * 0.5);
+    e.drift(dt, 0);
+    e.accelerate();
+    e.kick(dt * 0.5);
+  }
+
+  inline void reset() { primed_ = false; }
+
+ private:
+  bool primed_ = false;
+};
+
+
+template <typename Layout,
+          typename Force = PairForce,
+          typename Integrator = TaylorStep,
+          typename Parallel = Serial>
+class Engine : public Layout {
+ public:
+  static_assert(Force::splits || !Parallel::concurrent,
+                "this force can't be split over threads");
+
+  using Layout::Layout;
+
+  inline void accelerate() {
+    scratch_.reset();
+    force_.accelerate(layout(), parallel_, scratch_);
+  }
+
+  // x += v * dt + a * c
+  inline void drift(double dt, double c) {
+    Layout& l = layout();
+    for (size_t i = 0; i < l.count(); i++) {
+      for (size_t k = 0; k < 3; k++) {
+        l.pos(i, k) += l.vel(i, k) * dt + l.acc(i, k) * c;
+      }
+    }
+  }
+
+  // v += a * dt
+  inline void kick(double dt) {
+    Layout& l = layout();
+    for (size_t i = 0; i < l.count(); i++) {
+      for (size_t k = 0; k < 3; k++) {
+        l.vel(i, k) += l.acc(i, k) * dt;
+      }
+    }
+  }
+
+  inline void step(double dt) { integrator_.step(*this, dt); }
+
+  inline void run(uint64_t steps, double dt) {
+    for (uint64_t s = 0; s < steps; s++) {
+      step(dt);
+    }
+  }
+
+  // Forget anything the integrator carried over from the last step, after
+  // the bodies were changed from outside.
+  inline void reset() { integrator_.reset(); }
+
+  inline Layout& layout() { return *this; }
+  inline Parallel& parallel() { return parallel_; }
+  inline Arena& scratch() { return scratch_; }
+
+ private:
+  Force force_;
+  Arena scratch_;
+  Integrator integrator_;
+  Parallel parallel_;
+};
+
+}  // namespace ssm
+
+#endif  // ENGINE_H_
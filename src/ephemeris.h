@@ -0,0 +1,374 @@
+#ifndef EPHEMERIS_H_
+#define EPHEMERIS_H_
+
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ssm {
+
+// Chebyshev ephemeris, in the style of the JPL DE files. Time is split into
+// fixed length intervals (records). For every record each body's x, y and z
+// are stored as a Chebyshev series of the given degree over that interval.
+// Velocity comes from differentiating the series.
+//
+//   EphemHeader
+//   name_offsets[bodies + 1]   uint64_t
+//   names                      char data, padded to 8 bytes
+//   record[records]            double[bodies][3][degree + 1]
+//
+// Looking up a body at any time is a division to find the record and a
+// degree + 1 term recurrence per axis.
+struct EphemHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t degree;
+  uint64_t bodies;
+  uint64_t records;
+  uint64_t first_record;
+  double t0;
+  double interval;
+  uint64_t reserved[3];
+};
+
+static_assert(sizeof(EphemHeader) == 80, "ephemeris header size");
+
+constexpr char EPHEM_MAGIC[8] = { 'S', 'S', 'M', 'E', 'P', 'H', 'E', 'M' };
+constexpr uint32_t EPHEM_VERSION = 1;
+
+
+// Builds an ephemeris while the integrator runs. The builder asks for the
+// system state at the Chebyshev nodes of the current interval (next()), and
+// once it has all of them fits the coefficients and appends the record to
+// the file. Only one interval's worth of samples is ever held in memory.
+class EphemerisBuilder {
+ public:
+  EphemerisBuilder(size_t bodies,
+                   double t0,
+                   double interval,
+                   unsigned degree = 13)
+    : bodies_(bodies),
+      degree_(degree),
+      nodes_(degree + 1),
+      t0_(t0),
+      interval_(interval),
+      samples_(bodies * 3 * nodes_),
+      record_(bodies * 3 * nodes_),
+      basis_(nodes_ * nodes_) {
+    // Gauss-Chebyshev nodes in ascending order, and T_j at each of them.
+    for (size_t k = 0; k < nodes_; k++) {
+      double x = -std::cos(M_PI * (k + 0.5) / nodes_);
+      double tp = 1;
+      double tc = x;
+      x_.push_back(x);
+      basis_[k] = 1;
+      for (size_t j = 1; j < nodes_; j++) {
+        basis_[j * nodes_ + k] = tc;
+        double tn = 2 * x * tc - tp;
+        tp = tc;
+        tc = tn;
+      }
+    }
+  }
+
+  ~EphemerisBuilder() { close(); }
+
+  EphemerisBuilder(const EphemerisBuilder&) = delete;
+  EphemerisBuilder& operator=(const EphemerisBuilder&) = delete;
+
+  // Create path and write the header. Returns 0 or a negative errno.
+  int open(const char* path, const std::vector<std::string>& names) {
+    std::vector<uint64_t> offsets(names.size() + 1);
+    std::string blob;
+
+    fp_ = fopen(path, "wb");
+    if (fp_ == nullptr)
+      return -errno;
+    offsets[0] = 0;
+    for (size_t i = 0; i < names.size(); i++) {
+      blob += names[i];
+      offsets[i + 1] = blob.size();
+    }
+    blob.resize((blob.size() + 7) & ~size_t(7));
+    first_record_ = sizeof(EphemHeader) +
+                    offsets.size() * sizeof(uint64_t) +
+                    blob.size();
+    write_header();
+    fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), fp_);
+    fwrite(blob.data(), 1, blob.size(), fp_);
+    return ferror(fp_) ? -EIO : 0;
+  }
+
+  // Rewrite the header with the final record count and close the file.
+  // Samples of a partly covered interval are discarded. Returns 0 or a
+  // negative errno.
+  int close() {
+    int err;
+    if (fp_ == nullptr)
+      return 0;
+    fseek(fp_, 0, SEEK_SET);
+    write_header();
+    err = ferror(fp_) ? -EIO : 0;
+    if (fclose(fp_) != 0 && err == 0)
+      err = -errno;
+    fp_ = nullptr;
+    return err;
+  }
+
+  // Time at which the next sample is needed.
+  inline double next() const {
+    double half = interval_ / 2;
+    return t0_ + records_ * interval_ + half + half * x_[node_];
+  }
+
+  inline uint64_t records() const { return records_; }
+
+  // Add the state of every body at time next().
+  void add(const BodyState* states) {
+    for (size_t b = 0; b < bodies_; b++) {
+      for (size_t a = 0; a < 3; a++) {
+        samples_[(b * 3 + a) * nodes_ + node_] = states[b].pos[a];
+      }
+    }
+    if (++node_ < nodes_)
+      return;
+    fit();
+    if (fp_ != nullptr)
+      fwrite(record_.data(), sizeof(double), record_.size(), fp_);
+    records_++;
+    node_ = 0;
+  }
+
+ private:
+  // c_j = 2/N * sum_k f(x_k) T_j(x_k), with c_0 halved so the series is
+  // simply sum_j c_j T_j(x).
+  void fit() {
+    double scale = 2.0 / nodes_;
+    for (size_t s = 0; s < bodies_ * 3; s++) {
+      const double* f = &samples_[s * nodes_];
+      double* c = &record_[s * nodes_];
+      for (size_t j = 0; j < nodes_; j++) {
+        const double* t = &basis_[j * nodes_];
+        double sum = 0;
+        for (size_t k = 0; k < nodes_; k++) {
+          sum += f[k] * t[k];
+        }
+        c[j] = sum * scale;
+      }
+      c[0] *= 0.5;
+    }
+  }
+
+  void write_header() {
+    EphemHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, EPHEM_MAGIC, sizeof(h.magic));
+    h.version = EPHEM_VERSION;
+    h.degree = degree_;
+    h.bodies = bodies_;
+    h.records = records_;
+    h.first_record = first_record_;
+    h.t0 = t0_;
+    h.interval = interval_;
+    fwrite(&h, sizeof(h), 1, fp_);
+  }
+
+  size_t bodies_;
+  unsigned degree_;
+  size_t nodes_;
+  double t0_;
+  double interval_;
+  size_t node_ = 0;
+  uint64_t records_ = 0;
+  uint64_t first_record_ = 0;
+  FILE* fp_ = nullptr;
+  std::vector<double> x_;
+  // [body][axis][node]
+  std::vector<double> samples_;
+  // [body][axis][coefficient]
+  std::vector<double> record_;
+  // [j][node] = T_j(x_node)
+  std::vector<double> basis_;
+};
+
+
+// Memory mapped ephemeris reader.
+class Ephemeris {
+ public:
+  Ephemeris() { }
+  ~Ephemeris() { close(); }
+
+  Ephemeris(const Ephemeris&) = delete;
+  Ephemeris& operator=(const Ephemeris&) = delete;
+
+  // Returns 0, a negative errno, or -EINVAL if the file isn't valid. A file
+  // without records, such as one whose writer never closed it, isn't.
+  int open(const char* path) {
+    struct stat st;
+    int fd;
+
+    close();
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+      return -errno;
+    if (::fstat(fd, &st) != 0) {
+      int err = -errno;
+      ::close(fd);
+      return err;
+    }
+    if (static_cast<size_t>(st.st_size) < sizeof(EphemHeader)) {
+      ::close(fd);
+      return -EINVAL;
+    }
+    void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+      return -errno;
+    base_ = static_cast<const char*>(addr);
+    size_ = st.st_size;
+
+    const EphemHeader* h = header();
+    stride_ = (h->degree + 1) * 3;
+    // Sizes are checked by division, so a bad header can't overflow them.
+    size_t record = stride_ * sizeof(double);
+    if (std::memcmp(h->magic, EPHEM_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != EPHEM_VERSION ||
+        !(h->interval > 0) ||
+        h->records == 0 ||
+        h->bodies == 0 ||
+        h->bodies >= size_ / sizeof(uint64_t) ||
+        h->first_record > size_ ||
+        h->first_record < sizeof(EphemHeader) +
+                          (h->bodies + 1) * sizeof(uint64_t) ||
+        h->first_record % sizeof(double) != 0 ||
+        h->degree >= size_ / sizeof(double) ||
+        h->bodies > (size_ - h->first_record) / record) {
+      close();
+      return -EINVAL;
+    }
+    record *= h->bodies;
+    if ((size_ - h->first_record) % record != 0 ||
+        (size_ - h->first_record) / record != h->records ||
+        !valid_names()) {
+      close();
+      return -EINVAL;
+    }
+    coef_ = reinterpret_cast<const double*>(base_ + h->first_record);
+    inv_interval_ = 1 / h->interval;
+    return 0;
+  }
+
+  void close() {
+    if (base_ != nullptr)
+      ::munmap(const_cast<char*>(base_), size_);
+    base_ = nullptr;
+    size_ = 0;
+  }
+
+  inline const EphemHeader* header() const {
+    return reinterpret_cast<const EphemHeader*>(base_);
+  }
+  inline size_t bodies() const { return header()->bodies; }
+  inline double begin() const { return header()->t0; }
+  inline double end() const {
+    return header()->t0 + header()->records * header()->interval;
+  }
+
+  inline std::string name(size_t i) const {
+    return std::string(name_data(i), name_size(i));
+  }
+
+  // Name of body i without copying it. Not NUL terminated.
+  inline const char* name_data(size_t i) const {
+    return reinterpret_cast<const char*>(name_offsets() + bodies() + 1) +
+           name_offsets()[i];
+  }
+  inline size_t name_size(size_t i) const {
+    return name_offsets()[i + 1] - name_offsets()[i];
+  }
+
+  long find(const std::string& name) const {
+    for (size_t i = 0; i < bodies(); i++) {
+      if (this->name(i) == name)
+        return i;
+    }
+    return -1;
+  }
+
+  // Position and, if vel isn't null, velocity of body at time t. Returns false
+  // if t is outside [begin(), end()].
+  inline bool state(size_t body, double t, double pos[3], double* vel) const {
+    const EphemHeader* h = header();
+    double u = (t - h->t0) * inv_interval_;
+    if (h->records == 0 || !(u >= 0) || u > h->records)
+      return false;
+    uint64_t r = u < h->records ? static_cast<uint64_t>(u) : h->records - 1;
+    double x = 2 * (u - r) - 1;
+    size_t n = h->degree + 1;
+    const double* c = coef_ + (r * h->bodies + body) * stride_;
+
+    for (size_t a = 0; a < 3; a++, c += n) {
+      // T_j and T_j' by their three term recurrences.
+      double tp = 1;
+      double tc = x;
+      double dp = 0;
+      double dc = 1;
+      double p = c[0] + (n > 1 ? c[1] * x : 0);
+      double v = n > 1 ? c[1] : 0;
+      for (size_t j = 2; j < n; j++) {
+        double tn = 2 * x * tc - tp;
+        double dn = 2 * tc + 2 * x * dc - dp;
+        p += c[j] * tn;
+        v += c[j] * dn;
+        tp = tc;
+        tc = tn;
+        dp = dc;
+        dc = dn;
+      }
+      pos[a] = p;
+      if (vel != nullptr)
+        vel[a] = v * 2 * inv_interval_;
+    }
+    return true;
+  }
+
+ private:
+  inline const uint64_t* name_offsets() const {
+    return reinterpret_cast<const uint64_t*>(base_ + sizeof(EphemHeader));
+  }
+
+  // Whether the name offsets start at 0, ascend and stay before the first
+  // record.
+  bool valid_names() const {
+    const uint64_t* off = name_offsets();
+    size_t n = bodies();
+    uint64_t room = header()->first_record - sizeof(EphemHeader) -
+                    (n + 1) * sizeof(uint64_t);
+    for (size_t i = 0; i < n; i++) {
+      if (off[i] > off[i + 1])
+        return false;
+    }
+    return off[0] == 0 && off[n] <= room;
+  }
+
+  const char* base_ = nullptr;
+  size_t size_ = 0;
+  size_t stride_ = 0;
+  const double* coef_ = nullptr;
+  double inv_interval_ = 0;
+};
+
+}  // namespace ssm
+
+#endif  // EPHEMERIS_H_
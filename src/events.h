@@ -0,0 +1,249 @@
+#ifndef EVENTS_H_
+#define EVENTS_H_
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace ssm {
+
+enum OrbitEventType {
+  EVENT_PERIAPSIS = 0,
+  EVENT_APOAPSIS = 1,
+  EVENT_ASCENDING_NODE = 2,
+  EVENT_DESCENDING_NODE = 3,
+  // A test particle retired for leaving (see ParticleIntegrator::Ejection).
+  EVENT_UNBOUND = 4,
+  EVENT_OUT_OF_RANGE = 5,
+};
+
+static const char* const ORBIT_EVENT_NAMES[] = {
+  "periapsis", "apoapsis", "ascending_node", "descending_node",
+  "unbound", "out_of_range"
+};
+
+struct OrbitEvent {
+  double time;
+  uint64_t step;
+  uint32_t body;
+  uint32_t type;
+  // Distance from the orbited body at the event.
+  double distance;
+};
+
+
+// Finds apsis passages and node crossings as the integration runs, instead of
+// searching a dumped trajectory afterwards.
+//
+// For each body, with r, v and a relative to the body it orbits:
+//
+//   r.v changes sign at an apsis: - to + at periapsis, + to - at apoapsis.
+//   z changes sign at a node: - to + ascending, + to - descending.
+//
+// Both are smooth, and their time derivatives are known exactly (v.v + r.a
+// and vz), so the crossing between two observations is found as the root of
+// the cubic Hermite interpolant through them. Position at the event is
+// interpolated the same way using velocity. That keeps events accurate to far
+// better than a step even when bodies are only observed every few steps.
+class EventDetector {
+ public:
+  explicit EventDetector(size_t bodies) : prev_(bodies) { }
+
+  // Observe body at time t. Writes any events since its last observation to
+  // out, which needs room for 2, and returns how many.
+  size_t observe(size_t body,
+                 uint64_t step,
+                 double t,
+                 const double r[3],
+                 const double v[3],
+                 const double a[3],
+                 OrbitEvent* out) {
+    Sample cur;
+    size_t n = 0;
+
+    cur.t = t;
+    for (int k = 0; k < 3; k++) {
+      cur.r[k] = r[k];
+      cur.v[k] = v[k];
+    }
+    cur.rv = dot(r, v);
+    cur.drv = dot(v, v) + dot(r, a);
+    cur.valid = true;
+
+    Sample& p = prev_[body];
+    if (p.valid && t > p.t) {
+      bool s0 = p.rv >= 0;
+      bool s1 = cur.rv >= 0;
+      if (s0 != s1) {
+        double s = root(p.rv, p.drv, cur.rv, cur.drv, t - p.t);
+        out[n++] = event(body, step, s1 ? EVENT_PERIAPSIS : EVENT_APOAPSIS,
+                         p, cur, s);
+      }
+      s0 = p.r[2] >= 0;
+      s1 = cur.r[2] >= 0;
+      if (s0 != s1) {
+        double s = root(p.r[2], p.v[2], cur.r[2], cur.v[2], t - p.t);
+        out[n++] = event(body, step,
+                         s1 ? EVENT_ASCENDING_NODE : EVENT_DESCENDING_NODE,
+                         p, cur, s);
+      }
+    }
+    p = cur;
+    return n;
+  }
+
+ private:
+  struct Sample {
+    double t = 0;
+    double r[3] = { 0, 0, 0 };
+    double v[3] = { 0, 0, 0 };
+    double rv = 0;
+    double drv = 0;
+    bool valid = false;
+  };
+
+  static inline double dot(const double* x, const double* y) {
+    return x[0] * y[0] + x[1] * y[1] + x[2] * y[2];
+  }
+
+  // Cubic Hermite through (0, f0) and (1, f1) with slopes h * d0 and h * d1.
+  static inline double hermite(double f0,
+                               double d0,
+                               double f1,
+                               double d1,
+                               double h,
+                               double s) {
+    double s2 = s * s;
+    double s3 = s2 * s;
+    return (2 * s3 - 3 * s2 + 1) * f0 + (s3 - 2 * s2 + s) * h * d0 +
+           (-2 * s3 + 3 * s2) * f1 + (s3 - s2) * h * d1;
+  }
+
+  static inline double hermite_slope(double f0,
+                                     double d0,
+                                     double f1,
+                                     double d1,
+                                     double h,
+                                     double s) {
+    double s2 = s * s;
+    return (6 * s2 - 6 * s) * f0 + (3 * s2 - 4 * s + 1) * h * d0 +
+           (-6 * s2 + 6 * s) * f1 + (3 * s2 - 2 * s) * h * d1;
+  }
+
+  // Fraction of the interval where the interpolant crosses zero, given f0 and
+  // f1 have different signs. Newton from the linear estimate, falling back to
+  // bisection whenever a step would leave the bracket.
+  static double root(double f0, double d0, double f1, double d1, double h) {
+    double lo = 0;
+    double hi = 1;
+    double s = f0 / (f0 - f1);
+    for (int i = 0; i < 20; i++) {
+      double f = hermite(f0, d0, f1, d1, h, s);
+      if ((f >= 0) == (f0 >= 0))
+        lo = s;
+      else
+        hi = s;
+      double df = hermite_slope(f0, d0, f1, d1, h, s);
+      double next = df != 0 ? s - f / df : lo;
+      if (!(next > lo && next < hi))
+        next = (lo + hi) / 2;
+      if (std::fabs(next - s) < 1e-12)
+        return next;
+      s = next;
+    }
+    return s;
+  }
+
+  static OrbitEvent event(size_t body,
+                          uint64_t step,
+                          OrbitEventType type,
+                          const Sample& p,
+                          const Sample& c,
+                          double s) {
+    double h = c.t - p.t;
+    double d = 0;
+    for (int k = 0; k < 3; k++) {
+      double x = hermite(p.r[k], p.v[k], c.r[k], c.v[k], h, s);
+      d += x * x;
+    }
+    OrbitEvent e;
+    e.time = p.t + s * h;
+    e.step = step;
+    e.body = body;
+    e.type = type;
+    e.distance = std::sqrt(d);
+    return e;
+  }
+
+  std::vector<Sample> prev_;
+};
+
+
+// Text event stream, one event per line:
+//
+//   time,step,body,event,distance
+class EventLog {
+ public:
+  EventLog() { }
+  ~EventLog() { close(); }
+
+  EventLog(const EventLog&) = delete;
+  EventLog& operator=(const EventLog&) = delete;
+
+  // Returns 0 or a negative errno. A path of "-" writes to stdout.
+  int open(const char* path, const std::vector<std::string>& names) {
+    names_ = names;
+    if (std::string(path) == "-") {
+      fp_ = stdout;
+    } else {
+      fp_ = fopen(path, "w");
+      if (fp_ == nullptr)
+        return -errno;
+    }
+    fprintf(fp_, "time,step,body,event,distance\n");
+    return 0;
+  }
+
+  int close() {
+    int err = 0;
+    if (fp_ == nullptr)
+      return 0;
+    if (ferror(fp_))
+      err = -EIO;
+    if (fp_ != stdout && fclose(fp_) != 0 && err == 0)
+      err = -errno;
+    fp_ = nullptr;
+    return err;
+  }
+
+  void write(const OrbitEvent& e) {
+    const std::string& name = names_[e.body];
+    write(e, name.data(), name.size());
+  }
+
+  // For bodies that weren't named in open(), such as test particles.
+  void write(const OrbitEvent& e, const char* name, size_t len) {
+    fprintf(fp_, "%.6f,%lu,%.*s,%s,%.17g\n",
+            e.time,
+            e.step,
+            static_cast<int>(len),
+            name,
+            ORBIT_EVENT_NAMES[e.type],
+            e.distance);
+    written_++;
+  }
+
+  inline uint64_t written() const { return written_; }
+
+ private:
+  FILE* fp_ = nullptr;
+  std::vector<std::string> names_;
+  uint64_t written_ = 0;
+};
+
+}  // namespace ssm
+
+#endif  // EVENTS_H_
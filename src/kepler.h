@@ -0,0 +1,51 @@
+#ifndef KEPLER_H_
+#define KEPLER_H_
+
+#include "utils.h"
+
+#include <cmath>
+
+namespace ssm {
+
+/**
+ * Cartesian position and velocity, relative to the orbited body, of a body
+ * with the given Keplerian elements.
+ *
+ * mu - gravitational parameter (G * M) of the orbited body
+ * a - semi-major axis
+ * e - eccentricity
+ * i - inclination in degrees
+ * w - argument of periapsis (ω) in degrees
+ * Om - longitude of ascending node (Ω) in degrees
+ * E - eccentric anomaly in radians
+ */
+inline void kep2cart(double mu, double a, double e, double i, double w,
+                     double Om, double E, double pos[3], double vel[3]) {
+  constexpr double d2r = PI / 180;
+  i *= d2r;
+  w *= d2r;
+  Om *= d2r;
+  double v = 2 * std::atan(std::sqrt((1 + e) / (1 - e)) * std::tan(E / 2));
+  double r = a * (1 - e * std::cos(E));
+  double h = std::sqrt(mu * a / (1 - e * e));
+  double cos_i = std::cos(i);
+  double sin_i = std::sin(i);
+  double cos_Om = std::cos(Om);
+  double sin_Om = std::sin(Om);
+  double cos_wv = std::cos(w + v);
+  double sin_wv = std::sin(w + v);
+  double cos_w = std::cos(w);
+  double sin_w = std::sin(w);
+  pos[0] = r * (cos_Om * cos_wv - sin_Om * sin_wv * cos_i);
+  pos[1] = r * (sin_Om * cos_wv + cos_Om * sin_wv * cos_i);
+  pos[2] = r * (sin_i * sin_wv);
+  vel[0] = -(mu / h) * (cos_Om * (sin_wv + e * sin_w) +
+                        sin_Om * (cos_wv + e * cos_w) * cos_i);
+  vel[1] = -(mu / h) * (sin_Om * (sin_wv + e * sin_w) -
+                        cos_Om * (cos_wv + e * cos_w) * cos_i);
+  vel[2] = (mu / h) * (cos_wv + e * cos_w) * sin_i;
+}
+
+}  // namespace ssm
+
+#endif  // KEPLER_H_
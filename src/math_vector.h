@@ -2,132 +2,385 @@
 #define MATH_VECTOR_H_
 
 #include <cmath>
+#include <cstddef>
+#include <type_traits>
+
+// add(), sub(), mul() and div() used to change the vector in place. Now they
+// return the result, so a call that drops it is a bug and gets a warning.
+#if __cplusplus >= 201703L
+#define SSM_NODISCARD [[nodiscard]]
+#else
+#define SSM_NODISCARD __attribute__((warn_unused_result))
+#endif
 
 namespace ssm {
 
-class Vector {
- public:
-  Vector() : coords_{0, 0, 0} { }
-  Vector(const Vector& v) : coords_{v.x(), v.y(), v.z()} { }
-  Vector(double x, double y, double z) : coords_{x, y, z} { }
-
-  constexpr inline double x() const { return coords_[0]; }
-  constexpr inline double y() const { return coords_[1]; }
-  constexpr inline double z() const { return coords_[2]; }
-  inline void x(double n) { coords_[0] = n; }
-  inline void y(double n) { coords_[1] = n; }
-  inline void z(double n) { coords_[2] = n; }
-
-  inline void set(double x_, double y_, double z_) {
-    coords_[0] = x_;
-    coords_[1] = y_;
-    coords_[2] = z_;
+template <typename E>
+struct ExprTraits;
+
+namespace vector_expr {
+
+// Calls f(0), ..., f(N - 1) unrolled. Loops this short over a compile time
+// count aren't reliably unrolled at -O2, and a loop of three scalar ops costs
+// more than the ops.
+template <size_t I, size_t N>
+struct Unroll {
+  template <typename F>
+  static inline void run(F&& f) {
+    f(I);
+    Unroll<I + 1, N>::run(f);
   }
-  inline void set(const Vector& v) { set(v.x(), v.y(), v.z()); }
-  inline void set(Vector* v) { set(v->x(), v->y(), v->z()); }
-  inline void zero() { set(0, 0, 0); }
+};
+template <size_t N>
+struct Unroll<N, N> {
+  template <typename F>
+  static inline void run(F&&) { }
+};
+
+}  // namespace vector_expr
 
-  constexpr inline double len_sq() const {
-    return x() * x() + y() * y() + z() * z();
+// Vector arithmetic is done with expression templates. An expression like
+//
+//   acc += -G * m / (rsq * sqrt(rsq)) * (pos - p);
+//
+// doesn't build a Vector for (pos - p) and another for the scaled result.
+// Each operator returns a small node that records its operands, and only
+// assigning to a Vector evaluates the tree, one component at a time. That
+// inlines to the same three lines of arithmetic as writing out x, y and z by
+// hand, which the compiler is free to contract into FMAs.
+//
+// Nodes hold Vectors by reference, so an expression must be used within the
+// statement that builds it. Don't keep one in an auto variable; assign it to
+// a Vector instead.
+template <typename E>
+class VectorExpr {
+ public:
+  using value_type = typename ExprTraits<E>::value_type;
+  static constexpr size_t size = ExprTraits<E>::size;
+
+  constexpr inline const E& self() const {
+    return static_cast<const E&>(*this);
   }
-  inline double len() const { return std::sqrt(len_sq()); }
+  constexpr inline value_type operator[](size_t i) const { return self()[i]; }
+
+  constexpr inline value_type x() const { return self()[0]; }
+  constexpr inline value_type y() const { return self()[1]; }
+  constexpr inline value_type z() const { return self()[2]; }
 
-  inline double mag_sq(const Vector& v) const {
-    return std::pow(x() - v.x(), 2) + std::pow(y() - v.y(), 2) +
-      std::pow(z() - v.z(), 2);
+  inline value_type len_sq() const { return dot(*this); }
+  inline value_type len() const { return std::sqrt(len_sq()); }
+
+  template <typename F>
+  inline value_type dot(const VectorExpr<F>& v) const {
+    value_type sum = 0;
+    vector_expr::Unroll<0, size>::run([&](size_t i) {
+      sum += (*this)[i] * v[i];
+    });
+    return sum;
   }
-  inline double mag_sq(Vector* v) const { return mag_sq(*v); }
 
-  inline double mag(const Vector& v) const {
-    return std::sqrt(mag_sq(v));
+  template <typename F>
+  inline value_type mag_sq(const VectorExpr<F>& v) const {
+    value_type sum = 0;
+    vector_expr::Unroll<0, size>::run([&](size_t i) {
+      value_type d = (*this)[i] - v[i];
+      sum += d * d;
+    });
+    return sum;
   }
-  inline double mag(Vector* v) const { return mag(*v); }
 
-  constexpr inline double dot(const Vector& v) const {
-    return x() * v.x() + y() * v.y() + z() * v.z();
+  template <typename F>
+  inline value_type mag(const VectorExpr<F>& v) const {
+    return std::sqrt(mag_sq(v));
   }
-  constexpr inline double dot(Vector* v) const { return dot(*v); }
 
-  inline double angle_rad(const Vector& v) const {
+  template <typename F>
+  inline value_type angle_rad(const VectorExpr<F>& v) const {
     return std::acos(dot(v) / (len() * v.len()));
   }
-  inline double angle_rad(Vector* v) const { return angle_rad(*v); }
 
-  inline double angle_deg(const Vector& v) const {
+  template <typename F>
+  inline value_type angle_deg(const VectorExpr<F>& v) const {
     return angle_rad(v) * 180 / 3.141592653589793;
   }
-  inline double angle_deg(Vector* v) const { return angle_deg(*v); }
+};
 
-  inline Vector add(double n) const {
-    return Vector(x() + n, y() + n, z() + n);
-  }
-  inline Vector add(const Vector& v) const {
-    return Vector(x() + v.x(), y() + v.y(), z() + v.z());
+
+// N components of type T. With Padded the storage is rounded up to a multiple
+// of 4 lanes and aligned to its size, so a 3 component double vector fills
+// exactly one 256 bit register (or a float one a 128 bit register). Results
+// are then computed across all the lanes at once. The padding lanes hold no
+// meaning; lengths, dot products and the like only read the first N.
+//
+// Vector is the double, 3 component, unpadded form used by the engines.
+template <typename T, size_t N = 3, bool Padded = false>
+class BasicVector : public VectorExpr<BasicVector<T, N, Padded>> {
+ public:
+  static_assert(std::is_floating_point<T>::value, "T must be float or double");
+  static_assert(N > 0, "vectors need at least one component");
+
+  using value_type = T;
+  static constexpr size_t size = N;
+  static constexpr size_t lanes = Padded ? (N + 3) / 4 * 4 : N;
+
+  BasicVector() : coords_{} { }
+  BasicVector(const BasicVector& v) : coords_{} { assign(v); }
+  BasicVector(T x, T y, T z) : coords_{x, y, z} {
+    static_assert(N == 3, "x, y, z constructor needs 3 components");
   }
-  inline Vector add(Vector* v) const { return add(*v); }
+  template <typename E>
+  BasicVector(const VectorExpr<E>& e) : coords_{} { assign(e); }
+
+  constexpr inline T operator[](size_t i) const { return coords_[i]; }
+  inline T& operator[](size_t i) { return coords_[i]; }
+  inline const T* data() const { return coords_; }
+  inline T* data() { return coords_; }
+
+  constexpr inline T x() const { return coords_[0]; }
+  constexpr inline T y() const { return coords_[1]; }
+  constexpr inline T z() const { return coords_[2]; }
+  inline void x(T n) { coords_[0] = n; }
+  inline void y(T n) { coords_[1] = n; }
+  inline void z(T n) { coords_[2] = n; }
 
-  inline Vector sub(double n) const {
-    return Vector(x() - n, y() - n, z() - n);
+  inline void set(T x_, T y_, T z_) {
+    static_assert(N == 3, "set(x, y, z) needs 3 components");
+    coords_[0] = x_;
+    coords_[1] = y_;
+    coords_[2] = z_;
   }
-  inline Vector sub(const Vector& v) const {
-    return Vector(x() - v.x(), y() - v.y(), z() - v.z());
+  inline void set(const BasicVector& v) { assign(v); }
+  inline void set(const BasicVector* v) { assign(*v); }
+  inline void zero() {
+    vector_expr::Unroll<0, lanes>::run([&](size_t i) { coords_[i] = 0; });
   }
-  inline Vector sub(Vector* v) const { return sub(*v); }
 
-  inline Vector mul(double n) const {
-    return Vector(x() * n, y() * n, z() * n);
+  using VectorExpr<BasicVector>::mag_sq;
+  using VectorExpr<BasicVector>::mag;
+  using VectorExpr<BasicVector>::dot;
+  using VectorExpr<BasicVector>::angle_rad;
+  using VectorExpr<BasicVector>::angle_deg;
+  inline T mag_sq(const BasicVector* v) const { return mag_sq(*v); }
+  inline T mag(const BasicVector* v) const { return mag(*v); }
+  inline T dot(const BasicVector* v) const { return dot(*v); }
+  inline T angle_rad(const BasicVector* v) const { return angle_rad(*v); }
+  inline T angle_deg(const BasicVector* v) const { return angle_deg(*v); }
+
+  SSM_NODISCARD inline BasicVector add(T n) const;
+  SSM_NODISCARD inline BasicVector add(const BasicVector& v) const;
+  SSM_NODISCARD inline BasicVector add(const BasicVector* v) const {
+    return add(*v);
   }
-  inline Vector mul(const Vector& v) const {
-    return Vector(x() * v.x(), y() * v.y(), z() * v.z());
+  SSM_NODISCARD inline BasicVector sub(T n) const;
+  SSM_NODISCARD inline BasicVector sub(const BasicVector& v) const;
+  SSM_NODISCARD inline BasicVector sub(const BasicVector* v) const {
+    return sub(*v);
   }
-  inline Vector mul(Vector* v) const { return mul(*v); }
-
-  inline Vector div(double n) const {
-    return Vector(x() / n, y() / n, z() / n);
+  SSM_NODISCARD inline BasicVector mul(T n) const;
+  SSM_NODISCARD inline BasicVector mul(const BasicVector& v) const;
+  SSM_NODISCARD inline BasicVector mul(const BasicVector* v) const {
+    return mul(*v);
   }
-  inline Vector div(const Vector& v) const {
-    return Vector(x() / v.x(), y() / v.y(), z() / v.z());
+  SSM_NODISCARD inline BasicVector div(T n) const;
+  SSM_NODISCARD inline BasicVector div(const BasicVector& v) const;
+  SSM_NODISCARD inline BasicVector div(const BasicVector* v) const {
+    return div(*v);
   }
-  inline Vector div(Vector* v) const { return div(*v); }
 
-  friend Vector operator+(const Vector& u, double n) { return u.add(n); }
-  friend Vector operator+(double n, const Vector& u) { return u.add(n); }
-  friend Vector operator+(const Vector& u, const Vector& v) { return u.add(v); }
-  friend Vector operator-(const Vector& u, double n) { return u.sub(n); }
-  friend Vector operator-(double n, const Vector& u) { return u.sub(n); }
-  friend Vector operator-(const Vector& u, const Vector& v) { return u.sub(v); }
-  friend Vector operator*(const Vector& u, double n) { return u.mul(n); }
-  friend Vector operator*(double n, const Vector& u) { return u.mul(n); }
-  friend Vector operator*(const Vector& u, const Vector& v) { return u.mul(v); }
-  friend Vector operator/(const Vector& u, double n) { return u.div(n); }
-  friend Vector operator/(double n, const Vector& u) { return u.div(n); }
-  friend Vector operator/(const Vector& u, const Vector& v) { return u.div(v); }
-
-  Vector& operator=(const Vector& u) {
-    set(u);
+  BasicVector& operator=(const BasicVector& u) {
+    assign(u);
     return *this;
   }
-  Vector& operator+=(const Vector& u) {
-    set(x() + u.x(), y() + u.y(), z() + u.z());
+
+  // Each component of the result only depends on the same component of the
+  // operands, so writing in place is safe even if this appears in e.
+  template <typename E>
+  BasicVector& operator=(const VectorExpr<E>& e) {
+    assign(e);
     return *this;
   }
-  Vector& operator-=(const Vector& u) {
-    set(x() - u.x(), y() - u.y(), z() - u.z());
-    return *this;
+  template <typename E>
+  BasicVector& operator+=(const VectorExpr<E>& e) {
+    return *this = *this + e;
   }
-  Vector& operator*=(const Vector& u) {
-    set(x() * u.x(), y() * u.y(), z() * u.z());
-    return *this;
+  template <typename E>
+  BasicVector& operator-=(const VectorExpr<E>& e) {
+    return *this = *this - e;
   }
-  Vector& operator/=(const Vector& u) {
-    set(x() / u.x(), y() / u.y(), z() / u.z());
-    return *this;
+  template <typename E>
+  BasicVector& operator*=(const VectorExpr<E>& e) {
+    return *this = *this * e;
   }
+  template <typename E>
+  BasicVector& operator/=(const VectorExpr<E>& e) {
+    return *this = *this / e;
+  }
+  BasicVector& operator*=(T n) { return *this = *this * n; }
+  BasicVector& operator/=(T n) { return *this = *this / n; }
 
  //private:
-  double coords_[3];
+  // Evaluate e into every lane e has; padding lanes are only written when
+  // every operand of e is padded too.
+  template <typename E>
+  inline void assign(const VectorExpr<E>& e) {
+    static_assert(ExprTraits<E>::size == N, "vector sizes differ");
+    constexpr size_t n =
+        ExprTraits<E>::lanes < lanes ? ExprTraits<E>::lanes : lanes;
+    vector_expr::Unroll<0, n>::run([&](size_t i) { coords_[i] = e[i]; });
+  }
+
+  alignas(Padded ? lanes * sizeof(T) : alignof(T)) T coords_[lanes];
 };
 
+using Vector = BasicVector<double, 3>;
+using VectorF = BasicVector<float, 3>;
+using PaddedVector = BasicVector<double, 3, true>;
+using PaddedVectorF = BasicVector<float, 3, true>;
+
+template <typename T, size_t N, bool Padded>
+struct ExprTraits<BasicVector<T, N, Padded>> {
+  using value_type = T;
+  static constexpr size_t size = N;
+  static constexpr size_t lanes = BasicVector<T, N, Padded>::lanes;
+};
+
+
+namespace vector_expr {
+
+// A scalar operand, the same in every component.
+template <typename T>
+class Scalar : public VectorExpr<Scalar<T>> {
+ public:
+  constexpr explicit Scalar(T n) : n_(n) { }
+  constexpr inline T operator[](size_t) const { return n_; }
+
+ private:
+  T n_;
+};
+
+// Vectors are held by reference; other nodes are small and held by value.
+template <typename T>
+struct Operand { using type = const T; };
+template <typename T, size_t N, bool Padded>
+struct Operand<BasicVector<T, N, Padded>> {
+  using type = const BasicVector<T, N, Padded>&;
+};
+
+struct Add {
+  template <typename T>
+  static constexpr inline T apply(T a, T b) { return a + b; }
+};
+struct Sub {
+  template <typename T>
+  static constexpr inline T apply(T a, T b) { return a - b; }
+};
+struct Mul {
+  template <typename T>
+  static constexpr inline T apply(T a, T b) { return a * b; }
+};
+struct Div {
+  template <typename T>
+  static constexpr inline T apply(T a, T b) { return a / b; }
+};
+
+template <typename L, typename R, typename Op>
+class Binary : public VectorExpr<Binary<L, R, Op>> {
+ public:
+  using value_type = typename ExprTraits<Binary>::value_type;
+
+  constexpr Binary(const L& l, const R& r) : l_(l), r_(r) { }
+  constexpr inline value_type operator[](size_t i) const {
+    return Op::apply(static_cast<value_type>(l_[i]),
+                     static_cast<value_type>(r_[i]));
+  }
+
+ private:
+  typename Operand<L>::type l_;
+  typename Operand<R>::type r_;
+};
+
+}  // namespace vector_expr
+
+// A scalar takes the size of whatever it's combined with, and never limits
+// how many lanes are computed.
+template <typename T>
+struct ExprTraits<vector_expr::Scalar<T>> {
+  using value_type = T;
+  static constexpr size_t size = 0;
+  static constexpr size_t lanes = ~size_t(0);
+};
+
+template <typename L, typename R, typename Op>
+struct ExprTraits<vector_expr::Binary<L, R, Op>> {
+  using value_type = typename std::common_type<
+      typename ExprTraits<L>::value_type,
+      typename ExprTraits<R>::value_type>::type;
+  static constexpr size_t size =
+      ExprTraits<L>::size > ExprTraits<R>::size ?
+      ExprTraits<L>::size : ExprTraits<R>::size;
+  static constexpr size_t lanes =
+      ExprTraits<L>::lanes < ExprTraits<R>::lanes ?
+      ExprTraits<L>::lanes : ExprTraits<R>::lanes;
+  static_assert(ExprTraits<L>::size == ExprTraits<R>::size ||
+                ExprTraits<L>::size == 0 || ExprTraits<R>::size == 0,
+                "vector sizes differ");
+};
+
+
+// Component-wise operators between any two vector expressions, or between an
+// expression and a scalar applied to every component. Scalars take the
+// expression's precision, so a float vector times 0.5 stays float.
+#define SSM_VECTOR_OPERATOR(op, Op)                                           \
+  template <typename L, typename R>                                           \
+  constexpr inline auto operator op(const VectorExpr<L>& l,                   \
+                                    const VectorExpr<R>& r) {                 \
+    return vector_expr::Binary<L, R, vector_expr::Op>(l.self(), r.self());    \
+  }                                                                           \
+  template <typename L>                                                       \
+  constexpr inline auto operator op(                                          \
+      const VectorExpr<L>& l, typename ExprTraits<L>::value_type n) {         \
+    using S = vector_expr::Scalar<typename ExprTraits<L>::value_type>;        \
+    return vector_expr::Binary<L, S, vector_expr::Op>(l.self(), S(n));        \
+  }                                                                           \
+  template <typename R>                                                       \
+  constexpr inline auto operator op(                                          \
+      typename ExprTraits<R>::value_type n, const VectorExpr<R>& r) {         \
+    using S = vector_expr::Scalar<typename ExprTraits<R>::value_type>;        \
+    return vector_expr::Binary<S, R, vector_expr::Op>(S(n), r.self());        \
+  }
+
+SSM_VECTOR_OPERATOR(+, Add)
+SSM_VECTOR_OPERATOR(-, Sub)
+SSM_VECTOR_OPERATOR(*, Mul)
+SSM_VECTOR_OPERATOR(/, Div)
+
+#undef SSM_VECTOR_OPERATOR
+
+template <typename E>
+constexpr inline auto operator-(const VectorExpr<E>& e) {
+  return typename ExprTraits<E>::value_type(-1) * e;
+}
+
+
+#define SSM_VECTOR_METHOD(name, op)                                           \
+  template <typename T, size_t N, bool Padded>                                \
+  inline BasicVector<T, N, Padded> BasicVector<T, N, Padded>::name(T n)       \
+      const {                                                                 \
+    return *this op n;                                                        \
+  }                                                                           \
+  template <typename T, size_t N, bool Padded>                                \
+  inline BasicVector<T, N, Padded> BasicVector<T, N, Padded>::name(           \
+      const BasicVector& v) const {                                           \
+    return *this op v;                                                        \
+  }
+
+SSM_VECTOR_METHOD(add, +)
+SSM_VECTOR_METHOD(sub, -)
+SSM_VECTOR_METHOD(mul, *)
+SSM_VECTOR_METHOD(div, /)
+
+#undef SSM_VECTOR_METHOD
+
 }  // namespace ssm
 
 #endif  // MATH_VECTOR_H_
@@ -0,0 +1,320 @@
+#ifndef MIXED_PRECISION_H_
+#define MIXED_PRECISION_H_
+
+#include "simd_dispatch.h"
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(SSM_SIMD_DISPATCH)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+namespace ssm {
+
+// 1 / sqrt(x) in single precision: the hardware estimate (12 bits on x86)
+// refined by one Newton-Raphson step. Without SSE it's the exact value, which
+// the Newton step leaves as it is.
+inline float rsqrt_newton(float x) {
+#if defined(__SSE__)
+  float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+#else
+  float y = 1 / std::sqrt(x);
+#endif
+  return y * (1.5f - 0.5f * x * y * y);
+}
+
+#if defined(__SSE__)
+// rsqrt_newton() of four floats at once.
+inline __m128 rsqrt_newton(__m128 x) {
+  __m128 y = _mm_rsqrt_ps(x);
+  __m128 hx = _mm_mul_ps(_mm_set1_ps(0.5f), x);
+  return _mm_mul_ps(
+      y, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(hx, _mm_mul_ps(y, y))));
+}
+#endif
+
+// Bound on the relative error of inv_r3_mixed() against 1 / (rsq * sqrt(rsq))
+// in double. The estimate is within 1.5 * 2^-12, the Newton step squares that
+// to 2e-7, and rounding in float adds a few 6e-8 ulps; cubing triples it all.
+// test_mixed_precision measures 9.8e-7 over 1e7 random displacements from 1
+// km to 1e15 m. The error doesn't depend on the scale of the displacement
+// within float's range (r up to about 1e19 m).
+constexpr double MIXED_INV_R3_MAX_ERROR = 1.5e-6;
+
+// 1 / r^3 for the displacement (dx, dy, dz), for the force between two
+// bodies. The displacement is taken in double, since positions are too large
+// for the difference to survive in float, and only then narrowed. Squaring
+// and the inverse square root are done in float, without a divide or a
+// double sqrt. The cube is taken in double, as 1 / r^3 of a distant body is
+// below float's range.
+inline double inv_r3_mixed(double dx, double dy, double dz) {
+  float fx = static_cast<float>(dx);
+  float fy = static_cast<float>(dy);
+  float fz = static_cast<float>(dz);
+  double inv = rsqrt_newton(fx * fx + fy * fy + fz * fz);
+  return inv * inv * inv;
+}
+
+namespace mixed_detail {
+
+// Bodies from b on, one at a time, added to the sums.
+inline void accel_tail(size_t b,
+                       size_t n,
+                       const double* bx,
+                       const double* by,
+                       const double* bz,
+                       const double* gm,
+                       double px,
+                       double py,
+                       double pz,
+                       double sx,
+                       double sy,
+                       double sz,
+                       double a[3]) {
+  for (; b < n; b++) {
+    double dx = px - bx[b];
+    double dy = py - by[b];
+    double dz = pz - bz[b];
+    double f = -gm[b] * inv_r3_mixed(dx, dy, dz);
+    sx += f * dx;
+    sy += f * dy;
+    sz += f * dz;
+  }
+  a[0] = sx;
+  a[1] = sy;
+  a[2] = sz;
+}
+
+// With SSE2 each four bodies need twice the conversions and shuffles, which
+// is where most of the time goes.
+inline void accel_sse2(size_t n,
+                       const double* bx,
+                       const double* by,
+                       const double* bz,
+                       const double* gm,
+                       double px,
+                       double py,
+                       double pz,
+                       double a[3]) {
+  size_t b = 0;
+  double sx = 0;
+  double sy = 0;
+  double sz = 0;
+#if defined(__SSE2__)
+  const __m128d x = _mm_set1_pd(px);
+  const __m128d y = _mm_set1_pd(py);
+  const __m128d z = _mm_set1_pd(pz);
+  __m128d ax = _mm_setzero_pd();
+  __m128d ay = _mm_setzero_pd();
+  __m128d az = _mm_setzero_pd();
+  for (; b + 4 <= n; b += 4) {
+    __m128d dx0 = _mm_sub_pd(x, _mm_loadu_pd(bx + b));
+    __m128d dx1 = _mm_sub_pd(x, _mm_loadu_pd(bx + b + 2));
+    __m128d dy0 = _mm_sub_pd(y, _mm_loadu_pd(by + b));
+    __m128d dy1 = _mm_sub_pd(y, _mm_loadu_pd(by + b + 2));
+    __m128d dz0 = _mm_sub_pd(z, _mm_loadu_pd(bz + b));
+    __m128d dz1 = _mm_sub_pd(z, _mm_loadu_pd(bz + b + 2));
+    __m128 fx = _mm_movelh_ps(_mm_cvtpd_ps(dx0), _mm_cvtpd_ps(dx1));
+    __m128 fy = _mm_movelh_ps(_mm_cvtpd_ps(dy0), _mm_cvtpd_ps(dy1));
+    __m128 fz = _mm_movelh_ps(_mm_cvtpd_ps(dz0), _mm_cvtpd_ps(dz1));
+    __m128 rsq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(fx, fx), _mm_mul_ps(fy, fy)),
+                            _mm_mul_ps(fz, fz));
+    __m128 inv = rsqrt_newton(rsq);
+    __m128d i0 = _mm_cvtps_pd(inv);
+    __m128d i1 = _mm_cvtps_pd(_mm_movehl_ps(inv, inv));
+    __m128d f0 = _mm_mul_pd(_mm_loadu_pd(gm + b),
+                            _mm_mul_pd(_mm_mul_pd(i0, i0), i0));
+    __m128d f1 = _mm_mul_pd(_mm_loadu_pd(gm + b + 2),
+                            _mm_mul_pd(_mm_mul_pd(i1, i1), i1));
+    ax = _mm_sub_pd(ax, _mm_add_pd(_mm_mul_pd(f0, dx0), _mm_mul_pd(f1, dx1)));
+    ay = _mm_sub_pd(ay, _mm_add_pd(_mm_mul_pd(f0, dy0), _mm_mul_pd(f1, dy1)));
+    az = _mm_sub_pd(az, _mm_add_pd(_mm_mul_pd(f0, dz0), _mm_mul_pd(f1, dz1)));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, ax);
+  sx = lanes[0] + lanes[1];
+  _mm_storeu_pd(lanes, ay);
+  sy = lanes[0] + lanes[1];
+  _mm_storeu_pd(lanes, az);
+  sz = lanes[0] + lanes[1];
+#endif
+  accel_tail(b, n, bx, by, bz, gm, px, py, pz, sx, sy, sz, a);
+}
+
+#if defined(SSM_SIMD_DISPATCH)
+// AVX converts four doubles at a time.
+__attribute__((target("avx2")))
+inline void accel_avx2(size_t n,
+                       const double* bx,
+                       const double* by,
+                       const double* bz,
+                       const double* gm,
+                       double px,
+                       double py,
+                       double pz,
+                       double a[3]) {
+  size_t b = 0;
+  const __m256d x = _mm256_set1_pd(px);
+  const __m256d y = _mm256_set1_pd(py);
+  const __m256d z = _mm256_set1_pd(pz);
+  __m256d ax = _mm256_setzero_pd();
+  __m256d ay = _mm256_setzero_pd();
+  __m256d az = _mm256_setzero_pd();
+  for (; b + 4 <= n; b += 4) {
+    __m256d dx = _mm256_sub_pd(x, _mm256_loadu_pd(bx + b));
+    __m256d dy = _mm256_sub_pd(y, _mm256_loadu_pd(by + b));
+    __m256d dz = _mm256_sub_pd(z, _mm256_loadu_pd(bz + b));
+    __m128 fx = _mm256_cvtpd_ps(dx);
+    __m128 fy = _mm256_cvtpd_ps(dy);
+    __m128 fz = _mm256_cvtpd_ps(dz);
+    __m128 rsq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(fx, fx), _mm_mul_ps(fy, fy)),
+                            _mm_mul_ps(fz, fz));
+    __m256d inv = _mm256_cvtps_pd(rsqrt_newton(rsq));
+    __m256d f = _mm256_mul_pd(_mm256_loadu_pd(gm + b),
+                              _mm256_mul_pd(_mm256_mul_pd(inv, inv), inv));
+    ax = _mm256_sub_pd(ax, _mm256_mul_pd(f, dx));
+    ay = _mm256_sub_pd(ay, _mm256_mul_pd(f, dy));
+    az = _mm256_sub_pd(az, _mm256_mul_pd(f, dz));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, ax);
+  double sx = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  _mm256_storeu_pd(lanes, ay);
+  double sy = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  _mm256_storeu_pd(lanes, az);
+  double sz = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  accel_tail(b, n, bx, by, bz, gm, px, py, pz, sx, sy, sz, a);
+}
+
+__attribute__((target("avx512f")))
+inline __m256 rsqrt_newton_avx512(__m256 x) {
+  __m256 y = _mm256_rsqrt_ps(x);
+  __m256 hx = _mm256_mul_ps(_mm256_set1_ps(0.5f), x);
+  return _mm256_mul_ps(
+      y, _mm256_sub_ps(_mm256_set1_ps(1.5f),
+                       _mm256_mul_ps(hx, _mm256_mul_ps(y, y))));
+}
+
+// Eight bodies at a time. The last few are loaded under a mask, with their
+// force zeroed, instead of being left to the scalar loop.
+__attribute__((target("avx512f")))
+inline void accel_avx512(size_t n,
+                         const double* bx,
+                         const double* by,
+                         const double* bz,
+                         const double* gm,
+                         double px,
+                         double py,
+                         double pz,
+                         double a[3]) {
+  const __m512d x = _mm512_set1_pd(px);
+  const __m512d y = _mm512_set1_pd(py);
+  const __m512d z = _mm512_set1_pd(pz);
+  __m512d ax = _mm512_setzero_pd();
+  __m512d ay = _mm512_setzero_pd();
+  __m512d az = _mm512_setzero_pd();
+  for (size_t b = 0; b < n; b += 8) {
+    __mmask8 m = n - b >= 8 ? 0xff : static_cast<__mmask8>((1u << (n - b)) - 1);
+    __m512d dx = _mm512_sub_pd(x, _mm512_maskz_loadu_pd(m, bx + b));
+    __m512d dy = _mm512_sub_pd(y, _mm512_maskz_loadu_pd(m, by + b));
+    __m512d dz = _mm512_sub_pd(z, _mm512_maskz_loadu_pd(m, bz + b));
+    __m256 fx = _mm512_maskz_cvtpd_ps(m, dx);
+    __m256 fy = _mm512_maskz_cvtpd_ps(m, dy);
+    __m256 fz = _mm512_maskz_cvtpd_ps(m, dz);
+    __m256 rsq = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(fx, fx), _mm256_mul_ps(fy, fy)),
+        _mm256_mul_ps(fz, fz));
+    __m512d inv = _mm512_maskz_cvtps_pd(m, rsqrt_newton_avx512(rsq));
+    // Masked off lanes convert to 0, and so get an infinite inv; the mask
+    // gives them a force of 0 all the same.
+    __m512d f = _mm512_maskz_mul_pd(m, _mm512_maskz_loadu_pd(m, gm + b),
+                                    _mm512_mul_pd(_mm512_mul_pd(inv, inv), inv));
+    ax = _mm512_sub_pd(ax, _mm512_mul_pd(f, dx));
+    ay = _mm512_sub_pd(ay, _mm512_mul_pd(f, dy));
+    az = _mm512_sub_pd(az, _mm512_mul_pd(f, dz));
+  }
+  double lanes[8];
+  _mm512_storeu_pd(lanes, ax);
+  a[0] = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+         ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+  _mm512_storeu_pd(lanes, ay);
+  a[1] = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+         ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+  _mm512_storeu_pd(lanes, az);
+  a[2] = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+         ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+#endif
+
+}  // namespace mixed_detail
+
+using AccelMixedKernel = void (*)(size_t,
+                                  const double*,
+                                  const double*,
+                                  const double*,
+                                  const double*,
+                                  double,
+                                  double,
+                                  double,
+                                  double*);
+
+// The build of accel_mixed() for level, which the CPU has to support.
+inline AccelMixedKernel accel_mixed_kernel(SimdLevel level) {
+#if defined(SSM_SIMD_DISPATCH)
+  switch (level) {
+    case SimdLevel::AVX512: return mixed_detail::accel_avx512;
+    case SimdLevel::AVX2: return mixed_detail::accel_avx2;
+    case SimdLevel::SSE2: break;
+  }
+#endif
+  return mixed_detail::accel_sse2;
+}
+
+// The build accel_mixed() calls. Starts as the best the CPU supports.
+inline AccelMixedKernel& accel_mixed_active() {
+  static AccelMixedKernel kernel = accel_mixed_kernel(detect_simd_level());
+  return kernel;
+}
+
+// Switch accel_mixed() to the build for level. Not safe while other threads
+// are calling it.
+inline void set_accel_mixed_level(SimdLevel level) {
+  accel_mixed_active() = accel_mixed_kernel(level);
+}
+
+// Acceleration at (px, py, pz) from n bodies at (bx, by, bz) with G * m of
+// gm, into a[3], with inv_r3_mixed() for the distance terms. One at a time
+// that's no faster than the double kernel: narrowing and a scalar rsqrt cost
+// about what a pipelined sqrt and divide do. The gain is in taking four or
+// eight bodies per float instruction, keeping the displacements and sums in
+// double registers throughout.
+//
+// Runs the SSE2, AVX2 or AVX-512 build picked by set_accel_mixed_level(). The
+// builds sum the bodies in different orders, so their results differ in the
+// last bits.
+inline void accel_mixed(size_t n,
+                        const double* bx,
+                        const double* by,
+                        const double* bz,
+                        const double* gm,
+                        double px,
+                        double py,
+                        double pz,
+                        double a[3]) {
+  accel_mixed_active()(n, bx, by, bz, gm, px, py, pz, a);
+}
+
+// The same in full double precision.
+inline double inv_r3(double dx, double dy, double dz) {
+  double rsq = dx * dx + dy * dy + dz * dz;
+  return 1 / (rsq * std::sqrt(rsq));
+}
+
+}  // namespace ssm
+
+#endif  // MIXED_PRECISION_H_
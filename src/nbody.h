@@ -0,0 +1,22 @@
+#ifndef NBODY_H_
+#define NBODY_H_
+
+#include "engine.h"
+
+namespace ssm {
+
+constexpr double NBODY_G = ENGINE_G;
+
+// Direct summation N-body integrator over flat arrays it doesn't own: mass[n],
+// and pos, vel and acc as n rows of x, y, z. Callers can lay the arrays out
+// however suits them (the Node addon hands them to JS as Float64Arrays) and
+// read or change them between steps without any copying.
+//
+// Each step uses the same scheme as planets2: the acceleration at the current
+// positions, then pos += v * dt + a * dt^2 / 2 and vel += a * dt. Each pair is
+// only visited once. See engine.h for the other configurations.
+using NBody = Engine<FlatLayout, PairForce, TaylorStep, Serial>;
+
+}  // namespace ssm
+
+#endif  // NBODY_H_
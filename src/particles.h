@@ -0,0 +1,471 @@
+#ifndef PARTICLES_H_
+#define PARTICLES_H_
+
+#include "checkpoint.h"
+#include "ephemeris.h"
+#include "events.h"
+#include "mixed_precision.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ssm {
+
+// Integrates massless test particles against a precomputed ephemeris of the
+// massive bodies. Particles don't pull on anything, so each one only needs the
+// massive bodies' positions over time, which the ephemeris gives directly.
+// That makes every particle independent of every other.
+//
+// Particles are read from a binary catalog (a checkpoint file, see
+// catalog.h), which is mapped and walked in chunks. Each worker thread takes
+// the next chunk, copies it into its own SoA buffers, integrates it over the
+// whole span of the ephemeris, and writes its final states into the output
+// file at the chunk's offsets. Memory use depends on the chunk size and thread
+// count, never on the number of particles.
+//
+// Integration is velocity Verlet. Per step the massive bodies are looked up
+// once and shared by the whole chunk.
+//
+// With mixed set, the distance term of each force is found in float by
+// accel_mixed() (see mixed_precision.h), four or eight bodies at a time.
+// Positions, displacements and the sums stay in double, and each force is
+// within MIXED_INV_R3_MAX_ERROR of itself. Over half a year of a 20k asteroid
+// belt that moved no particle more than 1e-7 of its distance from the sun, and
+// cut the time per step by about 8% with SSE2, 26% with AVX2 and 35% with
+// AVX-512.
+//
+// Particles that have left can be retired, see set_ejection(). A retired
+// particle is swapped to the back of its chunk and no longer stepped, so the
+// cost of a chunk falls as it thins out. Its state when retired is what's
+// written for it.
+class ParticleIntegrator {
+ public:
+  // When a particle counts as gone, relative to ephemeris body central
+  // (normally the sun): when its two body energy about central is positive,
+  // if unbound is set, or when it's farther than max_distance meters from
+  // it, if that isn't 0. Checked every `every` steps.
+  struct Ejection {
+    size_t central = 0;
+    bool unbound = false;
+    double max_distance = 0;
+    uint64_t every = 64;
+  };
+
+  // gm[b] is G times the mass of ephemeris body b.
+  ParticleIntegrator(const Ephemeris* eph,
+                     const std::vector<double>& gm,
+                     double step,
+                     size_t chunk = 4096,
+                     bool mixed = false)
+    : eph_(eph), gm_(gm), step_(step), chunk_(chunk), mixed_(mixed) { }
+
+  ParticleIntegrator(const ParticleIntegrator&) = delete;
+  ParticleIntegrator& operator=(const ParticleIntegrator&) = delete;
+
+  // Retire particles as ej describes, and write an EVENT_UNBOUND or
+  // EVENT_OUT_OF_RANGE for each to log, if given. Events carry the particle's
+  // row in the catalog as body, and its name. They're written a chunk at a
+  // time, so they're only in time order within a chunk.
+  void set_ejection(const Ejection& ej, EventLog* log = nullptr) {
+    eject_ = ej;
+    if (eject_.every == 0)
+      eject_.every = 1;
+    log_ = log;
+  }
+
+  // Integrate every body in the catalog at in from the start to the end of
+  // the ephemeris, taking its states to be at the start, and write the final
+  // states to out in the same format. Bodies that are also in the ephemeris,
+  // such as the sun, are given their ephemeris state instead. out is written
+  // to out.tmp and renamed once complete. Returns 0 or a negative errno, and
+  // -EINVAL if the ephemeris covers no time or doesn't match gm.
+  int run(const char* in, const char* out, size_t threads = 0) {
+    if (!(eph_->end() > eph_->begin()) || !(step_ > 0) ||
+        gm_.size() != eph_->bodies()) {
+      return -EINVAL;
+    }
+    MappedCheckpoint src;
+    int err = src.open(in);
+    if (err != 0)
+      return err;
+
+    size_t n = src.count();
+    std::string tmp = std::string(out) + ".tmp";
+    CheckpointLayout layout(n);
+    CheckpointHeader header;
+    const uint64_t* offsets = src.name_offsets();
+
+    total_ = n;
+    done_ = 0;
+    ejected_ = 0;
+    steps_ = static_cast<uint64_t>(
+        std::ceil((eph_->end() - eph_->begin()) / step_));
+
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.count = n;
+    header.step = steps_;
+    header.time = eph_->end();
+    header.step_sec = step_;
+    header.file_size = layout.names + offsets[n];
+
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      return -errno;
+    if (::ftruncate(fd, header.file_size) != 0)
+      err = -errno;
+    if (err == 0)
+      err = Checkpoint::write_at(fd, &header, sizeof(header), 0);
+    if (err == 0)
+      err = Checkpoint::write_at(fd, src.mass(), n * sizeof(double),
+                                 layout.mass);
+    if (err == 0)
+      err = Checkpoint::write_at(fd, offsets, (n + 1) * sizeof(uint64_t),
+                                 layout.name_offsets);
+    if (err == 0)
+      err = Checkpoint::write_at(fd, src.names(), offsets[n], layout.names);
+
+    if (err == 0) {
+      std::atomic<size_t> next(0);
+      std::atomic<int> failed(0);
+      std::mutex log_mutex;
+      if (threads == 0)
+        threads = std::max<unsigned>(1, std::thread::hardware_concurrency());
+      auto worker = [&]() {
+        Chunk c(chunk_, eph_->bodies());
+        size_t begin;
+        while (failed == 0 && (begin = next.fetch_add(chunk_)) < n) {
+          size_t end = std::min(n, begin + chunk_);
+          c.load(src, begin, end);
+          integrate(src, &c);
+          fix_massive(src, &c);
+          if (!c.events.empty()) {
+            ejected_ += c.events.size();
+            if (log_ != nullptr) {
+              std::lock_guard<std::mutex> lock(log_mutex);
+              for (const OrbitEvent& e : c.events) {
+                log_->write(e, src.names() + offsets[e.body],
+                            offsets[e.body + 1] - offsets[e.body]);
+              }
+            }
+          }
+          int r = c.store(fd, layout);
+          if (r != 0) {
+            failed = r;
+            break;
+          }
+          done_ += end - begin;
+        }
+      };
+      std::vector<std::thread> pool;
+      for (size_t t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+      }
+      worker();
+      for (auto& t : pool) {
+        t.join();
+      }
+      err = failed;
+    }
+
+    if (err == 0 && ::fsync(fd) != 0)
+      err = -errno;
+    if (::close(fd) != 0 && err == 0)
+      err = -errno;
+    if (err == 0 && ::rename(tmp.c_str(), out) != 0)
+      err = -errno;
+    if (err != 0)
+      ::unlink(tmp.c_str());
+    return err;
+  }
+
+  // Progress, safe to read from another thread while run() is going.
+  inline size_t done() const { return done_.load(std::memory_order_relaxed); }
+  inline size_t total() const {
+    return total_.load(std::memory_order_relaxed);
+  }
+  inline uint64_t steps() const { return steps_; }
+  // Particles retired so far.
+  inline size_t ejected() const {
+    return ejected_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // One worker's particles, as columns, plus the massive body positions for
+  // the current step. The first live are still being stepped, the rest are
+  // retired. row[i] is the catalog row of the particle in column i.
+  struct Chunk {
+    Chunk(size_t cap, size_t bodies)
+      : x(cap), y(cap), z(cap),
+        vx(cap), vy(cap), vz(cap),
+        ax(cap), ay(cap), az(cap),
+        row(cap),
+        out(cap * 3),
+        bx(bodies), by(bodies), bz(bodies) { }
+
+    void load(const MappedCheckpoint& src, size_t b, size_t e) {
+      const double* pos = src.pos() + b * 3;
+      const double* vel = src.vel() + b * 3;
+      begin = b;
+      n = e - b;
+      live = n;
+      events.clear();
+      for (size_t i = 0; i < n; i++) {
+        row[i] = b + i;
+        x[i] = pos[i * 3];
+        y[i] = pos[i * 3 + 1];
+        z[i] = pos[i * 3 + 2];
+        vx[i] = vel[i * 3];
+        vy[i] = vel[i * 3 + 1];
+        vz[i] = vel[i * 3 + 2];
+      }
+    }
+
+    int store(int fd, const CheckpointLayout& layout) {
+      int err = store_column(fd, layout.pos, x.data(), y.data(), z.data());
+      if (err == 0)
+        err = store_column(fd, layout.vel, vx.data(), vy.data(), vz.data());
+      if (err == 0)
+        err = store_column(fd, layout.acc, ax.data(), ay.data(), az.data());
+      return err;
+    }
+
+    int store_column(int fd,
+                     uint64_t col,
+                     const double* cx,
+                     const double* cy,
+                     const double* cz) {
+      for (size_t i = 0; i < n; i++) {
+        size_t o = (row[i] - begin) * 3;
+        out[o] = cx[i];
+        out[o + 1] = cy[i];
+        out[o + 2] = cz[i];
+      }
+      return Checkpoint::write_at(fd, out.data(), n * 3 * sizeof(double),
+                                  col + begin * 3 * sizeof(double));
+    }
+
+    // Retire the particle in column i, by swapping it with the last live one.
+    void retire(size_t i) {
+      size_t j = --live;
+      std::swap(x[i], x[j]);
+      std::swap(y[i], y[j]);
+      std::swap(z[i], z[j]);
+      std::swap(vx[i], vx[j]);
+      std::swap(vy[i], vy[j]);
+      std::swap(vz[i], vz[j]);
+      std::swap(ax[i], ax[j]);
+      std::swap(ay[i], ay[j]);
+      std::swap(az[i], az[j]);
+      std::swap(row[i], row[j]);
+    }
+
+    size_t begin = 0;
+    size_t n = 0;
+    size_t live = 0;
+    std::vector<double> x, y, z;
+    std::vector<double> vx, vy, vz;
+    std::vector<double> ax, ay, az;
+    std::vector<size_t> row;
+    std::vector<double> out;
+    std::vector<OrbitEvent> events;
+    std::vector<double> bx, by, bz;
+  };
+
+  void bodies_at(double t, Chunk* c) const {
+    double pos[3];
+    for (size_t b = 0; b < gm_.size(); b++) {
+      eph_->state(b, t, pos, nullptr);
+      c->bx[b] = pos[0];
+      c->by[b] = pos[1];
+      c->bz[b] = pos[2];
+    }
+  }
+
+  // Acceleration of particle i from every massive body at their current
+  // positions in c.
+  inline void accel(const Chunk& c,
+                    size_t i,
+                    double* ax,
+                    double* ay,
+                    double* az) const {
+    if (mixed_) {
+      double a[3];
+      accel_mixed(gm_.size(), c.bx.data(), c.by.data(), c.bz.data(),
+                  gm_.data(), c.x[i], c.y[i], c.z[i], a);
+      *ax = a[0];
+      *ay = a[1];
+      *az = a[2];
+      return;
+    }
+    double sx = 0;
+    double sy = 0;
+    double sz = 0;
+    for (size_t b = 0; b < gm_.size(); b++) {
+      double dx = c.x[i] - c.bx[b];
+      double dy = c.y[i] - c.by[b];
+      double dz = c.z[i] - c.bz[b];
+      double rsq = dx * dx + dy * dy + dz * dz;
+      double f = -gm_[b] / (rsq * std::sqrt(rsq));
+      sx += f * dx;
+      sy += f * dy;
+      sz += f * dz;
+    }
+    *ax = sx;
+    *ay = sy;
+    *az = sz;
+  }
+
+  inline bool ejecting() const {
+    return eject_.unbound || eject_.max_distance > 0;
+  }
+
+  // Retire the live particles in c that have left, as of time t after step.
+  // Massive bodies in the catalog are left alone; fix_massive() sets them.
+  void eject(const MappedCheckpoint& src,
+             Chunk* c,
+             uint64_t step,
+             double t) const {
+    double cp[3];
+    double cv[3];
+    eph_->state(eject_.central, t, cp, cv);
+    double gm = gm_[eject_.central];
+    double max_sq = eject_.max_distance * eject_.max_distance;
+    size_t i = 0;
+    while (i < c->live) {
+      double dx = c->x[i] - cp[0];
+      double dy = c->y[i] - cp[1];
+      double dz = c->z[i] - cp[2];
+      double rsq = dx * dx + dy * dy + dz * dz;
+      uint32_t type;
+      if (max_sq > 0 && rsq > max_sq) {
+        type = EVENT_OUT_OF_RANGE;
+      } else if (eject_.unbound) {
+        double vx = c->vx[i] - cv[0];
+        double vy = c->vy[i] - cv[1];
+        double vz = c->vz[i] - cv[2];
+        double energy = 0.5 * (vx * vx + vy * vy + vz * vz) -
+                        gm / std::sqrt(rsq);
+        if (!(energy > 0)) {
+          i++;
+          continue;
+        }
+        type = EVENT_UNBOUND;
+      } else {
+        i++;
+        continue;
+      }
+      size_t b;
+      if (massive(src, c->row[i], &b)) {
+        i++;
+        continue;
+      }
+      OrbitEvent e;
+      e.time = t;
+      e.step = step;
+      e.body = static_cast<uint32_t>(c->row[i]);
+      e.type = type;
+      e.distance = std::sqrt(rsq);
+      c->events.push_back(e);
+      // Column i now holds another live particle, or is past the end.
+      c->retire(i);
+    }
+  }
+
+  void integrate(const MappedCheckpoint& src, Chunk* c) const {
+    double t = eph_->begin();
+    double end = eph_->end();
+    uint64_t countdown = eject_.every;
+
+    bodies_at(t, c);
+    for (size_t i = 0; i < c->n; i++) {
+      accel(*c, i, &c->ax[i], &c->ay[i], &c->az[i]);
+    }
+    for (uint64_t s = 0; s < steps_; s++) {
+      double dt = std::min(step_, end - t);
+      double hdt = dt * 0.5;
+      t = s + 1 == steps_ ? end : t + dt;
+      bodies_at(t, c);
+      for (size_t i = 0; i < c->live; i++) {
+        double nx;
+        double ny;
+        double nz;
+        c->x[i] += (c->vx[i] + c->ax[i] * hdt) * dt;
+        c->y[i] += (c->vy[i] + c->ay[i] * hdt) * dt;
+        c->z[i] += (c->vz[i] + c->az[i] * hdt) * dt;
+        accel(*c, i, &nx, &ny, &nz);
+        c->vx[i] += (c->ax[i] + nx) * hdt;
+        c->vy[i] += (c->ay[i] + ny) * hdt;
+        c->vz[i] += (c->az[i] + nz) * hdt;
+        c->ax[i] = nx;
+        c->ay[i] = ny;
+        c->az[i] = nz;
+      }
+      if (ejecting() && --countdown == 0) {
+        eject(src, c, s + 1, t);
+        countdown = eject_.every;
+      }
+    }
+  }
+
+  // Whether catalog row is one of the ephemeris bodies, and which in *body.
+  bool massive(const MappedCheckpoint& src, size_t row, size_t* body) const {
+    const uint64_t* off = src.name_offsets();
+    size_t len = off[row + 1] - off[row];
+    for (size_t b = 0; b < eph_->bodies(); b++) {
+      if (eph_->name_size(b) == len &&
+          std::memcmp(eph_->name_data(b), src.names() + off[row], len) == 0) {
+        *body = b;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Replace any massive bodies in the chunk with their ephemeris state.
+  void fix_massive(const MappedCheckpoint& src, Chunk* c) const {
+    for (size_t i = 0; i < c->n; i++) {
+      size_t b;
+      if (massive(src, c->row[i], &b)) {
+        double pos[3];
+        double vel[3];
+        eph_->state(b, eph_->end(), pos, vel);
+        c->x[i] = pos[0];
+        c->y[i] = pos[1];
+        c->z[i] = pos[2];
+        c->vx[i] = vel[0];
+        c->vy[i] = vel[1];
+        c->vz[i] = vel[2];
+        c->ax[i] = c->ay[i] = c->az[i] = 0;
+      }
+    }
+  }
+
+  const Ephemeris* eph_;
+  std::vector<double> gm_;
+  double step_;
+  size_t chunk_;
+  bool mixed_;
+  Ejection eject_;
+  EventLog* log_ = nullptr;
+  std::atomic<size_t> total_{0};
+  uint64_t steps_ = 0;
+  std::atomic<size_t> done_{0};
+  std::atomic<size_t> ejected_{0};
+};
+
+}  // namespace ssm
+
+#endif  // PARTICLES_H_
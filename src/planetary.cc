@@ -0,0 +1,144 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++17 -pthread -fPIC -fvisibility=hidden -shared -o libplanetary.so planetary.cc
+//
+// libplanetary: the C API in planetary.h over ssm::NBody, with catalog.h and
+// checkpoint.h for loading and saving.
+
+#include "planetary.h"
+#include "catalog.h"
+#include "nbody.h"
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <new>
+
+struct planetary_sim {
+  ssm::Checkpoint cp;
+  // Over cp's arrays, so it's dropped whenever they may have moved and made
+  // again on the next step.
+  std::unique_ptr<ssm::NBody> nbody;
+};
+
+planetary_sim* planetary_create(void) {
+  return new (std::nothrow) planetary_sim();
+}
+
+void planetary_destroy(planetary_sim* sim) {
+  delete sim;
+}
+
+int planetary_load(planetary_sim* sim, const char* path, size_t* bad_line) {
+  if (sim == nullptr || path == nullptr)
+    return -EINVAL;
+  ssm::Checkpoint cp;
+  size_t line = 0;
+  int err;
+  try {
+    err = ssm::load_catalog(path, &cp, &line);
+  } catch (const std::bad_alloc&) {
+    err = -ENOMEM;
+  }
+  if (bad_line != nullptr)
+    *bad_line = line;
+  if (err != 0)
+    return err;
+  sim->nbody.reset();
+  sim->cp = std::move(cp);
+  return 0;
+}
+
+int planetary_add_body(planetary_sim* sim,
+                       const char* name,
+                       double mass,
+                       const double pos[3],
+                       const double vel[3]) {
+  if (sim == nullptr || name == nullptr || pos == nullptr || vel == nullptr)
+    return -EINVAL;
+  ssm::Checkpoint& cp = sim->cp;
+  size_t n = cp.count();
+  sim->nbody.reset();
+  try {
+    cp.resize(n + 1);
+    cp.names[n] = name;
+  } catch (const std::bad_alloc&) {
+    cp.resize(n);
+    return -ENOMEM;
+  }
+  cp.mass[n] = mass;
+  for (int k = 0; k < 3; k++) {
+    cp.pos[n * 3 + k] = pos[k];
+    cp.vel[n * 3 + k] = vel[k];
+    cp.acc[n * 3 + k] = 0;
+  }
+  return 0;
+}
+
+int planetary_step(planetary_sim* sim, uint64_t steps, double dt) {
+  if (sim == nullptr)
+    return -EINVAL;
+  ssm::Checkpoint& cp = sim->cp;
+  try {
+    if (!sim->nbody) {
+      sim->nbody.reset(new ssm::NBody(cp.count(), cp.mass.data(),
+                                      cp.pos.data(), cp.vel.data(),
+                                      cp.acc.data()));
+    }
+    sim->nbody->run(steps, dt);
+  } catch (const std::bad_alloc&) {
+    return -ENOMEM;
+  }
+  cp.step += steps;
+  cp.time += steps * dt;
+  cp.step_sec = dt;
+  return 0;
+}
+
+size_t planetary_count(const planetary_sim* sim) {
+  return sim != nullptr ? sim->cp.count() : 0;
+}
+
+uint64_t planetary_steps(const planetary_sim* sim) {
+  return sim != nullptr ? sim->cp.step : 0;
+}
+
+double planetary_time(const planetary_sim* sim) {
+  return sim != nullptr ? sim->cp.time : 0;
+}
+
+const char* planetary_name(const planetary_sim* sim, size_t i) {
+  if (sim == nullptr || i >= sim->cp.count())
+    return nullptr;
+  return sim->cp.names[i].c_str();
+}
+
+int planetary_snapshot(const planetary_sim* sim,
+                       double* mass,
+                       double* pos,
+                       double* vel) {
+  if (sim == nullptr)
+    return -EINVAL;
+  const ssm::Checkpoint& cp = sim->cp;
+  size_t n = cp.count();
+  if (mass != nullptr)
+    std::memcpy(mass, cp.mass.data(), n * sizeof(double));
+  if (pos != nullptr)
+    std::memcpy(pos, cp.pos.data(), n * 3 * sizeof(double));
+  if (vel != nullptr)
+    std::memcpy(vel, cp.vel.data(), n * 3 * sizeof(double));
+  return 0;
+}
+
+int planetary_save(const planetary_sim* sim, const char* path) {
+  if (sim == nullptr || path == nullptr)
+    return -EINVAL;
+  try {
+    return sim->cp.save(path);
+  } catch (const std::bad_alloc&) {
+    return -ENOMEM;
+  }
+}
+
+const char* planetary_strerror(int err) {
+  return std::strerror(err < 0 ? -err : err);
+}
@@ -0,0 +1,93 @@
+#ifndef PLANETARY_H_
+#define PLANETARY_H_
+
+/*
+ * C API of libplanetary, for embedding the N-body engine in other programs.
+ *
+ * Every simulation lives in its own planetary_sim and the library holds no
+ * global state, so any number can run in one process, each from its own
+ * thread. A single planetary_sim must not be used from two threads at once.
+ *
+ * Functions returning int give 0 on success or a negative errno, which
+ * planetary_strerror() describes.
+ *
+ *   planetary_sim* sim = planetary_create();
+ *   planetary_load(sim, "belt.bin", NULL);
+ *   planetary_step(sim, 86400, 1);
+ *   planetary_snapshot(sim, NULL, pos, vel);
+ *   planetary_destroy(sim);
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The library is built with -fvisibility=hidden; only these are exported. */
+#define PLANETARY_EXTERN __attribute__((visibility("default")))
+
+typedef struct planetary_sim planetary_sim;
+
+/* Create an empty simulation. Returns NULL if out of memory. */
+PLANETARY_EXTERN
+planetary_sim* planetary_create(void);
+
+PLANETARY_EXTERN
+void planetary_destroy(planetary_sim* sim);
+
+/*
+ * Replace the bodies with those in a catalog, text or binary (see catalog.h).
+ * A binary checkpoint also restores the step count and time. If the text form
+ * has a bad line, -EINVAL is returned and *bad_line (if not NULL) is set to its
+ * line number.
+ */
+PLANETARY_EXTERN
+int planetary_load(planetary_sim* sim, const char* path, size_t* bad_line);
+
+/* Append a body. pos and vel are x, y, z in m and m/s. */
+PLANETARY_EXTERN
+int planetary_add_body(planetary_sim* sim,
+                       const char* name,
+                       double mass,
+                       const double pos[3],
+                       const double vel[3]);
+
+/* Advance steps steps of dt seconds each. */
+PLANETARY_EXTERN
+int planetary_step(planetary_sim* sim, uint64_t steps, double dt);
+
+PLANETARY_EXTERN
+size_t planetary_count(const planetary_sim* sim);
+PLANETARY_EXTERN
+uint64_t planetary_steps(const planetary_sim* sim);
+PLANETARY_EXTERN
+double planetary_time(const planetary_sim* sim);
+
+/* Name of body i, or NULL if out of range. Valid until the bodies change. */
+PLANETARY_EXTERN
+const char* planetary_name(const planetary_sim* sim, size_t i);
+
+/*
+ * Copy the current state out: mass[count], pos[count][3] and vel[count][3].
+ * Any of them may be NULL to skip it.
+ */
+PLANETARY_EXTERN
+int planetary_snapshot(const planetary_sim* sim,
+                       double* mass,
+                       double* pos,
+                       double* vel);
+
+/* Write a binary checkpoint that planetary_load() can resume from. */
+PLANETARY_EXTERN
+int planetary_save(const planetary_sim* sim, const char* path);
+
+PLANETARY_EXTERN
+const char* planetary_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* PLANETARY_H_ */
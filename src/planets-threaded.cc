@@ -1,20 +1,17 @@
 #include "utils.h"
+#include "body_registry.h"
+#include "engine.h"
 #include "math_vector.h"
 
-#include <atomic>
 #include <algorithm>
 #include <cmath>
 #include <string>
-#include <thread>
 #include <vector>
 
 using ssm::Vector;
-using std::atomic;
 using std::string;
 using std::vector;
-using std::thread;
 
-struct SystemThread;
 class SystemBody;
 class System;
 
@@ -26,12 +23,13 @@ static void print_planet(SystemBody* p);
 static void print_system(System* s);
 
 
-// TODO everything
-struct SystemThread {
-  atomic<int> run_state;
-  SystemBody* body;
-  thread* t;
-};
+// Every body against every other, with the bodies split over a pool of
+// threads for each force sweep (see engine.h).
+using ThreadedEngine = ssm::Engine<ssm::AoSLayout,
+                                   ssm::AllForce,
+                                   ssm::TaylorStep,
+                                   ssm::ThreadPool>;
+using BodyState = ssm::AoSLayout::Body;
 
 
 class SystemBody {
@@ -52,10 +50,9 @@ class SystemBody {
              double E);  // eccentric anomaly
 
   // TODO(trevnorris): Add ability to center a body around another body.
-  // acceleration calculations should be done here instead of in System to
-  // make working with threads easier. Use system_ to retrieve the full list of
-  // bodies that this instance needs to calculate acceleration against.
 
+  // mass(), pos(), vel() and acc() are the body's row in its System's engine
+  // once it's been added, and its own copy before then.
   string& name();
   double mass();
   double radius();
@@ -65,25 +62,15 @@ class SystemBody {
   System* system();
   SystemBody* orbiting();
   void set_orbit(SystemBody* body);
-  void update_acceleration(vector<SystemBody*>& bodies);
-  void update_position_velocity(double t);
-
-  /* 0 - thread control
-   * 1 - thread hand off
-   * 2 - main control
-   * 3 - main hand off
-   */
-  atomic<int> run_state;
-  thread* t;
 
  private:
   friend class System;
 
+  BodyState& state();
   void add_orbiting_body(SystemBody* body);
   void remove_orbiting_body(SystemBody* body);
 
   string name_ = "[unknown]";
-  double mass_ = 0;
   double radius_ = 0;
   double a_ = 0;
   double e_ = 0;
@@ -93,31 +80,36 @@ class SystemBody {
   double E_ = 0;
   // Maximum ||r||^2 value where gravitational acceleration should be calc'd.
   //double r_concern_ = 0;
-  System* system_;
+  System* system_ = nullptr;
+  // Position in system_'s bodies(), and row in its engine.
+  size_t index_ = 0;
   SystemBody* orbiting_ = nullptr;
   vector<SystemBody*> orbited_ = {};
-  Vector pos_ = { 0, 0, 0 };
-  Vector vel_ = { 0, 0, 0 };
-  Vector acc_ = { 0, 0, 0 };
+  // State until the body is added to a System.
+  BodyState staged_;
 };
 
 
 class System {
  public:
   void add_body(SystemBody* body);
-  // TODO implement
-  //void remove_body(SystemBody* body);
+  // O(1): the last body takes body's place in bodies(). body keeps its last
+  // state. Returns -ENOENT if body isn't in this system.
+  int remove_body(SystemBody* body);
 
   // Thread-safe to read since there will be no additional writers.
   vector<SystemBody*>& bodies();
 
-  // Run system using step seconds, for dur steps, using threads.
+  // Run system using step seconds, for dur steps, using every core. Returns
+  // the time taken in ns.
   uint64_t run(double step, size_t dur);
-  uint64_t run_threaded(double step, size_t dur);
 
  private:
+  friend class SystemBody;
+
+  // Row i is the state of bodies_[i].
+  ThreadedEngine engine_;
   vector<SystemBody*> bodies_ = {};
-  vector<thread*> threads_ = {};
 };
 
 
@@ -135,7 +127,6 @@ SystemBody::SystemBody(string name,
            double Om, // longitude of ascending node
            double E)  // eccentric anomaly
     : name_(name),
-      mass_(mass),
       radius_(radius),
       a_(a),
       e_(e),
@@ -143,14 +134,19 @@ SystemBody::SystemBody(string name,
       w_(w),
       Om_(Om),
       E_(E) {
+  staged_.mass = mass;
+}
+
+BodyState& SystemBody::state() {
+  return system_ != nullptr ? system_->engine_.body(index_) : staged_;
 }
 
 string& SystemBody::name() { return name_; }
-double SystemBody::mass() { return mass_; }
+double SystemBody::mass() { return state().mass; }
 double SystemBody::radius() { return radius_; }
-Vector& SystemBody::pos() { return pos_; }
-Vector& SystemBody::vel() { return vel_; }
-Vector& SystemBody::acc() { return acc_; }
+Vector& SystemBody::pos() { return state().pos; }
+Vector& SystemBody::vel() { return state().vel; }
+Vector& SystemBody::acc() { return state().acc; }
 
 System* SystemBody::system() {
   return system_;
@@ -171,8 +167,8 @@ void SystemBody::set_orbit(SystemBody* body) {
   }
   orbiting_ = body;
   orbiting_->add_orbiting_body(this);
-  kep2cart(orbiting_->mass(), a_, e_, i_, w_, Om_, E_, pos_, vel_);
-  pos_ += orbiting_->pos();
+  kep2cart(orbiting_->mass(), a_, e_, i_, w_, Om_, E_, pos(), vel());
+  pos() += orbiting_->pos();
   for (auto& b : orbited_) {
     // Some unnecessary operations will happen here, but this code is executed
     // very little. So not going to worry about it.
@@ -193,29 +189,25 @@ void SystemBody::remove_orbiting_body(SystemBody* body) {
   }
 }
 
-void SystemBody::update_acceleration(vector<SystemBody*>& bodies) {
-  acc_.zero();
-  for (SystemBody* body : bodies) {
-    Vector& p = body->pos();
-    double rsq = pos_.mag_sq(&p);
-    if (&pos_ == &p)
-      continue;
-    //if (rsq < r_concern_)
-      //continue;
-    acc_ += -G * body->mass() / (rsq * sqrt(rsq)) * (pos_ - p);
-  }
-}
-
-void SystemBody::update_position_velocity(double t) {
-  pos_ += vel_ * t + acc_ * t * t * 0.5;
-  vel_ += acc_ * t;
-}
-
 
 void System::add_body(SystemBody* body) {
-  bodies_.push_back(body);
   // TODO(trevnorris): if system_ != nullptr then remove from the other sysstem
+  engine_.bodies().push_back(body->state());
+  bodies_.push_back(body);
   body->system_ = this;
+  body->index_ = bodies_.size() - 1;
+}
+
+int System::remove_body(SystemBody* body) {
+  if (body->system_ != this)
+    return -ENOENT;
+  size_t i = body->index_;
+  body->staged_ = engine_.remove(i);
+  body->system_ = nullptr;
+  ssm::swap_remove(&bodies_, i);
+  if (i < bodies_.size())
+    bodies_[i]->index_ = i;
+  return 0;
 }
 
 vector<SystemBody*>& System::bodies() {
@@ -223,81 +215,13 @@ vector<SystemBody*>& System::bodies() {
 }
 
 
-uint64_t System::run(double step, size_t iter) {
+uint64_t System::run(double step, size_t dur) {
   auto t = hrtime();
-  for (size_t i = 0; i < iter; i++) {
-    for (auto& sb : bodies_) {
-      sb->update_acceleration(bodies_);
-    }
-    for (auto& sb : bodies_) {
-      sb->update_position_velocity(step);
-    }
-  }
+  engine_.run(dur, step);
   return hrtime() - t;
 }
 
 
-// TODO(trevnorris): Being lazy. fix this.
-std::atomic<size_t> run_dur;
-
-static void run_body(SystemThread* st) {
-  //auto& bodies(body->system()->bodies());
-  //auto* body = st->body;
-  st->run_state = 1;
-  for (size_t i = run_dur.load(); i > 0; i--) {
-    while (st->run_state != 3);
-    st->run_state = 0;
-    //body->update_acceleration(bodies);
-    st->run_state = 1;
-  }
-}
-
-// TODO(trevnorris): This is slow, so very very slow.
-uint64_t System::run_threaded(double step, size_t dur) {
-  vector<SystemThread*> st;
-  run_dur = dur;
-
-  for (auto& body : bodies_) {
-    auto* s = new SystemThread();
-    s->run_state = 0;
-    s->body = body;
-    s->t = new thread(run_body, s);
-    st.push_back(s);
-  }
-
-  for (auto& s : st) {
-    while (s->run_state != 1);
-  }
-  for (auto& s : st) {
-    s->run_state = 3;
-  }
-
-  auto t = hrtime();
-  for(; dur > 0; dur--) {
-    for (auto& s : st) {
-      while (s->run_state != 1);
-      s->run_state = 2;
-    }
-    //for (auto& body : bodies_) {
-      //body->update_position_velocity(step);
-    //}
-    for (auto& s : st) {
-      s->run_state = 3;
-    }
-  }
-  t = hrtime() - t;
-
-  for (auto& s : st) {
-    s->t->join();
-    delete s->t;
-    delete s;
-  }
-  st.clear();
-
-  return t;
-}
-
-
 int main() {
   System ssm;
   SystemBody sun("sun", 1.9885e30, 696342000, 0, 0, 0, 0, 0, 0);
@@ -340,8 +264,7 @@ int main() {
   constexpr size_t iter = 1000000;//86400*365.2422;//315569260;  // 100 years
   constexpr double step = 1;
 
-  //auto t = ssm.run(step, iter);
-  auto t = ssm.run_threaded(step, iter);
+  auto t = ssm.run(step, iter);
 
   printf("\n");
   print_system(&ssm);
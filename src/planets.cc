@@ -1,96 +1,103 @@
+#include "utils.h"
 #include "deps/inih.h"
 #include "deps/cxxopts.h"
+#include "catalog.h"
+#include "engine.h"
+#include "snapshot.h"
+#include "trajectory_writer.h"
 
 #include <uv.h>
 
 #include <signal.h>
 
+#include <atomic>
 #include <chrono>
 #include <cmath>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <sstream>
 
-using std::pow;
-using std::sqrt;
+using ssm::BodyState;
+using ssm::Snapshot;
+using ssm::SnapshotBuffer;
+using ssm::TrajectoryWriter;
 using std::stod;
 using std::string;
 using std::stringstream;
 using std::vector;
 
-#define G 6.67408e-11
-#define AU 149597870000
+// Each pair visited once, over a struct per body, with the Taylor step (see
+// engine.h).
+using SystemEngine =
+    ssm::Engine<ssm::AoSLayout, ssm::PairForce, ssm::TaylorStep, ssm::Serial>;
+using Body = ssm::AoSLayout::Body;
 
 struct SolarSystem;
-struct Planet;
-static void printSystem(SolarSystem* ssm, Planet*);
-static void printPlanet(Planet* p, Planet* sun);
-static inline void add_position_velocity(Planet* p1, double t);
-static inline void add_acceleration(Planet* p1, Planet* p2);
-
-static uint64_t hrtime() {
-  return std::chrono::duration_cast<std::chrono::nanoseconds>(
-      std::chrono::steady_clock::now().time_since_epoch()).count();
-}
-
-struct Coord {
-  double x;
-  double y;
-  double z;
-};
-
+static void printSystem(SolarSystem* ssm, size_t sun);
+static void printSnapshot(SolarSystem* ssm, size_t sun, const Snapshot& snap);
+static void printBodies(SolarSystem* ssm, const Body* bodies, size_t sun);
+static void printPlanet(SolarSystem* ssm,
+                        const Body* bodies,
+                        size_t i,
+                        size_t sun);
 
-struct Planet {
-  Planet(string n, double m)
-    : name(n), mass(m), pos(), vel(), acc() { }
-  Planet(string n, double m, Coord p, Coord v, Coord a)
-    : name(n), mass(m), pos(p), vel(v), acc(a) { }
-  Planet(string n,
-         double m,
-         vector<double> p,
-         vector<double> v,
-         vector<double> a)
-    : name(n), mass(m) {
-    pos = { p[0], p[1], p[2] };
-    vel = { v[0], v[1], v[2] };
-    acc = { a[0], a[1], a[2] };
-  }
-  string name;
-  double mass;
-  Coord pos;
-  Coord vel;
-  Coord acc;
-};
+// Index of no body, for a name that isn't in the system.
+static const size_t NO_BODY = SIZE_MAX;
 
 
 struct SolarSystem {
-  SolarSystem() { }
-  SolarSystem(vector<Planet*> p) : planets(p) { }
-  vector<Planet*> planets;
+  // Room for n bodies, filled in through names and engine.body().
+  void resize(size_t n) {
+    names.resize(n);
+    engine.resize(n);
+  }
+  void add(const string& name, const Body& body) {
+    names.push_back(name);
+    engine.bodies().push_back(body);
+  }
+  // Called once every body is in.
+  void index_names() {
+    by_name.reserve(names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+      // The first body by a name wins, as it did with a scan.
+      by_name.emplace(names[i], i);
+    }
+  }
+  // Names are kept out of the engine's table, so a step only reads the mass,
+  // position, velocity and acceleration of each body.
+  vector<string> names;
+  SystemEngine engine;
+  std::unordered_map<string, size_t> by_name;
   // TODO: Implement collision detection. To do this will need the radius of
   // each planet, then need to used the distance between them.
-  void step(uint64_t t) {
-    for (auto& b1 : planets) {
-      b1->acc = { 0, 0, 0 };
-    }
-    for (size_t i = 0; i < planets.size(); i++) {
-      auto b1 = planets[i];
-      for (size_t j = i + 1; j < planets.size(); j++) {
-        auto b2 = planets[j];
-        add_acceleration(b1, b2);
-      }
-    }
-    for (auto& b1 : planets) {
-      add_position_velocity(b1, t);
-    }
+  void step(double t) { engine.step(t); }
+  size_t count() const { return names.size(); }
+  size_t find(const string& name) const {
+    auto it = by_name.find(name);
+    return it == by_name.end() ? NO_BODY : it->second;
   }
-  Planet* get_planet(string name) {
-    for (auto planet : planets) {
-      if (planet->name == name) {
-        return planet;
-      }
+  // Copy the current state of every body into out. Only called from the
+  // thread running step(), so the bodies are never read concurrently.
+  void save_state(BodyState* out) {
+    for (size_t i = 0; i < count(); i++) {
+      const Body& b = engine.body(i);
+      out[i] = { { b.pos[0], b.pos[1], b.pos[2] },
+                 { b.vel[0], b.vel[1], b.vel[2] } };
     }
-    return nullptr;
+  }
+  void publish(SnapshotBuffer* buf, uint64_t iter, double time) {
+    save_state(buf->begin(count()));
+    buf->commit(iter, time);
+  }
+  // Queue a trajectory sample. Dropped if the writer is backed up.
+  void sample(TrajectoryWriter* tw, uint64_t iter, double time) {
+    BodyState* out = tw->begin();
+    if (out == nullptr)
+      return;
+    save_state(out);
+    tw->commit(iter, time);
   }
 };
 
@@ -100,7 +107,7 @@ cxxopts::Options* retrieve_options() {
       "Planetary Motion", "Calculate the planetary motion for a solar system");
   options->add_options()
     ("p,planets",
-     "path to planets.ini",
+     "path to planets.ini, or a text or binary body catalog (see catalog.h)",
      cxxopts::value<string>()->default_value("planets.ini"))
     ("h,help", "print help")
     ("s,step",
@@ -111,7 +118,30 @@ cxxopts::Options* retrieve_options() {
      cxxopts::value<uint64_t>()->default_value("10"))
     ("y,years",
      "how many earth years the test should proceed",
-     cxxopts::value<uint64_t>()->default_value("0"));
+     cxxopts::value<uint64_t>()->default_value("0"))
+    ("snapshot",
+     "publish a snapshot of the system every this many iterations",
+     cxxopts::value<size_t>()->default_value("10000"))
+    ("report",
+     "print the latest snapshot every this many seconds (0 to disable)",
+     cxxopts::value<uint64_t>()->default_value("0"))
+    ("t,trajectory",
+     "write sampled positions and velocities to this file",
+     cxxopts::value<string>()->default_value(""))
+    ("trajectory-every",
+     "iterations between trajectory samples",
+     cxxopts::value<size_t>()->default_value("1000"))
+    ("trajectory-format",
+     "csv, or columnar for the indexed binary format",
+     cxxopts::value<string>()->default_value("csv"))
+    ("trajectory-chunk",
+     "samples per chunk in the columnar format",
+     cxxopts::value<size_t>()->default_value("1024"))
+    ("trajectory-compress",
+     "losslessly compress columnar trajectory chunks")
+    ("trajectory-depth",
+     "samples that may be queued before new ones are dropped",
+     cxxopts::value<size_t>()->default_value("64"));
   return options;
 }
 
@@ -127,57 +157,130 @@ static vector<double> parse_coord(string vals) {
 }
 
 
-static Planet* gen_planet(INIReader* reader, const char* name) {
-  double mass = reader->GetReal(name, "mass", 0);
+static void gen_planet(INIReader* reader,
+                       const char* name,
+                       SolarSystem* ssm) {
+  Body b;
   vector<double> pos = parse_coord(reader->Get(name, "position", "0,0,0"));
   vector<double> vel = parse_coord(reader->Get(name, "velocity", "0,0,0"));
   vector<double> acc = parse_coord(reader->Get(name, "acceleration", "0,0,0"));
-  return new Planet(name, mass, pos, vel, acc);
+  b.mass = reader->GetReal(name, "mass", 0);
+  b.pos.set(pos[0], pos[1], pos[2]);
+  b.vel.set(vel[0], vel[1], vel[2]);
+  b.acc.set(acc[0], acc[1], acc[2]);
+  ssm->add(name, b);
 }
 
 
 static SolarSystem* generate_solar_system(const char* ini_realpath) {
   INIReader reader(ini_realpath);
-  vector<Planet*> planets;
 
   if (reader.ParseError() != 0) {
     fprintf(stderr, "can't load '%s'\n", ini_realpath);
     return nullptr;
   }
 
+  SolarSystem* ssm = new SolarSystem();
   for (auto elem : reader.Sections()) {
-    planets.push_back(gen_planet(&reader, elem.c_str()));
+    gen_planet(&reader, elem.c_str(), ssm);
+  }
+  ssm->index_names();
+  return ssm;
+}
+
+
+// Large catalogs skip INIReader entirely. Every line is parsed straight into
+// its row of the engine's table, in parallel, with nothing held per body in
+// between.
+static SolarSystem* load_solar_system(const char* realpath) {
+  SolarSystem* ssm = new SolarSystem();
+  size_t line = 0;
+  uint64_t t = hrtime();
+
+  int err = ssm::load_bodies(
+      realpath,
+      [ssm](size_t n) { ssm->resize(n); },
+      [ssm](size_t i,
+                 const char* name,
+                 size_t len,
+                 double mass,
+                 const double* p,
+                 const double* v,
+                 const double* a) {
+        Body& b = ssm->engine.body(i);
+        ssm->names[i].assign(name, len);
+        b.mass = mass;
+        b.pos.set(p[0], p[1], p[2]);
+        b.vel.set(v[0], v[1], v[2]);
+        b.acc.set(a[0], a[1], a[2]);
+      },
+      &line);
+  if (err == -EINVAL && line > 0) {
+    fprintf(stderr, "can't load '%s': bad body on line %lu\n", realpath, line);
+    delete ssm;
+    return nullptr;
+  } else if (err != 0) {
+    fprintf(stderr, "can't load '%s': %s\n", realpath, strerror(-err));
+    delete ssm;
+    return nullptr;
   }
 
-  return new SolarSystem(planets);
+  printf("loaded %lu bodies in %.2f ms\n\n",
+         ssm->count(), (hrtime() - t) / 1e6);
+  ssm->index_names();
+  return ssm;
 }
 
 
-// TODO: Fix this horrible ugliness...
-uint64_t t;
-size_t STEP_SEC;
-size_t iter;
-SolarSystem* ssm = nullptr;
-Planet* sun = nullptr;
+static bool is_ini(const char* path) {
+  size_t len = strlen(path);
+  return len >= 4 && strcmp(path + len - 4, ".ini") == 0;
+}
 
-void s_handler(int s) {
-  printf("%c[2K\r", 27);
-  t = hrtime() - t;
-  printSystem(ssm, sun);
-  printf("step: %lu    iter: %lu   %.2f ns/iter   %.2f minutes\n",
-         STEP_SEC,
-         iter,
-         1.0 * t / iter,
-         1.0 * t / 1e9 / 60);
-  printf("%.2f years computed\n",
-         1.0 * iter * STEP_SEC / 60 / 60 / 24 / 365.256);
-  exit(0);
+
+// The handler only raises a flag. The main loop notices it, stops stepping
+// and prints the final state itself, so the bodies are never read
+// while they're being mutated.
+static volatile sig_atomic_t interrupted = 0;
+static std::atomic<bool> done(false);
+
+void s_handler(int) {
+  interrupted = 1;
+}
+
+
+// Reader thread that periodically prints the latest published snapshot. Never
+// touches the live bodies.
+static void report_thread(SolarSystem* ssm,
+                          size_t sun,
+                          SnapshotBuffer* snapshots,
+                          uint64_t report_sec) {
+  Snapshot snap;
+  uint64_t last_epoch = 0;
+  uint64_t next = hrtime() + report_sec * 1e9;
+  while (!done.load(std::memory_order_relaxed)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    if (hrtime() < next)
+      continue;
+    next += report_sec * 1e9;
+    if (!snapshots->read(&snap) || snap.epoch == last_epoch)
+      continue;
+    last_epoch = snap.epoch;
+    printSnapshot(ssm, sun, snap);
+    printf("\n");
+    fflush(stdout);
+  }
 }
 
 
 int main(int argc, char* argv[]) {
   struct sigaction sigIntHandler;
   uv_fs_t ini_path_fs;
+  SolarSystem* ssm = nullptr;
+  size_t sun = NO_BODY;
+  uint64_t t;
+  size_t STEP_SEC;
+  size_t iter;
   int err;
 
   sigIntHandler.sa_handler = s_handler;
@@ -205,44 +308,114 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
-  ssm = generate_solar_system(static_cast<char*>(ini_path_fs.ptr));
+  if (is_ini(static_cast<char*>(ini_path_fs.ptr)))
+    ssm = generate_solar_system(static_cast<char*>(ini_path_fs.ptr));
+  else
+    ssm = load_solar_system(static_cast<char*>(ini_path_fs.ptr));
   uv_fs_req_cleanup(&ini_path_fs);
 
   if (ssm == nullptr) {
     return 1;
   }
 
-  sun = ssm->get_planet("sun");
-  //sun = ssm->get_planet("jupiter");
-  //printSystem(ssm, ssm->get_planet("sun"));
+  sun = ssm->find("sun");
+  //sun = ssm->find("jupiter");
+  //printSystem(ssm, ssm->find("sun"));
 
   //size_t STEP_SEC = 1;
   //uint64_t DUR = 1e9 * 10;   // 1e9 is 1 sec
   uint64_t DUR = 1e9 * result["duration"].as<uint64_t>();   // 1e9 is 1 sec
   uint64_t YEARS = result["years"].as<uint64_t>();
+  uint64_t REPORT_SEC = result["report"].as<uint64_t>();
+  size_t SNAP_ITER = result["snapshot"].as<size_t>();
+  string TRAJ_PATH = result["trajectory"].as<string>();
+  size_t TRAJ_ITER = result["trajectory-every"].as<size_t>();
   STEP_SEC = result["step"].as<size_t>();
   iter = 0;
 
+  SnapshotBuffer snapshots(ssm->count());
+  std::thread* reporter = nullptr;
+  TrajectoryWriter* trajectory = nullptr;
+  size_t snap_countdown = SNAP_ITER;
+  size_t traj_countdown = TRAJ_ITER;
+
+  if (!TRAJ_PATH.empty() && TRAJ_ITER > 0) {
+    string format = result["trajectory-format"].as<string>();
+    ssm::TrajectoryEncoder* encoder;
+    const vector<string>& names = ssm->names;
+    if (format == "csv") {
+      encoder = new ssm::CsvEncoder(names);
+    } else if (format == "columnar") {
+      encoder = new ssm::ColumnarEncoder(
+          names,
+          result["trajectory-chunk"].as<size_t>(),
+          result.count("trajectory-compress") ?
+              ssm::TRAJ_CODEC_DELTA : ssm::TRAJ_CODEC_RAW);
+    } else {
+      fprintf(stderr, "unknown trajectory format '%s'\n", format.c_str());
+      return 1;
+    }
+    trajectory = new TrajectoryWriter(
+        names.size(), encoder, result["trajectory-depth"].as<size_t>());
+    err = trajectory->start(TRAJ_PATH.c_str());
+    if (err) {
+      fprintf(stderr, "can't open trajectory file '%s': %s\n",
+              TRAJ_PATH.c_str(), uv_err_name(err));
+      return 1;
+    }
+  }
+
+  // Advance a single iteration and publish a snapshot or trajectory sample
+  // when either is due.
+  auto advance = [&]() {
+    iter++;
+    ssm->step(STEP_SEC);
+    if (SNAP_ITER > 0 && --snap_countdown == 0) {
+      ssm->publish(&snapshots, iter, 1.0 * iter * STEP_SEC);
+      snap_countdown = SNAP_ITER;
+    }
+    if (trajectory != nullptr && --traj_countdown == 0) {
+      ssm->sample(trajectory, iter, 1.0 * iter * STEP_SEC);
+      traj_countdown = TRAJ_ITER;
+    }
+  };
+
   printSystem(ssm, sun);
   printf("\n");
 
+  ssm->publish(&snapshots, iter, 0);
+  if (trajectory != nullptr)
+    ssm->sample(trajectory, iter, 0);
+  if (REPORT_SEC > 0) {
+    reporter = new std::thread(report_thread, ssm, sun, &snapshots, REPORT_SEC);
+  }
+
   t = hrtime();
 
   if (YEARS > 0) {
     for (size_t i = 0; i < YEARS * 86400 * 365.256; i += STEP_SEC) {
-      iter++;
-      ssm->step(STEP_SEC);
+      if (interrupted)
+        break;
+      advance();
     }
   } else {
     do {
       for (size_t i = 0; i < 100000; i++) {
-        iter++;
-        ssm->step(STEP_SEC);
+        advance();
       }
-    } while (hrtime() - t < DUR);
+    } while (hrtime() - t < DUR && !interrupted);
   }
 
   t = hrtime() - t;
+  ssm->publish(&snapshots, iter, 1.0 * iter * STEP_SEC);
+  done = true;
+  if (reporter != nullptr) {
+    reporter->join();
+    delete reporter;
+  }
+
+  if (interrupted)
+    printf("%c[2K\r", 27);
   printSystem(ssm, sun);
   printf("step: %lu    iter: %lu   %.2f ns/iter   %.2f minutes\n",
          STEP_SEC,
@@ -252,89 +425,76 @@ int main(int argc, char* argv[]) {
   printf("%.2f years computed\n",
          1.0 * iter * STEP_SEC / 86400 / 365.256);
 
-  delete options;
-  for (auto p : ssm->planets) {
-    delete p;
+  if (trajectory != nullptr) {
+    err = trajectory->stop();
+    if (err) {
+      fprintf(stderr, "trajectory write error: %s\n", uv_err_name(err));
+    }
+    printf("trajectory: %lu samples   %lu dropped   %.2f MB\n",
+           trajectory->written(),
+           trajectory->dropped(),
+           trajectory->bytes() / 1e6);
+    delete trajectory;
   }
-  ssm->planets.clear();
+
+  delete options;
   delete ssm;
   return 0;
 }
 
 
-static inline void add_position_velocity(Planet* p1, double t) {
-  double tsq = t * t * 0.5;
-  p1->pos.x += p1->vel.x * t + p1->acc.x * tsq;
-  p1->pos.y += p1->vel.y * t + p1->acc.y * tsq;
-  p1->pos.z += p1->vel.z * t + p1->acc.z * tsq;
-  p1->vel.x += p1->acc.x * t;
-  p1->vel.y += p1->acc.y * t;
-  p1->vel.z += p1->acc.z * t;
+static void printSystem(SolarSystem* ssm, size_t sun) {
+  printBodies(ssm, ssm->engine.bodies().data(), sun);
 }
 
 
-static inline void add_acceleration(Planet* p1, Planet* p2) {
-  double dx = p1->pos.x - p2->pos.x;
-  double dy = p1->pos.y - p2->pos.y;
-  double dz = p1->pos.z - p2->pos.z;
-  double rsq = dx * dx + dy * dy + dz * dz;
-  double r = 0;
-  double Fg;
-
-  Fg = -G * p2->mass / rsq;
-  if (Fg < -1e-8) {
-    r = 1 / sqrt(rsq);
-    p1->acc.x += Fg * dx * r;
-    p1->acc.y += Fg * dy * r;
-    p1->acc.z += Fg * dz * r;
-  }
-
-  Fg = -G * p1->mass / rsq;
-  if (Fg < -1e-8) {
-    if (r == 0)
-      r = 1 / sqrt(rsq);
-    p2->acc.x += Fg * (p2->pos.x - p1->pos.x) * r;
-    p2->acc.y += Fg * (p2->pos.y - p1->pos.y) * r;
-    p2->acc.z += Fg * (p2->pos.z - p1->pos.z) * r;
+// Print from a snapshot instead of the live system. Names never change after
+// startup so they're still read from ssm.
+static void printSnapshot(SolarSystem* ssm, size_t sun, const Snapshot& snap) {
+  vector<Body> bodies(snap.bodies.size());
+  printf("epoch: %lu   iter: %lu   %.2f years\n",
+         snap.epoch,
+         snap.step,
+         snap.time / 86400 / 365.256);
+  for (size_t i = 0; i < snap.bodies.size(); i++) {
+    const BodyState& b = snap.bodies[i];
+    bodies[i].pos.set(b.pos[0], b.pos[1], b.pos[2]);
+    bodies[i].vel.set(b.vel[0], b.vel[1], b.vel[2]);
   }
+  printBodies(ssm, bodies.data(), sun);
 }
 
 
-static void printSystem(SolarSystem* ssm, Planet* sun) {
-  printPlanet(sun, sun);
-  for (auto p : ssm->planets) {
-    if (sun != nullptr && p->name == sun->name) continue;
-    printPlanet(p, sun);
+// The sun first, then every other body relative to it.
+static void printBodies(SolarSystem* ssm, const Body* bodies, size_t sun) {
+  if (sun != NO_BODY)
+    printPlanet(ssm, bodies, sun, sun);
+  for (size_t i = 0; i < ssm->count(); i++) {
+    if (i == sun) continue;
+    printPlanet(ssm, bodies, i, sun);
   }
 }
 
 
-static double len(Coord& c1) {
-  return sqrt(c1.x * c1.x + c1.y * c1.y + c1.z * c1.z);
-}
-
-
-static inline double mag(Coord* c1, Coord* c2) {
-  return sqrt(pow(c1->x - c2->x, 2) + pow(c1->y - c2->y, 2) +
-      pow(c1->z - c2->z, 2));
-}
-
-
-static void printPlanet(Planet* p, Planet* sun) {
-  if (p == nullptr) return;
-  printf("[%s]\n", p->name.c_str());
+static void printPlanet(SolarSystem* ssm,
+                        const Body* bodies,
+                        size_t i,
+                        size_t sun) {
+  const Body& p = bodies[i];
+  printf("[%s]\n", ssm->names[i].c_str());
   printf("  [position]  x: %-14.3fy: %-14.3fz: %.3f\n",
-         p->pos.x / AU,
-         p->pos.y / AU,
-         p->pos.z / AU);
+         p.pos.x() / AU,
+         p.pos.y() / AU,
+         p.pos.z() / AU);
   //printf("  [velocity]  x: %-14gy: %-14gz: %g\n",
-         //p->vel.x,
-         //p->vel.y,
-         //p->vel.z);
-  if (sun == nullptr) return;
+         //p.vel.x(),
+         //p.vel.y(),
+         //p.vel.z());
+  if (sun == NO_BODY) return;
+  const Body& s = bodies[sun];
   printf("  to %s: %-12.4f wobble: %-12.4f vel: %.1f\n",
-         sun->name.c_str(),
-         mag(&p->pos, &sun->pos) / AU,
-         (len(p->pos) / AU) - (mag(&p->pos, &sun->pos) / AU),
-         len(p->vel));
+         ssm->names[sun].c_str(),
+         p.pos.mag(s.pos) / AU,
+         (p.pos.len() / AU) - (p.pos.mag(s.pos) / AU),
+         p.vel.len());
 }
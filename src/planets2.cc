@@ -1,8 +1,22 @@
 #include "utils.h"
+#include "alloc_counter.h"
+#include "body_registry.h"
 #include "math_vector.h"
+#include "checkpoint.h"
+#include "engine.h"
+#include "ephemeris.h"
+#include "events.h"
+#include "kepler.h"
+#include "mixed_precision.h"
+#include "particles.h"
+#include "static_system.h"
+#include "deps/cxxopts.h"
+
+#include <signal.h>
 
 #include <atomic>
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <string>
 #include <thread>
@@ -10,6 +24,17 @@
 
 #include <sstream>
 
+using ssm::BodyId;
+using ssm::BodyRegistry;
+using ssm::BodyState;
+using ssm::Checkpoint;
+using ssm::Ephemeris;
+using ssm::EphemerisBuilder;
+using ssm::EventDetector;
+using ssm::EventLog;
+using ssm::MappedCheckpoint;
+using ssm::ParticleIntegrator;
+using ssm::StaticSystem;
 using ssm::Vector;
 using std::atomic;
 using std::pow;
@@ -20,16 +45,34 @@ using std::stringstream;
 using std::thread;
 using std::vector;
 
-class ProcessingThread;
 class SystemBody;
 class System;
 
-static double d2r(double d);
 static void kep2cart(double M, double a, double e, double i, double w,
                      double Om, double E, Vector& pos, Vector& acc);
 static void print_body(SystemBody* p);
 static void print_system(System* s);
 
+// Number of bodies main() adds, for --static.
+constexpr size_t BODIES = 14;
+using FixedSystem = StaticSystem<BODIES>;
+
+// Set from SIGINT/SIGTERM. The main loop writes a final checkpoint and exits.
+static volatile sig_atomic_t interrupted = 0;
+
+
+// Every body against every other, over a struct per body, with the Taylor
+// step (see engine.h).
+using SystemEngine =
+    ssm::Engine<ssm::AoSLayout, ssm::AllForce, ssm::TaylorStep, ssm::Serial>;
+
+// What a step reads and writes of a body, packed so a force sweep over every
+// body touches only these 80 bytes of each. System's engine keeps them in one
+// table; everything else about a body stays in SystemBody.
+using HotBody = ssm::AoSLayout::Body;
+
+static_assert(sizeof(HotBody) == 80, "HotBody should stay packed");
+
 
 class SystemBody {
  public:
@@ -53,26 +96,28 @@ class SystemBody {
   // make working with threads easier. Use system_ to retrieve the full list of
   // bodies that this instance needs to calculate acceleration against.
 
+  // mass(), pos(), vel() and acc() are the body's row in its System's table
+  // once it's been added, and its own copy before then.
   constexpr string& name();
-  constexpr double mass();
+  // Stable while the body is in a System, and not reused after it leaves.
+  constexpr BodyId id();
+  inline double mass();
   constexpr double radius();
-  constexpr Vector& pos();
-  constexpr Vector& vel();
-  constexpr Vector& acc();
+  inline Vector& pos();
+  inline Vector& vel();
+  inline Vector& acc();
   constexpr System* system();
   constexpr SystemBody* orbiting();
   void set_orbit(SystemBody* body);
-  void update_acceleration(const vector<SystemBody*>& bodies);
-  void update_position_velocity(double t);
 
  private:
   friend class System;
 
+  inline HotBody& hot();
   void add_orbiting_body(SystemBody* body);
   void remove_orbiting_body(SystemBody* body);
 
   string name_ = "[unknown]";
-  double mass_ = 0;
   double radius_ = 0;
   double a_ = 0;
   double e_ = 0;
@@ -82,30 +127,67 @@ class SystemBody {
   double E_ = 0;
   // Maximum ||r||^2 value where gravitational acceleration should be calc'd.
   //double r_concern_ = 0;
-  System* system_;
+  System* system_ = nullptr;
+  // Row in system_'s table, and id in its registry.
+  size_t index_ = 0;
+  BodyId id_ = ssm::NO_BODY;
   SystemBody* orbiting_ = nullptr;
   vector<SystemBody*> orbited_ = {};
-  Vector pos_ = { 0, 0, 0 };
-  Vector vel_ = { 0, 0, 0 };
-  Vector acc_ = { 0, 0, 0 };
+  // State until the body is added to a System.
+  HotBody staged_;
 };
 
 
 class System {
  public:
-  void add_body(SystemBody* body);
-  // TODO implement
-  //void remove_body(SystemBody* body);
+  // Returns -EEXIST if the system already has a body by that name.
+  int add_body(SystemBody* body);
+  // Take body out of the system, in O(1). The last body moves into its row,
+  // so rows aren't stable, but ids are. body keeps its last state, and bodies
+  // orbiting it keep orbiting that. Returns -ENOENT if body isn't in this
+  // system. Not while an ephemeris is being written, since its body list is
+  // fixed when it's opened.
+  int remove_body(SystemBody* body);
+  // The body called name, or nullptr.
+  SystemBody* find(const string& name);
 
   // Run system using step seconds, for dur steps, using threads.
   void step(double step);
 
+  // step() split in two, so the state can be sampled at times in between
+  // steps. accelerate() computes acceleration at the current positions,
+  // extrapolate() writes every body's state dt seconds ahead along the same
+  // path advance() will take, and advance() moves to the end of the step.
+  void accelerate();
+  void extrapolate(double dt, BodyState* out);
+  void advance(double step);
+
+  // Look for apsis passages and node crossings of every body relative to the
+  // body it orbits, and write any to log. Needs accelerate() to have been
+  // called for the current positions. Bodies are reported by id, so ed and
+  // log need room for every id handed out.
+  void observe(EventDetector* ed, EventLog* log, uint64_t step, double time);
+
+  // Copy the state of every body into cp, or load it back. restore() fails
+  // if the checkpoint doesn't hold the same bodies in the same order.
+  void save(Checkpoint* cp);
+  bool restore(const MappedCheckpoint& cp);
+
+  // Copy the state of every body into fs, or back from it. Only valid with
+  // BODIES bodies.
+  void save(FixedSystem* fs);
+  void restore(const FixedSystem& fs);
+
   // Thread-safe to read since there will be no additional writers.
   constexpr vector<SystemBody*>& bodies();
 
  private:
+  friend class SystemBody;
+
+  // Row i is the state of bodies_[i], and registry_ slot i.
+  SystemEngine engine_;
   vector<SystemBody*> bodies_ = {};
-  vector<ProcessingThread*> threads_ = {};
+  BodyRegistry registry_;
 };
 
 
@@ -123,7 +205,6 @@ SystemBody::SystemBody(string name,
            double Om, // longitude of ascending node
            double E)  // eccentric anomaly
     : name_(name),
-      mass_(mass),
       radius_(radius),
       a_(a),
       e_(e),
@@ -133,14 +214,20 @@ SystemBody::SystemBody(string name,
       E_(E) {
       //E_(E),
       //r_concern_(G * mass / 1e-9) {
+  staged_.mass = mass;
+}
+
+inline HotBody& SystemBody::hot() {
+  return system_ != nullptr ? system_->engine_.body(index_) : staged_;
 }
 
 constexpr string& SystemBody::name() { return name_; }
-constexpr double SystemBody::mass() { return mass_; }
+constexpr BodyId SystemBody::id() { return id_; }
+inline double SystemBody::mass() { return hot().mass; }
 constexpr double SystemBody::radius() { return radius_; }
-constexpr Vector& SystemBody::pos() { return pos_; }
-constexpr Vector& SystemBody::vel() { return vel_; }
-constexpr Vector& SystemBody::acc() { return acc_; }
+inline Vector& SystemBody::pos() { return hot().pos; }
+inline Vector& SystemBody::vel() { return hot().vel; }
+inline Vector& SystemBody::acc() { return hot().acc; }
 constexpr System* SystemBody::system() { return system_; }
 constexpr SystemBody* SystemBody::orbiting() { return orbiting_; }
 
@@ -155,8 +242,8 @@ void SystemBody::set_orbit(SystemBody* body) {
   }
   orbiting_ = body;
   orbiting_->add_orbiting_body(this);
-  kep2cart(orbiting_->mass(), a_, e_, i_, w_, Om_, E_, pos_, vel_);
-  pos_ += orbiting_->pos();
+  kep2cart(orbiting_->mass(), a_, e_, i_, w_, Om_, E_, pos(), vel());
+  pos() += orbiting_->pos();
   for (auto& b : orbited_) {
     // Some unnecessary operations will happen here, but this code is executed
     // very little. So not going to worry about it.
@@ -177,31 +264,36 @@ void SystemBody::remove_orbiting_body(SystemBody* body) {
   }
 }
 
-void SystemBody::update_acceleration(const vector<SystemBody*>& bodies) {
-  acc_.zero();
-  for (auto* body : bodies) {
-    if (body == this)
-      continue;
-    auto& p = body->pos();
-    double rsq = pos_.mag_sq(&p);
-    // TODO(trevnorris): Track the mag of acceleration from all bodies, and
-    // if this is below a given % then skip the calc. but how can I do this
-    // w/o needing to do the calc to begin with?
-    //if (rsq > r_concern_)
-      //continue;
-    acc_ += -G * body->mass() / (rsq * sqrt(rsq)) * (pos_ - p);
-  }
+int System::add_body(SystemBody* body) {
+  // TODO(trevnorris): if system_ != nullptr then remove from the other sysstem
+  int err = registry_.add(body->name(), &body->id_);
+  if (err != 0)
+    return err;
+  engine_.bodies().push_back(body->hot());
+  bodies_.push_back(body);
+  body->system_ = this;
+  body->index_ = bodies_.size() - 1;
+  return 0;
 }
 
-void SystemBody::update_position_velocity(double t) {
-  pos_ += vel_ * t + acc_ * t * t * 0.5;
-  vel_ += acc_ * t;
+int System::remove_body(SystemBody* body) {
+  if (body->system_ != this)
+    return -ENOENT;
+  size_t slot;
+  int err = registry_.remove(body->id_, &slot);
+  if (err != 0)
+    return err;
+  body->staged_ = engine_.remove(slot);
+  body->system_ = nullptr;
+  ssm::swap_remove(&bodies_, slot);
+  if (slot < bodies_.size())
+    bodies_[slot]->index_ = slot;
+  return 0;
 }
 
-void System::add_body(SystemBody* body) {
-  bodies_.push_back(body);
-  // TODO(trevnorris): if system_ != nullptr then remove from the other sysstem
-  body->system_ = this;
+SystemBody* System::find(const string& name) {
+  BodyId id = registry_.find(name);
+  return id == ssm::NO_BODY ? nullptr : bodies_[registry_.slot(id)];
 }
 
 constexpr vector<SystemBody*>& System::bodies() {
@@ -209,16 +301,310 @@ constexpr vector<SystemBody*>& System::bodies() {
 }
 
 void System::step(double step) {
-  for (auto& sb : bodies_) {
-    sb->update_acceleration(bodies_);
+  engine_.step(step);
+}
+
+void System::accelerate() {
+  engine_.accelerate();
+}
+
+void System::extrapolate(double dt, BodyState* out) {
+  double c = dt * dt * 0.5;
+  for (size_t i = 0; i < bodies_.size(); i++) {
+    const HotBody& b = engine_.body(i);
+    Vector p = b.pos + b.vel * dt + b.acc * c;
+    Vector v = b.vel + b.acc * dt;
+    out[i].pos[0] = p.x();
+    out[i].pos[1] = p.y();
+    out[i].pos[2] = p.z();
+    out[i].vel[0] = v.x();
+    out[i].vel[1] = v.y();
+    out[i].vel[2] = v.z();
   }
-  for (auto& sb : bodies_) {
-    sb->update_position_velocity(step);
+}
+
+// The rest of a TaylorStep, after accelerate().
+void System::advance(double step) {
+  engine_.drift(step, step * step * 0.5);
+  engine_.kick(step);
+}
+
+void System::observe(EventDetector* ed,
+                     EventLog* log,
+                     uint64_t step,
+                     double time) {
+  ssm::OrbitEvent found[2];
+  for (size_t i = 0; i < bodies_.size(); i++) {
+    SystemBody* b = bodies_[i];
+    SystemBody* o = b->orbiting();
+    if (o == nullptr)
+      continue;
+    Vector r = b->pos() - o->pos();
+    Vector v = b->vel() - o->vel();
+    Vector a = b->acc() - o->acc();
+    double rr[3] = { r.x(), r.y(), r.z() };
+    double vv[3] = { v.x(), v.y(), v.z() };
+    double aa[3] = { a.x(), a.y(), a.z() };
+    size_t n = ed->observe(b->id(), step, time, rr, vv, aa, found);
+    for (size_t e = 0; e < n; e++) {
+      log->write(found[e]);
+    }
+  }
+}
+
+void System::save(Checkpoint* cp) {
+  cp->resize(bodies_.size());
+  for (size_t i = 0; i < bodies_.size(); i++) {
+    SystemBody* b = bodies_[i];
+    cp->names[i] = b->name();
+    cp->mass[i] = b->mass();
+    cp->pos[i * 3] = b->pos().x();
+    cp->pos[i * 3 + 1] = b->pos().y();
+    cp->pos[i * 3 + 2] = b->pos().z();
+    cp->vel[i * 3] = b->vel().x();
+    cp->vel[i * 3 + 1] = b->vel().y();
+    cp->vel[i * 3 + 2] = b->vel().z();
+    cp->acc[i * 3] = b->acc().x();
+    cp->acc[i * 3 + 1] = b->acc().y();
+    cp->acc[i * 3 + 2] = b->acc().z();
+  }
+}
+
+bool System::restore(const MappedCheckpoint& cp) {
+  if (cp.count() != bodies_.size())
+    return false;
+  for (size_t i = 0; i < bodies_.size(); i++) {
+    if (cp.name(i) != bodies_[i]->name())
+      return false;
+  }
+  const double* pos = cp.pos();
+  const double* vel = cp.vel();
+  const double* acc = cp.acc();
+  for (size_t i = 0; i < bodies_.size(); i++) {
+    bodies_[i]->pos().set(pos[i * 3], pos[i * 3 + 1], pos[i * 3 + 2]);
+    bodies_[i]->vel().set(vel[i * 3], vel[i * 3 + 1], vel[i * 3 + 2]);
+    bodies_[i]->acc().set(acc[i * 3], acc[i * 3 + 1], acc[i * 3 + 2]);
+  }
+  return true;
+}
+
+void System::save(FixedSystem* fs) {
+  for (size_t i = 0; i < BODIES; i++) {
+    SystemBody* b = bodies_[i];
+    fs->set_gm(i, G * b->mass());
+    fs->pos(i) = b->pos();
+    fs->vel(i) = b->vel();
+    fs->acc(i) = b->acc();
+  }
+}
+
+void System::restore(const FixedSystem& fs) {
+  for (size_t i = 0; i < BODIES; i++) {
+    bodies_[i]->pos() = fs.pos(i);
+    bodies_[i]->vel() = fs.vel(i);
+    bodies_[i]->acc() = fs.acc(i);
   }
 }
 
 
+cxxopts::Options* retrieve_options() {
+  auto options = new cxxopts::Options(
+      "Planetary Motion", "Calculate the planetary motion for a solar system");
+  options->add_options()
+    ("h,help", "print help")
+    ("y,years",
+     "how many earth years the test should proceed",
+     cxxopts::value<double>()->default_value("1"))
+    ("c,checkpoint",
+     "path of the checkpoint file to write",
+     cxxopts::value<string>()->default_value(""))
+    ("checkpoint-every",
+     "iterations between checkpoints (0 only writes on exit)",
+     cxxopts::value<size_t>()->default_value("0"))
+    ("r,restore",
+     "resume from this checkpoint file",
+     cxxopts::value<string>()->default_value(""))
+    ("e,ephemeris",
+     "path of the Chebyshev ephemeris file to write",
+     cxxopts::value<string>()->default_value(""))
+    ("ephemeris-days",
+     "length in days of each ephemeris interval",
+     cxxopts::value<double>()->default_value("8"))
+    ("ephemeris-degree",
+     "degree of the Chebyshev series fit to each interval",
+     cxxopts::value<unsigned>()->default_value("13"))
+    ("events",
+     "write apsis and node crossing events to this file (- for stdout)",
+     cxxopts::value<string>()->default_value(""))
+    ("events-every",
+     "iterations between checks for events",
+     cxxopts::value<size_t>()->default_value("1"))
+    ("particles",
+     "binary catalog of test particles to integrate against the ephemeris",
+     cxxopts::value<string>()->default_value(""))
+    ("particles-out",
+     "where to write the particles' final states",
+     cxxopts::value<string>()->default_value(""))
+    ("particles-only",
+     "reuse the existing ephemeris instead of integrating the system first")
+    ("particles-step",
+     "time in seconds of each test particle step",
+     cxxopts::value<double>()->default_value("3600"))
+    ("particles-chunk",
+     "test particles integrated together by one thread",
+     cxxopts::value<size_t>()->default_value("4096"))
+    ("particles-mixed",
+     "find test particle forces partly in float (relative error under 1.5e-6)")
+    ("eject-unbound",
+     "retire test particles once their energy about the sun is positive")
+    ("eject-au",
+     "retire test particles farther than this from the sun (0 for no limit)",
+     cxxopts::value<double>()->default_value("0"))
+    ("eject-every",
+     "test particle steps between checks for ejection",
+     cxxopts::value<uint64_t>()->default_value("64"))
+    ("eject-events",
+     "write retired test particles to this file (- for stdout)",
+     cxxopts::value<string>()->default_value(""))
+    ("kernel",
+     "instruction set for --particles-mixed: auto, sse2, avx2, avx512",
+     cxxopts::value<string>()->default_value("auto"))
+    ("threads",
+     "threads for integrating test particles (0 for every core)",
+     cxxopts::value<size_t>()->default_value("0"))
+    ("static",
+     "step with the body count fixed at compile time (see static_system.h)");
+  return options;
+}
+
+
+void s_handler(int) {
+  interrupted = 1;
+}
+
+
+// Second phase of a test particle run. Every particle in the catalog at in is
+// integrated over the span of the ephemeris at path, pulled on by the bodies
+// of ssm as the ephemeris places them. Particles are retired as eject says,
+// with its central body taken to be the sun, and logged to events if that
+// isn't empty.
+static int run_particles(System* ssm,
+                         const string& path,
+                         const string& in,
+                         const string& out,
+                         double step,
+                         size_t chunk,
+                         bool mixed,
+                         size_t threads,
+                         ParticleIntegrator::Ejection eject,
+                         const string& events) {
+  Ephemeris eph;
+  EventLog log;
+  vector<double> gm;
+  bool has_sun = false;
+  int err = eph.open(path.c_str());
+  if (err != 0) {
+    fprintf(stderr, "can't load ephemeris '%s': %s\n",
+            path.c_str(), strerror(-err));
+    return err;
+  }
+  if (!(eph.end() > eph.begin())) {
+    fprintf(stderr, "ephemeris '%s' covers no time\n", path.c_str());
+    return -EINVAL;
+  }
+  for (size_t b = 0; b < eph.bodies(); b++) {
+    SystemBody* body = ssm->find(eph.name(b));
+    if (body == nullptr) {
+      fprintf(stderr, "ephemeris body '%s' isn't in this system\n",
+              eph.name(b).c_str());
+      return -EINVAL;
+    }
+    if (body->name() == "sun") {
+      eject.central = b;
+      has_sun = true;
+    }
+    gm.push_back(G * body->mass());
+  }
+
+  ParticleIntegrator pi(&eph, gm, step, chunk, mixed);
+  if (eject.unbound || eject.max_distance > 0) {
+    if (!has_sun) {
+      fprintf(stderr, "ejection needs the sun in the ephemeris\n");
+      return -EINVAL;
+    }
+    if (!events.empty()) {
+      err = log.open(events.c_str(), {});
+      if (err != 0) {
+        fprintf(stderr, "can't open event log '%s': %s\n",
+                events.c_str(), strerror(-err));
+        return err;
+      }
+    }
+    pi.set_ejection(eject, events.empty() ? nullptr : &log);
+  }
+  uint64_t t = hrtime();
+  atomic<bool> finished(false);
+  thread worker([&]() {
+    err = pi.run(in.c_str(), out.c_str(), threads);
+    finished = true;
+  });
+  size_t shown = 0;
+  while (!finished) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    if (pi.done() == shown)
+      continue;
+    shown = pi.done();
+    printf("\r%c[2K%lu / %lu particles", 27, shown, pi.total());
+    fflush(stdout);
+  }
+  worker.join();
+  t = hrtime() - t;
+  printf("\r%c[2K", 27);
+  if (err != 0) {
+    fprintf(stderr, "can't integrate particles '%s': %s\n",
+            in.c_str(), strerror(-err));
+    return err;
+  }
+  printf("particles: %lu over %.2f years in %lu steps   %.2f ns/step   "
+         "%.2f minutes\n",
+         pi.total(),
+         (eph.end() - eph.begin()) / (365.2422 * 86400),
+         pi.steps(),
+         1.0 * t / (pi.total() * pi.steps()),
+         t / 1e9 / 60);
+  if (eject.unbound || eject.max_distance > 0)
+    printf("ejected: %lu\n", pi.ejected());
+  err = log.close();
+  if (err != 0) {
+    fprintf(stderr, "can't write event log '%s': %s\n",
+            events.c_str(), strerror(-err));
+    return err;
+  }
+  return 0;
+}
+
+
+static int write_checkpoint(System* ssm,
+                            Checkpoint* cp,
+                            const string& path,
+                            size_t iter,
+                            double time,
+                            double step) {
+  ssm->save(cp);
+  cp->step = iter;
+  cp->time = time;
+  cp->step_sec = step;
+  int err = cp->save(path.c_str());
+  if (err != 0) {
+    fprintf(stderr, "\ncan't write checkpoint '%s': %s\n",
+            path.c_str(), strerror(-err));
+  }
+  return err;
+}
+
+
 int main(int argc, char* argv[]) {
+  struct sigaction sigIntHandler;
   System ssm;
   SystemBody sun("sun",         1.9885e30,  696342000, 0, 0, 0, 0, 0, 0);
   SystemBody mercury("mercury", 3.3011e23,  2439700,  57909175678.24835,  0.20563069, 6.3472876, 77.45645,  48.33167,  0);
@@ -268,19 +654,170 @@ int main(int argc, char* argv[]) {
   ssm.add_body(&quaoar);
   ssm.add_body(&varuna);
 
+  cxxopts::Options* options = retrieve_options();
+  auto result = options->parse(argc, argv);
+
+  if (result.count("help")) {
+    printf("%s", options->help({""}).c_str());
+    return 0;
+  }
+
   double YEAR_SEC = 365.2422 * 86400;
-  double YEARS = 1;
+  double YEARS = result["years"].as<double>();
   double TOTAL_TIME = YEARS * 365.2422 * 86400;
   double STEP_SEC = 1;
+  string CKPT_PATH = result["checkpoint"].as<string>();
+  size_t CKPT_ITER = result["checkpoint-every"].as<size_t>();
+  string RESTORE_PATH = result["restore"].as<string>();
+  string EPHEM_PATH = result["ephemeris"].as<string>();
+  double EPHEM_DAYS = result["ephemeris-days"].as<double>();
+  unsigned EPHEM_DEGREE = result["ephemeris-degree"].as<unsigned>();
+  EphemerisBuilder* eph = nullptr;
+  vector<BodyState> states;
+  string EVENTS_PATH = result["events"].as<string>();
+  size_t EVENTS_ITER = result["events-every"].as<size_t>();
+  EventDetector* events = nullptr;
+  EventLog event_log;
+  size_t events_countdown = 1;
+  string PARTICLES_PATH = result["particles"].as<string>();
+  string PARTICLES_OUT = result["particles-out"].as<string>();
+  bool PARTICLES_ONLY = result.count("particles-only") > 0;
+  double PARTICLES_STEP = result["particles-step"].as<double>();
+  size_t PARTICLES_CHUNK = result["particles-chunk"].as<size_t>();
+  bool PARTICLES_MIXED = result.count("particles-mixed") > 0;
+  string KERNEL = result["kernel"].as<string>();
+  ssm::SimdLevel kernel_level;
+  ParticleIntegrator::Ejection EJECT;
+  EJECT.unbound = result.count("eject-unbound") > 0;
+  EJECT.max_distance = result["eject-au"].as<double>() * AU;
+  EJECT.every = result["eject-every"].as<uint64_t>();
+  string EJECT_EVENTS = result["eject-events"].as<string>();
+  size_t THREADS = result["threads"].as<size_t>();
+  bool STATIC = result.count("static") > 0;
+  FixedSystem* fixed = nullptr;
+  size_t ckpt_countdown = CKPT_ITER;
   size_t iter = 0;
+  double start = 0;
+  Checkpoint cp;
   uint64_t t;
 
+  delete options;
+
+  int kernel_err = ssm::parse_simd_level(KERNEL.c_str(), &kernel_level);
+  if (kernel_err < 0) {
+    fprintf(stderr, "can't use kernel '%s': %s\n",
+            KERNEL.c_str(), strerror(-kernel_err));
+    return 1;
+  }
+  ssm::set_accel_mixed_level(kernel_level);
+  if (PARTICLES_MIXED) {
+    printf("mixed kernel: %s (cpu supports up to %s)\n",
+           ssm::simd_level_name(kernel_level),
+           ssm::simd_level_name(ssm::detect_simd_level()));
+  }
+
+  if (!PARTICLES_PATH.empty() && (EPHEM_PATH.empty() || PARTICLES_OUT.empty())) {
+    fprintf(stderr, "--particles needs --ephemeris and --particles-out\n");
+    return 1;
+  }
+  if (PARTICLES_ONLY) {
+    if (PARTICLES_PATH.empty()) {
+      fprintf(stderr, "--particles-only needs --particles\n");
+      return 1;
+    }
+    return run_particles(&ssm, EPHEM_PATH, PARTICLES_PATH, PARTICLES_OUT,
+                         PARTICLES_STEP, PARTICLES_CHUNK, PARTICLES_MIXED,
+                         THREADS, EJECT, EJECT_EVENTS) == 0 ? 0 : 1;
+  }
+
+  sigIntHandler.sa_handler = s_handler;
+  sigemptyset(&sigIntHandler.sa_mask);
+  sigIntHandler.sa_flags = 0;
+  sigaction(SIGINT, &sigIntHandler, nullptr);
+  sigaction(SIGTERM, &sigIntHandler, nullptr);
+
+  if (!RESTORE_PATH.empty()) {
+    MappedCheckpoint mcp;
+    t = hrtime();
+    int err = mcp.open(RESTORE_PATH.c_str());
+    if (err != 0) {
+      fprintf(stderr, "can't load checkpoint '%s': %s\n",
+              RESTORE_PATH.c_str(), strerror(-err));
+      return 1;
+    }
+    if (!ssm.restore(mcp)) {
+      fprintf(stderr, "checkpoint '%s' doesn't match this system\n",
+              RESTORE_PATH.c_str());
+      return 1;
+    }
+    iter = mcp.step();
+    start = mcp.time();
+    STEP_SEC = mcp.step_sec();
+    printf("restored %lu bodies at %.2f years in %.3f ms\n\n",
+           mcp.count(),
+           start / YEAR_SEC,
+           (hrtime() - t) / 1e6);
+  }
+
+  // The particles run over the ephemeris, which only holds whole intervals.
+  if (!PARTICLES_PATH.empty() && TOTAL_TIME - start < EPHEM_DAYS * 86400) {
+    fprintf(stderr, "--particles needs a run of at least one ephemeris "
+            "interval (%.2f days), not %.2f days\n",
+            EPHEM_DAYS, std::max(0.0, TOTAL_TIME - start) / 86400);
+    return 1;
+  }
+
+  if (!EPHEM_PATH.empty()) {
+    vector<string> names;
+    for (auto* b : ssm.bodies()) {
+      names.push_back(b->name());
+    }
+    states.resize(names.size());
+    eph = new EphemerisBuilder(
+        names.size(), start, EPHEM_DAYS * 86400, EPHEM_DEGREE);
+    int err = eph->open(EPHEM_PATH.c_str(), names);
+    if (err != 0) {
+      fprintf(stderr, "can't open ephemeris '%s': %s\n",
+              EPHEM_PATH.c_str(), strerror(-err));
+      return 1;
+    }
+  }
+
+  if (!EVENTS_PATH.empty() && EVENTS_ITER > 0) {
+    // Events are by body id, which is the row until a body is removed.
+    vector<string> names;
+    for (auto* b : ssm.bodies()) {
+      names.push_back(b->name());
+    }
+    events = new EventDetector(names.size());
+    int err = event_log.open(EVENTS_PATH.c_str(), names);
+    if (err != 0) {
+      fprintf(stderr, "can't open event log '%s': %s\n",
+              EVENTS_PATH.c_str(), strerror(-err));
+      return 1;
+    }
+  }
+
+  if (STATIC) {
+    if (ssm.bodies().size() != BODIES) {
+      fprintf(stderr, "--static is built for %lu bodies, not %lu\n",
+              BODIES, ssm.bodies().size());
+      return 1;
+    }
+    fixed = new FixedSystem();
+    ssm.save(fixed);
+  }
+
   print_system(&ssm);
   printf("\n");
 
+  uint64_t allocs = ssm::heap_allocations();
   t = hrtime();
 
-  for (double i = 0; i < TOTAL_TIME; i += STEP_SEC) {
+  double i = start;
+  for (; i < TOTAL_TIME; i += STEP_SEC) {
+    if (interrupted)
+      break;
     if ((size_t)i % (size_t)(YEAR_SEC / 10 * STEP_SEC) < 1) {
       double u = (hrtime() - t) / 1e9;
       double est = u / (i / TOTAL_TIME) - u * (i / TOTAL_TIME);
@@ -290,27 +827,98 @@ int main(int argc, char* argv[]) {
              est);
       fflush(stdout);
     }
+    bool sample = eph != nullptr && eph->next() < i + STEP_SEC;
+    bool observe = events != nullptr && --events_countdown == 0;
+    if (sample || observe) {
+      // Both work on ssm, so with --static bring it up to date first.
+      if (fixed != nullptr)
+        ssm.restore(*fixed);
+      // Both need the acceleration at the current positions, before the step.
+      ssm.accelerate();
+      if (observe) {
+        ssm.observe(events, &event_log, iter, i);
+        events_countdown = EVENTS_ITER;
+      }
+      // One or more Chebyshev nodes fall inside this step.
+      while (eph != nullptr && eph->next() < i + STEP_SEC) {
+        ssm.extrapolate(eph->next() - i, states.data());
+        eph->add(states.data());
+      }
+      ssm.advance(STEP_SEC);
+      if (fixed != nullptr)
+        ssm.save(fixed);
+    } else if (fixed != nullptr) {
+      fixed->step(STEP_SEC);
+    } else {
+      ssm.step(STEP_SEC);
+    }
     iter++;
-    ssm.step(STEP_SEC);
+    if (CKPT_ITER > 0 && --ckpt_countdown == 0 && !CKPT_PATH.empty()) {
+      if (fixed != nullptr)
+        ssm.restore(*fixed);
+      write_checkpoint(&ssm, &cp, CKPT_PATH, iter, i + STEP_SEC, STEP_SEC);
+      ckpt_countdown = CKPT_ITER;
+    }
   }
 
   t = hrtime() - t;
+  allocs = ssm::heap_allocations() - allocs;
+  if (fixed != nullptr) {
+    ssm.restore(*fixed);
+    delete fixed;
+  }
+  if (!CKPT_PATH.empty()) {
+    write_checkpoint(&ssm, &cp, CKPT_PATH, iter, i, STEP_SEC);
+  }
   printf("\r%c[2K", 27);
   print_system(&ssm);
   printf("step: %.2f    iter: %lu   %.2f ns/iter   %.2f minutes\n",
          STEP_SEC,
          iter,
-         1.0 * t / iter,
+         1.0 * t / (iter - start / STEP_SEC),
          1.0 * t / 1e9 / 60);
   printf("%.2f years computed\n",
          1.0 * iter * STEP_SEC / 86400 / 365.256);
+#if defined(SSM_COUNT_ALLOCS)
+  printf("heap allocations while stepping: %lu\n", allocs);
+#endif
+
+  if (eph != nullptr) {
+    uint64_t records = eph->records();
+    int err = eph->close();
+    if (err != 0) {
+      fprintf(stderr, "can't write ephemeris '%s': %s\n",
+              EPHEM_PATH.c_str(), strerror(-err));
+    } else {
+      printf("ephemeris: %lu intervals of %.2f days   %.2f MB\n",
+             records,
+             EPHEM_DAYS,
+             (sizeof(ssm::EphemHeader) +
+              records * states.size() * 3 * (EPHEM_DEGREE + 1) *
+              sizeof(double)) / 1e6);
+    }
+    delete eph;
+  }
 
-  return 0;
-}
+  if (events != nullptr) {
+    int err = event_log.close();
+    if (err != 0) {
+      fprintf(stderr, "can't write event log '%s': %s\n",
+              EVENTS_PATH.c_str(), strerror(-err));
+    }
+    printf("events: %lu\n", event_log.written());
+    delete events;
+  }
 
+  if (!PARTICLES_PATH.empty() && !interrupted) {
+    if (run_particles(&ssm, EPHEM_PATH, PARTICLES_PATH, PARTICLES_OUT,
+                      PARTICLES_STEP, PARTICLES_CHUNK, PARTICLES_MIXED,
+                      THREADS, EJECT, EJECT_EVENTS) != 0) {
+      return 1;
+    }
+  }
 
-double d2r(double d) {
-  return d * PI / 180;
+  return 0;
 }
 
 
@@ -328,21 +936,11 @@ double d2r(double d) {
  */
 void kep2cart(double M, double a, double e, double i, double w, double Om,
               double E, Vector& pos, Vector& vel) {
-  i = d2r(i);
-  w = d2r(w);
-  Om = d2r(Om);
-  double v = 2 * atan(sqrt((1 + e) / (1 - e)) * tan(E / 2));
-  double r = a * (1 - e * cos(E));
-  double mu = G * M;
-  double h = sqrt(mu * a / (1 - e * e));
-  pos.set(r * (cos(Om) * cos(w + v) - sin(Om) * sin(w + v) * cos(i)),
-          r * (sin(Om) * cos(w + v) + cos(Om) * sin(w + v) * cos(i)),
-          r * (sin(i) * sin(w + v)));
-  vel.set(-(mu / h) * (cos(Om) * (sin(w + v) + e * sin(w)) +
-                       sin(Om) * (cos(w + v) + e * cos(w)) * cos(i)),
-          -(mu / h) * (sin(Om) * (sin(w + v) + e * sin(w)) -
-                       cos(Om) * (cos(w + v) + e * cos(w)) * cos(i)),
-          (mu / h) * (cos(w + v) + e * cos(w)) * sin(i));
+  double p[3];
+  double v[3];
+  ssm::kep2cart(G * M, a, e, i, w, Om, E, p, v);
+  pos.set(p[0], p[1], p[2]);
+  vel.set(v[0], v[1], v[2]);
 }
 
 
@@ -0,0 +1,62 @@
+#ifndef RING_BUFFER_H_
+#define RING_BUFFER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace ssm {
+
+// Bounded single producer, single consumer queue. Neither side ever blocks;
+// push() and pop() return false when the ring is full or empty.
+template <typename T>
+class RingBuffer {
+ public:
+  explicit RingBuffer(size_t capacity) : slots_(capacity + 1) { }
+
+  RingBuffer(const RingBuffer&) = delete;
+  RingBuffer& operator=(const RingBuffer&) = delete;
+
+  inline size_t capacity() const { return slots_.size() - 1; }
+
+  inline bool push(const T& v) {
+    size_t h = head_.load(std::memory_order_relaxed);
+    size_t n = next(h);
+    if (n == tail_.load(std::memory_order_acquire))
+      return false;
+    slots_[h] = v;
+    head_.store(n, std::memory_order_release);
+    return true;
+  }
+
+  inline bool pop(T* v) {
+    size_t t = tail_.load(std::memory_order_relaxed);
+    if (t == head_.load(std::memory_order_acquire))
+      return false;
+    *v = slots_[t];
+    tail_.store(next(t), std::memory_order_release);
+    return true;
+  }
+
+  inline bool empty() const {
+    return tail_.load(std::memory_order_acquire) ==
+           head_.load(std::memory_order_acquire);
+  }
+
+ private:
+  inline size_t next(size_t i) const {
+    return i + 1 == slots_.size() ? 0 : i + 1;
+  }
+
+  std::vector<T> slots_;
+  // Keep producer and consumer indexes on separate cache lines. Padding rather
+  // than alignas so containing objects can still be allocated with new.
+  char pad0_[64];
+  std::atomic<size_t> head_{0};
+  char pad1_[64];
+  std::atomic<size_t> tail_{0};
+};
+
+}  // namespace ssm
+
+#endif  // RING_BUFFER_H_
@@ -0,0 +1,87 @@
+#ifndef SIMD_DISPATCH_H_
+#define SIMD_DISPATCH_H_
+
+#include <cerrno>
+#include <cstring>
+
+namespace ssm {
+
+// Instruction sets the SIMD kernels are built for. Each kernel is compiled
+// for every level in the same binary, with the compiler's target attribute,
+// and the one to run is picked at startup from what the CPU reports through
+// cpuid. Builds with -march=native are then no longer needed to use AVX2 or
+// AVX-512, and the binary still runs on machines with neither.
+//
+// SSE2 is the x86-64 baseline. Elsewhere only the portable code is built, and
+// SSE2 stands for that.
+enum class SimdLevel {
+  SSE2 = 0,
+  AVX2 = 1,
+  AVX512 = 2,
+};
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SSM_SIMD_DISPATCH 1
+#endif
+
+inline const char* simd_level_name(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::SSE2: return "sse2";
+    case SimdLevel::AVX2: return "avx2";
+    case SimdLevel::AVX512: return "avx512";
+  }
+  return "unknown";
+}
+
+// Whether the CPU, and the OS through the registers it saves, can run level.
+inline bool simd_level_supported(SimdLevel level) {
+#if defined(SSM_SIMD_DISPATCH)
+  __builtin_cpu_init();
+  switch (level) {
+    case SimdLevel::SSE2:
+      return true;
+    case SimdLevel::AVX2:
+      return __builtin_cpu_supports("avx2");
+    case SimdLevel::AVX512:
+      return __builtin_cpu_supports("avx512f");
+  }
+  return false;
+#else
+  return level == SimdLevel::SSE2;
+#endif
+}
+
+// The highest level the CPU supports.
+inline SimdLevel detect_simd_level() {
+  if (simd_level_supported(SimdLevel::AVX512))
+    return SimdLevel::AVX512;
+  if (simd_level_supported(SimdLevel::AVX2))
+    return SimdLevel::AVX2;
+  return SimdLevel::SSE2;
+}
+
+// Parse a --kernel value: "auto" for detect_simd_level(), or a level by name.
+// Returns -EINVAL for a name that isn't a level, and -ENOTSUP for one this
+// CPU can't run.
+inline int parse_simd_level(const char* name, SimdLevel* out) {
+  if (std::strcmp(name, "auto") == 0) {
+    *out = detect_simd_level();
+    return 0;
+  }
+  const SimdLevel levels[] = {
+    SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512
+  };
+  for (SimdLevel level : levels) {
+    if (std::strcmp(name, simd_level_name(level)) != 0)
+      continue;
+    if (!simd_level_supported(level))
+      return -ENOTSUP;
+    *out = level;
+    return 0;
+  }
+  return -EINVAL;
+}
+
+}  // namespace ssm
+
+#endif  // SIMD_DISPATCH_H_
@@ -0,0 +1,120 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace ssm {
+
+// Plain copy of the integration state of a single body. Kept trivially
+// copyable so a whole frame can be moved with a single memcpy.
+struct BodyState {
+  double pos[3];
+  double vel[3];
+};
+
+// Immutable, epoch-tagged copy of the system handed out to readers.
+struct Snapshot {
+  uint64_t epoch = 0;  // 0 means nothing has been published yet.
+  uint64_t step = 0;
+  double time = 0;
+  std::vector<BodyState> bodies;
+};
+
+// Single writer, many reader snapshot exchange. The integrator fills the
+// slot following the most recently published one and then flips latest_.
+// Readers copy out whichever slot latest_ points to and use the slot's
+// sequence number to detect the (rare) case the writer lapped them mid copy,
+// in which case they simply try again. The writer never waits on a reader.
+class SnapshotBuffer {
+ public:
+  explicit SnapshotBuffer(size_t capacity) : capacity_(capacity) {
+    for (auto& s : slots_) {
+      s.seq.store(0, std::memory_order_relaxed);
+      s.bodies.resize(capacity);
+    }
+  }
+
+  SnapshotBuffer(const SnapshotBuffer&) = delete;
+  SnapshotBuffer& operator=(const SnapshotBuffer&) = delete;
+
+  inline size_t capacity() const { return capacity_; }
+
+  // Epoch of the most recently published snapshot, 0 if none.
+  inline uint64_t epoch() const {
+    return latest_.load(std::memory_order_acquire);
+  }
+
+  // Writer: return the storage for the next snapshot. Must be followed by a
+  // call to commit() before begin() is called again. n must not be larger
+  // than capacity().
+  inline BodyState* begin(size_t n) {
+    uint64_t e = latest_.load(std::memory_order_relaxed) + 1;
+    Slot& s = slots_[e % kSlots];
+    // Odd sequence marks the slot as being written.
+    s.seq.store(e * 2 - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.count = n;
+    return s.bodies.data();
+  }
+
+  // Writer: publish the snapshot filled in after begin().
+  inline uint64_t commit(uint64_t step, double time) {
+    uint64_t e = latest_.load(std::memory_order_relaxed) + 1;
+    Slot& s = slots_[e % kSlots];
+    s.step = step;
+    s.time = time;
+    s.seq.store(e * 2, std::memory_order_release);
+    latest_.store(e, std::memory_order_release);
+    return e;
+  }
+
+  // Reader: copy the latest snapshot into out. Returns false if nothing has
+  // been published yet. Safe to call from any number of threads at once.
+  bool read(Snapshot* out) const {
+    for (;;) {
+      uint64_t e = latest_.load(std::memory_order_acquire);
+      if (e == 0)
+        return false;
+      const Slot& s = slots_[e % kSlots];
+      uint64_t seq = s.seq.load(std::memory_order_acquire);
+      if (seq != e * 2)
+        continue;
+      size_t n = s.count;
+      out->bodies.resize(n);
+      std::memcpy(static_cast<void*>(out->bodies.data()),
+                  s.bodies.data(),
+                  n * sizeof(BodyState));
+      out->step = s.step;
+      out->time = s.time;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (s.seq.load(std::memory_order_relaxed) != seq)
+        continue;
+      out->epoch = e;
+      return true;
+    }
+  }
+
+ private:
+  // Three slots let the writer fill a new snapshot while readers are still
+  // copying the previous one without ever touching the same memory.
+  static constexpr size_t kSlots = 3;
+
+  struct Slot {
+    std::atomic<uint64_t> seq;
+    uint64_t step = 0;
+    double time = 0;
+    size_t count = 0;
+    std::vector<BodyState> bodies;
+  };
+
+  size_t capacity_;
+  Slot slots_[kSlots];
+  std::atomic<uint64_t> latest_{0};
+};
+
+}  // namespace ssm
+
+#endif  // SNAPSHOT_H_
@@ -0,0 +1,110 @@
+#ifndef STATIC_SYSTEM_H_
+#define STATIC_SYSTEM_H_
+
+#include "math_vector.h"
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace ssm {
+
+// Direct summation over a body count fixed at compile time. Every array is a
+// std::array of N, and accelerate() is expanded over the N * (N - 1) / 2
+// pairs with each index a template argument, so the compiler sees straight
+// line code over fixed offsets: no loop counters, no pointers to chase and no
+// bounds to check. G is folded into each mass up front.
+//
+// The scheme is the one System::step() and NBody use, pos += v * dt +
+// a * dt^2 / 2 and vel += a * dt. Each pair is visited once, as in NBody, so
+// results differ from planets2's System in the last bits.
+//
+// Compile time and code size grow with the number of pairs; it's meant for
+// small systems like the 14 bodies of planets2.
+template <size_t N>
+class StaticSystem {
+ public:
+  static constexpr size_t size = N;
+
+  StaticSystem() : gm_{}, pos_{}, vel_{}, acc_{} { }
+
+  // gm is G times the body's mass.
+  inline void set_gm(size_t i, double gm) { gm_[i] = gm; }
+  inline double gm(size_t i) const { return gm_[i]; }
+  inline Vector& pos(size_t i) { return pos_[i]; }
+  inline Vector& vel(size_t i) { return vel_[i]; }
+  inline Vector& acc(size_t i) { return acc_[i]; }
+  inline const Vector& pos(size_t i) const { return pos_[i]; }
+  inline const Vector& vel(size_t i) const { return vel_[i]; }
+  inline const Vector& acc(size_t i) const { return acc_[i]; }
+
+  inline void accelerate() {
+    for (auto& a : acc_) {
+      a.zero();
+    }
+    rows(std::make_index_sequence<N>());
+  }
+
+  inline void advance(double dt) {
+    double hdt2 = dt * dt * 0.5;
+    for (size_t i = 0; i < N; i++) {
+      pos_[i] += vel_[i] * dt + acc_[i] * hdt2;
+      vel_[i] += acc_[i] * dt;
+    }
+  }
+
+  inline void step(double dt) {
+    accelerate();
+    advance(dt);
+  }
+
+  inline void run(uint64_t steps, double dt) {
+    for (uint64_t s = 0; s < steps; s++) {
+      step(dt);
+    }
+  }
+
+ private:
+  // Expanded with an array initializer so it stays within C++14.
+  template <size_t... I>
+  inline void rows(std::index_sequence<I...>) {
+    int expand[] = { 0, (row<I>(std::make_index_sequence<N - I - 1>()), 0)... };
+    (void)expand;
+  }
+
+  template <size_t I, size_t... J>
+  inline void row(std::index_sequence<J...>) {
+    int expand[] = { 0, (pair<I, I + 1 + J>(), 0)... };
+    (void)expand;
+  }
+
+  // Written out in scalars: inlined 91 times over, the temporaries of the
+  // Vector expressions end up spilled to the stack instead of folded away.
+  template <size_t I, size_t J>
+  inline void pair() {
+    double dx = pos_[I][0] - pos_[J][0];
+    double dy = pos_[I][1] - pos_[J][1];
+    double dz = pos_[I][2] - pos_[J][2];
+    double rsq = dx * dx + dy * dy + dz * dz;
+    double f = 1 / (rsq * std::sqrt(rsq));
+    double fi = gm_[J] * f;
+    double fj = gm_[I] * f;
+    acc_[I][0] -= fi * dx;
+    acc_[I][1] -= fi * dy;
+    acc_[I][2] -= fi * dz;
+    acc_[J][0] += fj * dx;
+    acc_[J][1] += fj * dy;
+    acc_[J][2] += fj * dz;
+  }
+
+  std::array<double, N> gm_;
+  std::array<Vector, N> pos_;
+  std::array<Vector, N> vel_;
+  std::array<Vector, N> acc_;
+};
+
+}  // namespace ssm
+
+#endif  // STATIC_SYSTEM_H_
@@ -0,0 +1,127 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++14 -o test_arena test_arena.cc
+
+// Count heap allocations in this build (see alloc_counter.h).
+#define SSM_COUNT_ALLOCS 1
+#include "alloc_counter.h"
+#include "arena.h"
+#include "engine.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+static int failed = 0;
+// Keeps the compiler from pairing up and dropping a new and delete.
+static int* volatile sink;
+
+static void check(bool ok, const char* what) {
+  printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+    failed = 1;
+}
+
+struct Node {
+  double center[3];
+  Node* child[8];
+};
+
+struct Tracked {
+  explicit Tracked(std::vector<int>* log, int id) : log_(log), id_(id) { }
+  ~Tracked() { log_->push_back(id_); }
+  std::vector<int>* log_;
+  int id_;
+};
+
+int main() {
+  {
+    uint64_t before = ssm::heap_allocations();
+    sink = new int(1);
+    delete sink;
+    check(ssm::heap_allocations() == before + 1, "operator new is counted");
+  }
+
+  {
+    ssm::Arena arena(1024);
+    bool aligned = true;
+    for (size_t a = 1; a <= 256; a *= 2) {
+      uintptr_t p = reinterpret_cast<uintptr_t>(arena.allocate(3, a));
+      aligned = aligned && p % a == 0;
+    }
+    check(aligned, "allocations are aligned");
+
+    void* big = arena.allocate(10000);
+    check(big != nullptr && arena.capacity() >= 10000 + 1024,
+          "oversized allocation gets its own block");
+  }
+
+  {
+    // A tree rebuilt every step, as a Barnes-Hut force would: the first step
+    // sizes the blocks, and no later step touches the heap.
+    ssm::Arena arena(4096);
+    size_t blocks = 0;
+    uint64_t allocs = 0;
+    for (int step = 0; step < 100; step++) {
+      arena.reset();
+      Node* root = arena.make<Node>();
+      for (int i = 0; i < 1000; i++) {
+        Node* n = arena.make<Node>();
+        n->child[0] = root;
+        root = n;
+      }
+      if (step == 0) {
+        blocks = arena.blocks();
+        allocs = ssm::heap_allocations();
+      }
+    }
+    check(arena.blocks() == blocks, "blocks are reused after reset()");
+    check(ssm::heap_allocations() == allocs,
+          "no heap allocations after the first step");
+  }
+
+  {
+    std::vector<int> log;
+    log.reserve(3);
+    ssm::Arena arena;
+    arena.make<Tracked>(&log, 1);
+    arena.make<Tracked>(&log, 2);
+    arena.make<Tracked>(&log, 3);
+    arena.reset();
+    check(log == std::vector<int>({ 3, 2, 1 }),
+          "destructors run in reverse on reset()");
+    arena.make<Tracked>(&log, 4);
+  }
+
+  {
+    ssm::Arena arena;
+    std::vector<double, ssm::ArenaAllocator<double>> v(
+        (ssm::ArenaAllocator<double>(&arena)));
+    v.reserve(100);
+    uint64_t allocs = ssm::heap_allocations();
+    for (int i = 0; i < 100; i++) {
+      v.push_back(i);
+    }
+    check(v[99] == 99 && ssm::heap_allocations() == allocs,
+          "std::vector over an arena stays off the heap");
+  }
+
+  {
+    // MixedForce takes its per step masses from the engine's scratch arena.
+    ssm::Engine<ssm::SoALayout, ssm::MixedForce> e;
+    e.resize(64);
+    for (size_t i = 0; i < 64; i++) {
+      e.set_mass(i, 1e24);
+      e.pos(i, 0) = 1e9 * i;
+      e.pos(i, 1) = 3e8 * (i % 7);
+      e.pos(i, 2) = 0;
+    }
+    e.run(3, 60);
+    uint64_t allocs = ssm::heap_allocations();
+    e.run(100, 60);
+    check(ssm::heap_allocations() == allocs,
+          "engine steps make no heap allocations");
+  }
+
+  printf("%s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
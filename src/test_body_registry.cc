@@ -0,0 +1,136 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++14 -o test_body_registry test_body_registry.cc
+
+#include "body_registry.h"
+#include "engine.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static int failed = 0;
+
+static void check(bool ok, const char* what) {
+  printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+    failed = 1;
+}
+
+using Body = ssm::AoSLayout::Body;
+
+static bool same(const Body& a, const Body& b) {
+  for (size_t k = 0; k < 3; k++) {
+    if (a.pos[k] != b.pos[k] || a.vel[k] != b.vel[k])
+      return false;
+  }
+  return a.mass == b.mass;
+}
+
+// Remove bodies part way through a run, as planets2's System::remove_body()
+// does, and check the rest keep their ids and states.
+static void check_remove_mid_run() {
+  using TestEngine = ssm::Engine<ssm::AoSLayout, ssm::AllForce>;
+  const char* names[] = { "sun", "mercury", "venus", "earth", "mars" };
+  const double au = 1.496e11;
+  ssm::BodyRegistry reg;
+  TestEngine e;
+
+  for (int i = 0; i < 5; i++) {
+    ssm::BodyId id;
+    Body b;
+    reg.add(names[i], &id);
+    b.mass = i == 0 ? 1.989e30 : 3e23 * i;
+    if (i > 0) {
+      b.pos.set(0.4 * i * au, 0, 0);
+      b.vel.set(0, std::sqrt(1.327e20 / (0.4 * i * au)), 0);
+    }
+    e.bodies().push_back(b);
+  }
+  e.run(1000, 3600);
+
+  // Nothing has moved yet, so id i is in row i.
+  std::vector<Body> before = e.bodies();
+  ssm::BodyId venus = reg.find("venus");
+  size_t slot;
+  check(reg.remove(venus, &slot) == 0 && slot == 2 &&
+        same(e.remove(slot), before[venus]),
+        "a removed body keeps its last state");
+  bool kept = e.count() == 4 && reg.size() == 4;
+  for (size_t i = 0; kept && i < e.count(); i++) {
+    kept = same(e.body(i), before[reg.id(i)]);
+  }
+  check(kept && reg.id(2) == reg.find("mars"),
+        "the rest keep their ids and states");
+
+  ssm::BodyId earth = reg.find("earth");
+  check(reg.remove(earth, &slot) == 0 && slot == 3 &&
+        same(e.remove(slot), before[earth]) && e.count() == 3,
+        "removing the last row");
+
+  // The run goes on as if the system had started with only these.
+  TestEngine fresh;
+  fresh.bodies() = e.bodies();
+  e.run(1000, 3600);
+  fresh.run(1000, 3600);
+  bool match = true;
+  for (size_t i = 0; i < e.count(); i++) {
+    match = match && same(e.body(i), fresh.body(i));
+  }
+  check(match, "stepping on matches a system without them");
+}
+
+int main() {
+  ssm::BodyRegistry reg;
+  // Kept in slot order alongside reg, as a system keeps its state arrays.
+  std::vector<std::string> rows;
+  const char* names[] = { "sun", "mercury", "venus", "earth", "mars" };
+  ssm::BodyId ids[5];
+
+  bool added = true;
+  for (int i = 0; i < 5; i++) {
+    added = added && reg.add(names[i], &ids[i]) == 0;
+    rows.push_back(names[i]);
+  }
+  check(added && reg.size() == 5, "bodies are added");
+  check(ids[0] == 0 && ids[4] == 4 && reg.slot(ids[3]) == 3,
+        "ids and slots start out the same");
+
+  ssm::BodyId dup;
+  check(reg.add("earth", &dup) == -EEXIST, "names are unique");
+  check(reg.find("mars") == ids[4] && reg.find("pluto") == ssm::NO_BODY,
+        "find() by name");
+
+  size_t slot;
+  check(reg.remove(ids[1], &slot) == 0 && slot == 1, "remove() gives the slot");
+  ssm::swap_remove(&rows, slot);
+  check(rows[1] == "mars" && reg.id(1) == ids[4] && reg.slot(ids[4]) == 1,
+        "the last body fills the slot");
+  check(reg.size() == 4 && rows.size() == 4, "arrays stay dense");
+  check(!reg.contains(ids[1]) && reg.find("mercury") == ssm::NO_BODY,
+        "removed bodies are gone");
+  check(reg.name(ids[1]) == "mercury", "removed ids keep their name");
+  check(reg.remove(ids[1], &slot) == -ENOENT, "removing twice fails");
+
+  check(reg.remove(ids[4], &slot) == 0 && slot == 1, "remove a moved body");
+  ssm::swap_remove(&rows, slot);
+  check(reg.remove(ids[2], &slot) == 0 && slot == 2, "remove the last body");
+  ssm::swap_remove(&rows, slot);
+
+  ssm::BodyId again;
+  check(reg.add("mercury", &again) == 0 && again == 5 && reg.slot(again) == 2,
+        "ids aren't reused");
+  rows.push_back("mercury");
+
+  bool match = reg.size() == rows.size();
+  for (size_t i = 0; match && i < rows.size(); i++) {
+    match = reg.name(reg.id(i)) == rows[i] && reg.slot(reg.id(i)) == i;
+  }
+  check(match && reg.issued() == 6, "slots, ids and names agree");
+
+  check_remove_mid_run();
+
+  printf("%s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
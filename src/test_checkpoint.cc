@@ -0,0 +1,104 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++14 -o test_checkpoint test_checkpoint.cc
+
+#include "checkpoint.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using ssm::Checkpoint;
+using ssm::CheckpointHeader;
+using ssm::CheckpointLayout;
+using ssm::MappedCheckpoint;
+
+static int failed = 0;
+
+static void check(bool ok, const char* what) {
+  printf("%-48s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+    failed = 1;
+}
+
+static std::vector<char> read_all(const char* path) {
+  std::vector<char> data;
+  FILE* f = fopen(path, "rb");
+  if (f == nullptr)
+    return data;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+  fclose(f);
+  return data;
+}
+
+static void write_all(const char* path, const std::vector<char>& data) {
+  FILE* f = fopen(path, "wb");
+  fwrite(data.data(), 1, data.size(), f);
+  fclose(f);
+}
+
+// Write good with the uint64_t at off replaced by v, and try to open it.
+static int open_patched(const char* path,
+                        std::vector<char> good,
+                        uint64_t off,
+                        uint64_t v) {
+  MappedCheckpoint mcp;
+  std::memcpy(good.data() + off, &v, sizeof(v));
+  write_all(path, good);
+  return mcp.open(path);
+}
+
+int main() {
+  const char* path = "/tmp/test_checkpoint.bin";
+  Checkpoint cp;
+  MappedCheckpoint mcp;
+
+  cp.resize(2);
+  cp.names[0] = "sun";
+  cp.names[1] = "earth";
+  cp.mass[0] = 1.9885e30;
+  cp.mass[1] = 5.9724e24;
+  cp.pos[3] = 1.496e11;
+  cp.vel[4] = 29784.7;
+  cp.step = 42;
+  cp.time = 42 * 60.0;
+  cp.step_sec = 60;
+  check(cp.save(path) == 0, "save");
+
+  check(mcp.open(path) == 0 && mcp.count() == 2 && mcp.name(0) == "sun" &&
+        mcp.name(1) == "earth" && mcp.pos()[3] == 1.496e11 &&
+        mcp.vel()[4] == 29784.7 && mcp.step() == 42,
+        "open gives back what was saved");
+  mcp.close();
+
+  std::vector<char> good = read_all(path);
+  CheckpointLayout layout(2);
+  uint64_t off = layout.name_offsets;
+  uint64_t count_at = offsetof(CheckpointHeader, count);
+
+  check(open_patched(path, good, off + 8, 1000000) == -EINVAL,
+        "a name running past the end is refused");
+  check(open_patched(path, good, off, 2) == -EINVAL,
+        "names not starting at 0 are refused");
+  check(open_patched(path, good, off + 8, 9) == -EINVAL,
+        "descending name offsets are refused");
+  check(open_patched(path, good, count_at, 3) == -EINVAL,
+        "a count too big for the file is refused");
+  check(open_patched(path, good, count_at, UINT64_MAX / 8) == -EINVAL,
+        "a count that overflows the layout is refused");
+
+  write_all(path, good);
+  check(mcp.open(path) == 0, "the unpatched file still opens");
+  mcp.close();
+  remove(path);
+
+  printf("%s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,178 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++14 -o test_ephemeris test_ephemeris.cc
+
+#include "utils.h"
+#include "ephemeris.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using ssm::BodyState;
+using ssm::Ephemeris;
+using ssm::EphemerisBuilder;
+
+constexpr size_t BODIES = 3;
+constexpr double DAY = 86400;
+constexpr double T0 = 1000;
+constexpr double INTERVAL = 8 * DAY;
+constexpr size_t RECORDS = 100;
+constexpr size_t QUERIES = 1000000;
+
+// Circular orbits with roughly Mercury's, Earth's and Jupiter's periods.
+static const double radius[BODIES] = { 0.387 * AU, AU, 5.2 * AU };
+static const double period[BODIES] = { 88 * DAY, 365.25 * DAY, 4333 * DAY };
+
+static void orbit(size_t b, double t, double pos[3], double vel[3]) {
+  double w = 2 * PI / period[b];
+  double a = w * t;
+  pos[0] = radius[b] * std::cos(a);
+  pos[1] = radius[b] * std::sin(a);
+  pos[2] = radius[b] * 0.01 * std::sin(a);
+  vel[0] = -radius[b] * w * std::sin(a);
+  vel[1] = radius[b] * w * std::cos(a);
+  vel[2] = radius[b] * 0.01 * w * std::cos(a);
+}
+
+int main() {
+  const char* path = "/tmp/test_ephemeris.eph";
+  std::vector<std::string> names = { "inner", "middle", "outer" };
+  std::vector<BodyState> states(BODIES);
+  EphemerisBuilder builder(BODIES, T0, INTERVAL);
+  Ephemeris eph;
+  double max_pos = 0;
+  double max_vel = 0;
+  int err;
+
+  err = builder.open(path, names);
+  if (err != 0) {
+    fprintf(stderr, "open: %s\n", strerror(-err));
+    return 1;
+  }
+  while (builder.records() < RECORDS) {
+    double t = builder.next();
+    for (size_t b = 0; b < BODIES; b++) {
+      orbit(b, t, states[b].pos, states[b].vel);
+    }
+    builder.add(states.data());
+  }
+  // Half an interval's worth of samples that should never reach the file.
+  for (size_t i = 0; i < 5; i++) {
+    builder.add(states.data());
+  }
+  err = builder.close();
+  if (err != 0) {
+    fprintf(stderr, "close: %s\n", strerror(-err));
+    return 1;
+  }
+
+  err = eph.open(path);
+  if (err != 0) {
+    fprintf(stderr, "open ephemeris: %s\n", strerror(-err));
+    return 1;
+  }
+  if (eph.bodies() != BODIES ||
+      eph.header()->records != RECORDS ||
+      eph.find("outer") != 2 ||
+      eph.begin() != T0 ||
+      eph.end() != T0 + RECORDS * INTERVAL) {
+    fprintf(stderr, "bad header\n");
+    return 1;
+  }
+
+  double pos[3];
+  double vel[3];
+  if (eph.state(0, T0 - 1, pos, vel) ||
+      eph.state(0, eph.end() + 1, pos, vel) ||
+      !eph.state(0, eph.end(), pos, vel)) {
+    fprintf(stderr, "bad range check\n");
+    return 1;
+  }
+
+  // Compare against the analytic orbit on a grid that doesn't line up with
+  // the Chebyshev nodes or interval boundaries.
+  for (double t = T0; t <= eph.end(); t += 3607.3) {
+    for (size_t b = 0; b < BODIES; b++) {
+      double ep[3];
+      double ev[3];
+      orbit(b, t, pos, vel);
+      eph.state(b, t, ep, ev);
+      for (size_t a = 0; a < 3; a++) {
+        max_pos = std::fmax(max_pos, std::fabs(ep[a] - pos[a]));
+        max_vel = std::fmax(max_vel, std::fabs(ev[a] - vel[a]));
+      }
+    }
+  }
+  printf("max error   position: %.3e m   velocity: %.3e m/s\n",
+         max_pos, max_vel);
+
+  uint64_t t = hrtime();
+  double sum = 0;
+  double span = eph.end() - eph.begin();
+  for (size_t i = 0; i < QUERIES; i++) {
+    eph.state(i % BODIES, T0 + span * (i * 0.618034 - (size_t)(i * 0.618034)),
+              pos, vel);
+    sum += pos[0] + vel[0];
+  }
+  t = hrtime() - t;
+  printf("%.1f ns/query (%g)\n", 1.0 * t / QUERIES, sum > 0 ? 1.0 : 0.0);
+
+  // The same file cut short, with a byte too many, and with no records at all
+  // are refused. So is a header whose record count wraps the size, and name
+  // offsets that run past the names, don't start at 0 or go backwards.
+  {
+    FILE* fp = fopen(path, "rb");
+    std::vector<char> data(eph.header()->first_record +
+                           RECORDS * BODIES * 14 * 3 * sizeof(double));
+    bool read = fread(data.data(), 1, data.size(), fp) == data.size();
+    fclose(fp);
+    eph.close();
+
+    std::vector<char> cut(data.begin(), data.end() - 8);
+    std::vector<char> extra(data);
+    extra.push_back(0);
+    std::vector<char> wrap(data);
+    uint64_t records = UINT64_MAX / (BODIES * 14 * 3 * sizeof(double)) + 2;
+    std::memcpy(wrap.data() + offsetof(ssm::EphemHeader, records),
+                &records, sizeof(records));
+    // Names are "inner", "middle" and "outer", so the offsets are 0, 5, 11, 16.
+    size_t names_at = sizeof(ssm::EphemHeader);
+    const uint64_t bad_names[][2] = { { 1, 1000000 }, { 0, 1 }, { 1, 12 } };
+    std::vector<std::vector<char>> renamed;
+    for (auto& b : bad_names) {
+      renamed.push_back(data);
+      std::memcpy(renamed.back().data() + names_at + b[0] * sizeof(uint64_t),
+                  &b[1], sizeof(uint64_t));
+    }
+    EphemerisBuilder empty(BODIES, T0, INTERVAL);
+    bool refused = read &&
+                   empty.open(path, names) == 0 && empty.close() == 0 &&
+                   eph.open(path) == -EINVAL;
+    for (auto* d : { &cut, &extra, &wrap,
+                     &renamed[0], &renamed[1], &renamed[2] }) {
+      fp = fopen(path, "wb");
+      fwrite(d->data(), 1, d->size(), fp);
+      fclose(fp);
+      refused = refused && eph.open(path) == -EINVAL;
+    }
+    if (!refused) {
+      fprintf(stderr, "bad file accepted\n");
+      return 1;
+    }
+  }
+
+  unlink(path);
+
+  // Degree 13 over 8 days resolves even the innermost orbit to well under a
+  // metre.
+  if (max_pos > 1 || max_vel > 1e-5) {
+    fprintf(stderr, "ephemeris error too large\n");
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,97 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++14 -o test_events test_events.cc
+
+#include "utils.h"
+#include "events.h"
+
+#include <cmath>
+#include <cstdio>
+
+using ssm::EventDetector;
+using ssm::OrbitEvent;
+
+constexpr double DAY = 86400;
+constexpr double MU = G * 1.9885e30;
+constexpr double A = 0.387 * AU;
+constexpr double ECC = 0.2056;
+constexpr double INCL = 7;
+constexpr size_t ORBITS = 10;
+
+// Position, velocity and acceleration on a Kepler orbit t seconds after
+// periapsis. Periapsis is on the x axis and the orbit is tilted about the y
+// axis, so the nodes are where x = 0, at E = +-acos(e).
+static void state(double t, double r[3], double v[3], double a[3]) {
+  double n = std::sqrt(MU / (A * A * A));
+  double b = A * std::sqrt(1 - ECC * ECC);
+  double M = std::fmod(n * t, 2 * PI);
+  double E = M;
+  for (int i = 0; i < 50; i++) {
+    E -= (E - ECC * std::sin(E) - M) / (1 - ECC * std::cos(E));
+  }
+  double dE = n / (1 - ECC * std::cos(E));
+  double x = A * (std::cos(E) - ECC);
+  double vx = -A * std::sin(E) * dE;
+  double ci = std::cos(INCL * PI / 180);
+  double si = std::sin(INCL * PI / 180);
+  r[0] = x * ci;
+  r[1] = b * std::sin(E);
+  r[2] = x * si;
+  v[0] = vx * ci;
+  v[1] = b * std::cos(E) * dE;
+  v[2] = vx * si;
+  double rr = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+  for (int k = 0; k < 3; k++) {
+    a[k] = -MU * r[k] / (rr * rr * rr);
+  }
+}
+
+int main() {
+  double period = 2 * PI * std::sqrt(A * A * A / MU);
+  double steps[] = { 3600, DAY, 4 * DAY };
+  double node = std::acos(ECC);
+  double node_t = (node - ECC * std::sin(node)) / (2 * PI) * period;
+  double expected[4];
+  expected[ssm::EVENT_PERIAPSIS] = 0;
+  expected[ssm::EVENT_APOAPSIS] = period / 2;
+  expected[ssm::EVENT_DESCENDING_NODE] = node_t;
+  expected[ssm::EVENT_ASCENDING_NODE] = period - node_t;
+  int failed = 0;
+
+  for (double step : steps) {
+    EventDetector ed(1);
+    OrbitEvent found[2];
+    double worst[4] = { 0, 0, 0, 0 };
+    size_t count[4] = { 0, 0, 0, 0 };
+    // Start just after periapsis so the first one seen is a full orbit in.
+    double t0 = step / 3;
+    for (uint64_t s = 0; t0 + s * step < ORBITS * period; s++) {
+      double t = t0 + s * step;
+      double r[3];
+      double v[3];
+      double a[3];
+      state(t, r, v, a);
+      size_t n = ed.observe(0, s, t, r, v, a, found);
+      for (size_t e = 0; e < n; e++) {
+        // Expected offset of each event from periapsis within the orbit.
+        double phase = std::fmod(found[e].time, period);
+        double expect = expected[found[e].type];
+        if (expect == 0 && phase > period / 2)
+          expect = period;
+        double err = std::fabs(phase - expect);
+        if (err > worst[found[e].type])
+          worst[found[e].type] = err;
+        count[found[e].type]++;
+      }
+    }
+    printf("step %6.0f s:", step);
+    for (int k = 0; k < 4; k++) {
+      printf("  %s %lu (%.3f s)", ssm::ORBIT_EVENT_NAMES[k], count[k], worst[k]);
+      if (count[k] < ORBITS - 1 || worst[k] > step * 1e-3)
+        failed = 1;
+    }
+    printf("\n");
+  }
+
+  printf("%s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,182 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++14 -o test_mixed_precision test_mixed_precision.cc
+
+#include "utils.h"
+#include "mixed_precision.h"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+constexpr size_t SAMPLES = 10000000;
+constexpr double DAY = 86400;
+constexpr double GM_SUN = G * 1.9885e30;
+
+// Largest relative error of inv_r3_mixed(), and of the acceleration from
+// accel_mixed(), over random directions and log-uniform distances from 1 km
+// to 1e15 m. accel_mixed() is given four bodies at a time, with only one
+// having any mass, so each of its lanes is checked separately. With AVX-512
+// that's a masked load of half a vector, which is checked along the way.
+static double measure_inv_r3() {
+  std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> log_r(3, 15);
+  std::normal_distribution<double> dir(0, 1);
+  double worst = 0;
+  double bx[4];
+  double by[4];
+  double bz[4];
+  for (size_t i = 0; i < SAMPLES; i += 4) {
+    for (size_t k = 0; k < 4; k++) {
+      double r = std::pow(10, log_r(rng));
+      double d[3] = { dir(rng), dir(rng), dir(rng) };
+      double s = r / std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+      bx[k] = d[0] * s;
+      by[k] = d[1] * s;
+      bz[k] = d[2] * s;
+    }
+    for (size_t k = 0; k < 4; k++) {
+      double exact = ssm::inv_r3(bx[k], by[k], bz[k]);
+      double mixed = ssm::inv_r3_mixed(bx[k], by[k], bz[k]);
+      worst = std::max(worst, std::fabs(mixed - exact) / exact);
+
+      double gm[4] = { 0, 0, 0, 0 };
+      double a[3];
+      gm[k] = 1;
+      ssm::accel_mixed(4, bx, by, bz, gm, 0, 0, 0, a);
+      double e[3] = { exact * bx[k], exact * by[k], exact * bz[k] };
+      double err = std::sqrt((a[0] - e[0]) * (a[0] - e[0]) +
+                             (a[1] - e[1]) * (a[1] - e[1]) +
+                             (a[2] - e[2]) * (a[2] - e[2]));
+      double len = std::sqrt(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+      worst = std::max(worst, err / len);
+    }
+  }
+  return worst;
+}
+
+// Velocity Verlet around the sun for a year from a circular orbit at 1 AU.
+// Returns the distance from where the double kernel puts it at the end.
+static double orbit(bool mixed, double* out) {
+  double p[3] = { AU, 0, 0 };
+  double v[3] = { 0, std::sqrt(GM_SUN / AU), 0 };
+  double a[3];
+  double dt = 3600;
+  auto accel = [&]() {
+    double f = -GM_SUN * (mixed ? ssm::inv_r3_mixed(p[0], p[1], p[2])
+                                : ssm::inv_r3(p[0], p[1], p[2]));
+    for (int k = 0; k < 3; k++)
+      a[k] = f * p[k];
+  };
+  accel();
+  for (int s = 0; s < 365.25 * 24; s++) {
+    for (int k = 0; k < 3; k++) {
+      p[k] += (v[k] + a[k] * dt / 2) * dt;
+      v[k] += a[k] * dt / 2;
+    }
+    accel();
+    for (int k = 0; k < 3; k++)
+      v[k] += a[k] * dt / 2;
+  }
+  if (out == nullptr)
+    return 0;
+  double dsq = 0;
+  for (int k = 0; k < 3; k++) {
+    dsq += (p[k] - out[k]) * (p[k] - out[k]);
+    out[k] = p[k];
+  }
+  return std::sqrt(dsq);
+}
+
+// ns per interaction of particles against 14 bodies, with the loop of
+// ParticleIntegrator::accel() in double and then the active accel_mixed().
+static void time_kernels(double* td, double* tm, double* sink) {
+  const size_t ITER = 2000000;
+  std::mt19937_64 rng(7);
+  std::uniform_real_distribution<double> pos(-40 * AU, 40 * AU);
+  std::vector<double> bx(14);
+  std::vector<double> by(14);
+  std::vector<double> bz(14);
+  std::vector<double> gm(14, GM_SUN);
+  for (size_t b = 0; b < gm.size(); b++) {
+    bx[b] = pos(rng);
+    by[b] = pos(rng);
+    bz[b] = pos(rng);
+  }
+  double px = AU;
+  double sum = 0;
+
+  uint64_t t = hrtime();
+  for (size_t i = 0; i < ITER; i++) {
+    double a[3] = { 0, 0, 0 };
+    for (size_t b = 0; b < gm.size(); b++) {
+      double dx = px - bx[b];
+      double dy = px - by[b];
+      double dz = px - bz[b];
+      double f = -gm[b] * ssm::inv_r3(dx, dy, dz);
+      a[0] += f * dx;
+      a[1] += f * dy;
+      a[2] += f * dz;
+    }
+    sum += a[0] + a[1] + a[2];
+    px += 1;
+  }
+  *td = static_cast<double>(hrtime() - t) / (ITER * gm.size());
+
+  t = hrtime();
+  for (size_t i = 0; i < ITER; i++) {
+    double a[3];
+    ssm::accel_mixed(gm.size(), bx.data(), by.data(), bz.data(), gm.data(),
+                     px, px, px, a);
+    sum += a[0] + a[1] + a[2];
+    px += 1;
+  }
+  *tm = static_cast<double>(hrtime() - t) / (ITER * gm.size());
+  *sink += sum;
+}
+
+int main() {
+  int failed = 0;
+  const ssm::SimdLevel levels[] = {
+    ssm::SimdLevel::SSE2, ssm::SimdLevel::AVX2, ssm::SimdLevel::AVX512
+  };
+
+  printf("cpu supports up to %s\n",
+         ssm::simd_level_name(ssm::detect_simd_level()));
+  for (ssm::SimdLevel level : levels) {
+    if (!ssm::simd_level_supported(level))
+      continue;
+    ssm::set_accel_mixed_level(level);
+    double worst = measure_inv_r3();
+    printf("%-6s mixed kernel: max relative error %.3g over %lu samples "
+           "(bound %.3g)\n", ssm::simd_level_name(level), worst, SAMPLES,
+           ssm::MIXED_INV_R3_MAX_ERROR);
+    if (!(worst <= ssm::MIXED_INV_R3_MAX_ERROR))
+      failed = 1;
+  }
+
+  double end[3] = { 0, 0, 0 };
+  orbit(false, end);
+  double drift = orbit(true, end);
+  printf("1 AU orbit, 1 year at 1 h steps: mixed ends %.1f m from double\n",
+         drift);
+  // Each step's force is off by up to 1.5e-6 of itself; the drift that adds
+  // up to over a year's orbit should stay well under a planet's radius.
+  if (!(drift < 1e6))
+    failed = 1;
+
+  double sink = 0;
+  for (ssm::SimdLevel level : levels) {
+    if (!ssm::simd_level_supported(level))
+      continue;
+    ssm::set_accel_mixed_level(level);
+    double td;
+    double tm;
+    time_kernels(&td, &tm, &sink);
+    printf("%-6s ns/interaction: double %.2f   mixed %.2f   (%.2fx)   [%g]\n",
+           ssm::simd_level_name(level), td, tm, td / tm, sink == 0 ? 0. : 1.);
+  }
+
+  printf("%s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,128 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++17 -pthread -fPIC -fvisibility=hidden -shared -o libplanetary.so planetary.cc
+//  clang -O2 -Wall -pthread -o test_planetary test_planetary.c -L. -lplanetary -lm
+
+#include "planetary.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SIMS 4
+#define STEPS 100000
+
+static const double AU = 149597870700;
+
+// Sun and earth, with the earth's distance scaled by k so each simulation
+// differs.
+static planetary_sim* make(double k) {
+  planetary_sim* sim = planetary_create();
+  double zero[3] = { 0, 0, 0 };
+  double pos[3] = { k * AU, 0, 0 };
+  double vel[3] = { 0, 29784.7 / sqrt(k), 0 };
+  planetary_add_body(sim, "sun", 1.9885e30, zero, zero);
+  planetary_add_body(sim, "earth", 5.9724e24, pos, vel);
+  return sim;
+}
+
+static void* run(void* arg) {
+  planetary_step((planetary_sim*) arg, STEPS, 60);
+  return NULL;
+}
+
+int main(void) {
+  planetary_sim* sims[SIMS];
+  pthread_t threads[SIMS];
+  double got[SIMS][6];
+  double want[6];
+  int failed = 0;
+
+  // The same simulations, concurrently then one at a time, must agree.
+  for (int i = 0; i < SIMS; i++) {
+    sims[i] = make(1 + i * 0.5);
+    pthread_create(&threads[i], NULL, run, sims[i]);
+  }
+  for (int i = 0; i < SIMS; i++) {
+    pthread_join(threads[i], NULL);
+    planetary_snapshot(sims[i], NULL, got[i], NULL);
+  }
+  for (int i = 0; i < SIMS; i++) {
+    planetary_sim* sim = make(1 + i * 0.5);
+    run(sim);
+    planetary_snapshot(sim, NULL, want, NULL);
+    if (memcmp(want, got[i], sizeof(want)) != 0) {
+      printf("simulation %d differs when run concurrently\n", i);
+      failed = 1;
+    }
+    planetary_destroy(sim);
+  }
+
+  // The engine is kept between calls, so splitting a run changes nothing.
+  planetary_sim* split = make(1);
+  planetary_step(split, STEPS / 2, 60);
+  planetary_step(split, STEPS - STEPS / 2, 60);
+  planetary_snapshot(split, NULL, want, NULL);
+  if (memcmp(want, got[0], sizeof(want)) != 0) {
+    printf("a split run differs\n");
+    failed = 1;
+  }
+
+  // Save and load round trip.
+  planetary_sim* sim = planetary_create();
+  int err = planetary_save(sims[0], "/tmp/test_planetary.bin");
+  if (err == 0)
+    err = planetary_load(sim, "/tmp/test_planetary.bin", NULL);
+  if (err != 0) {
+    printf("save/load: %s\n", planetary_strerror(err));
+    failed = 1;
+  } else {
+    planetary_snapshot(sim, NULL, want, NULL);
+    if (planetary_count(sim) != 2 ||
+        strcmp(planetary_name(sim, 1), "earth") != 0 ||
+        planetary_steps(sim) != STEPS ||
+        planetary_time(sim) != STEPS * 60.0 ||
+        memcmp(want, got[0], sizeof(want)) != 0) {
+      printf("loaded checkpoint doesn't match\n");
+      failed = 1;
+    }
+    // Both go on from the same state, the loaded one over its new arrays.
+    planetary_step(sim, 1000, 60);
+    planetary_step(sims[0], 1000, 60);
+    planetary_snapshot(sim, NULL, want, NULL);
+    planetary_snapshot(sims[0], NULL, got[0], NULL);
+    if (memcmp(want, got[0], sizeof(want)) != 0) {
+      printf("a loaded simulation steps differently\n");
+      failed = 1;
+    }
+  }
+  if (planetary_load(sim, "/nonexistent", NULL) != -ENOENT ||
+      planetary_count(sim) != 2) {
+    printf("failed load changed the simulation\n");
+    failed = 1;
+  }
+  planetary_destroy(sim);
+  remove("/tmp/test_planetary.bin");
+
+  // Adding a body after stepping starts a new engine over all three.
+  double pos[3] = { 0, 5.2 * AU, 0 };
+  double vel[3] = { -13070, 0, 0 };
+  double three[9];
+  if (planetary_add_body(split, "jupiter", 1.8982e27, pos, vel) != 0 ||
+      planetary_step(split, 1000, 60) != 0 ||
+      planetary_snapshot(split, NULL, three, NULL) != 0 ||
+      fabs(three[7] / AU - 5.2) > 0.01 || three[6] >= 0) {
+    printf("a body added after stepping doesn't move\n");
+    failed = 1;
+  }
+  planetary_destroy(split);
+
+  for (int i = 0; i < SIMS; i++) {
+    printf("sim %d: earth at %.6f, %.6f AU\n",
+           i, got[i][3] / AU, got[i][4] / AU);
+    planetary_destroy(sims[i]);
+  }
+  printf("%s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,78 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++14 -pthread -o test_snapshot test_snapshot.cc
+
+#include "utils.h"
+#include "snapshot.h"
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using ssm::BodyState;
+using ssm::Snapshot;
+using ssm::SnapshotBuffer;
+
+constexpr size_t BODIES = 1000;
+constexpr size_t READERS = 4;
+constexpr uint64_t EPOCHS = 200000;
+
+std::atomic<bool> writer_done(false);
+std::atomic<size_t> torn(0);
+std::atomic<size_t> reads(0);
+
+// Every value in a published snapshot is derived from the step it was
+// published at. Any mismatch means a reader saw a half written frame.
+static void reader(SnapshotBuffer* buf) {
+  Snapshot snap;
+  uint64_t last_epoch = 0;
+  while (!writer_done) {
+    if (!buf->read(&snap))
+      continue;
+    if (snap.epoch < last_epoch)
+      torn++;
+    last_epoch = snap.epoch;
+    for (size_t i = 0; i < snap.bodies.size(); i++) {
+      double v = 1.0 * snap.step + i;
+      if (snap.bodies[i].pos[0] != v || snap.bodies[i].vel[2] != -v) {
+        torn++;
+        break;
+      }
+    }
+    reads++;
+  }
+}
+
+int main() {
+  SnapshotBuffer buf(BODIES);
+  std::vector<std::thread> threads;
+  uint64_t t;
+
+  for (size_t i = 0; i < READERS; i++) {
+    threads.emplace_back(reader, &buf);
+  }
+
+  t = hrtime();
+  for (uint64_t e = 1; e <= EPOCHS; e++) {
+    BodyState* out = buf.begin(BODIES);
+    for (size_t i = 0; i < BODIES; i++) {
+      double v = 1.0 * e + i;
+      out[i] = { { v, v, v }, { -v, -v, -v } };
+    }
+    buf.commit(e, e);
+  }
+  t = hrtime() - t;
+
+  writer_done = true;
+  for (auto& th : threads) {
+    th.join();
+  }
+
+  printf("%lu epochs   %lu reads   %lu torn\n",
+         buf.epoch(), reads.load(), torn.load());
+  printf("%.2f ns/publish\n", 1.0 * t / EPOCHS);
+
+  bool ok = torn == 0 && buf.epoch() == EPOCHS;
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
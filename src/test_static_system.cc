@@ -0,0 +1,69 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++14 -o test_static_system test_static_system.cc
+
+#include "utils.h"
+#include "nbody.h"
+#include "static_system.h"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+constexpr size_t N = 14;
+constexpr double STEP = 3600;
+constexpr uint64_t STEPS = 24 * 365;
+
+// StaticSystem runs the same scheme over the same pairs as NBody, only with G
+// folded into the masses, so after a year of hourly steps of a sun and 13
+// planets the two should still agree to within rounding.
+int main() {
+  std::mt19937_64 rng(1);
+  std::uniform_real_distribution<double> radius(0.4 * AU, 40 * AU);
+  std::uniform_real_distribution<double> angle(0, 2 * PI);
+  std::uniform_real_distribution<double> mass(1e22, 2e27);
+  double m[N];
+  double pos[N * 3];
+  double vel[N * 3];
+  double acc[N * 3];
+  ssm::StaticSystem<N> fs;
+
+  m[0] = 1.9885e30;
+  for (size_t i = 0; i < N; i++) {
+    double r = i == 0 ? 0 : radius(rng);
+    double t = angle(rng);
+    double v = i == 0 ? 0 : std::sqrt(ssm::NBODY_G * m[0] / r);
+    if (i > 0)
+      m[i] = mass(rng);
+    pos[i * 3] = r * std::cos(t);
+    pos[i * 3 + 1] = r * std::sin(t);
+    pos[i * 3 + 2] = 0;
+    vel[i * 3] = -v * std::sin(t);
+    vel[i * 3 + 1] = v * std::cos(t);
+    vel[i * 3 + 2] = 0;
+    fs.set_gm(i, ssm::NBODY_G * m[i]);
+    fs.pos(i).set(pos[i * 3], pos[i * 3 + 1], pos[i * 3 + 2]);
+    fs.vel(i).set(vel[i * 3], vel[i * 3 + 1], vel[i * 3 + 2]);
+  }
+
+  ssm::NBody nb(N, m, pos, vel, acc);
+  uint64_t t = hrtime();
+  nb.run(STEPS, STEP);
+  uint64_t t_nbody = hrtime() - t;
+  t = hrtime();
+  fs.run(STEPS, STEP);
+  uint64_t t_static = hrtime() - t;
+
+  double worst = 0;
+  for (size_t i = 1; i < N; i++) {
+    const double* p = &pos[i * 3];
+    double r = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+    double d = (fs.pos(i) - ssm::Vector(p[0], p[1], p[2])).len();
+    worst = std::max(worst, d / r);
+  }
+  int failed = !(worst < 1e-12);
+  printf("max relative position difference from NBody: %.3g\n", worst);
+  printf("ns/step: NBody %.1f   StaticSystem %.1f\n",
+         1.0 * t_nbody / STEPS, 1.0 * t_static / STEPS);
+  printf("%s\n", failed ? "FAILED" : "ok");
+  return failed;
+}
@@ -0,0 +1,236 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++14 -o test_trajectory test_trajectory.cc
+
+#include "utils.h"
+#include "trajectory.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using ssm::BodyState;
+using ssm::ColumnarEncoder;
+using ssm::CsvEncoder;
+using ssm::TrajChunk;
+using ssm::TrajectoryFile;
+
+constexpr size_t BODIES = 7;
+constexpr size_t SAMPLES = 10000;
+constexpr size_t CHUNK = 256;
+constexpr double STEP = 60;
+
+static double value(size_t sample, size_t body, size_t comp) {
+  return sample * 1000.0 + body * 10.0 + comp;
+}
+
+static bool write_file(const char* path,
+                       bool with_index,
+                       ssm::TrajCodec codec) {
+  std::vector<std::string> names;
+  std::vector<BodyState> bodies(BODIES);
+  std::vector<char> out;
+  std::vector<char> header;
+
+  for (size_t b = 0; b < BODIES; b++) {
+    names.push_back("body" + std::to_string(b));
+  }
+
+  ColumnarEncoder enc(names, CHUNK, codec);
+  enc.begin(&out);
+  for (size_t i = 0; i < SAMPLES; i++) {
+    for (size_t b = 0; b < BODIES; b++) {
+      bodies[b] = { { value(i, b, 0), value(i, b, 1), value(i, b, 2) },
+                    { value(i, b, 3), value(i, b, 4), value(i, b, 5) } };
+    }
+    enc.encode(i, i * STEP, bodies.data(), &out);
+  }
+  if (with_index) {
+    enc.finish(&out);
+    enc.header(&header);
+    std::copy(header.begin(), header.end(), out.begin());
+  }
+
+  FILE* fp = fopen(path, "wb");
+  if (fp == nullptr)
+    return false;
+  fwrite(out.data(), 1, out.size(), fp);
+  fclose(fp);
+  return true;
+}
+
+static size_t check_file(const char* path) {
+  TrajectoryFile tf;
+  size_t errors = 0;
+  size_t chunk;
+  size_t idx;
+
+  if (tf.open(path) != 0) {
+    printf("%s: can't open\n", path);
+    return 1;
+  }
+  if (tf.bodies() != BODIES || tf.find("body3") != 3)
+    errors++;
+
+  // The unfinished file loses the last partial chunk.
+  size_t expect = tf.header()->index_offset ? SAMPLES : SAMPLES / CHUNK * CHUNK;
+  if (tf.samples() != expect)
+    errors++;
+
+  for (size_t i = 0; i < expect; i += 37) {
+    // Halfway between samples should land on the earlier one.
+    if (!tf.locate(i * STEP + STEP / 2, &chunk, &idx)) {
+      errors++;
+      continue;
+    }
+    const TrajChunk& c = tf.chunk(chunk);
+    if (c.step[idx] != i) {
+      errors++;
+      continue;
+    }
+    for (size_t b = 0; b < BODIES; b++) {
+      BodyState s = c.state(b, idx);
+      if (s.pos[0] != value(i, b, 0) || s.vel[2] != value(i, b, 5) ||
+          c.column(b, ssm::TRAJ_Y)[idx] != value(i, b, 1)) {
+        errors++;
+      }
+    }
+  }
+  if (tf.locate(-1, &chunk, &idx))
+    errors++;
+
+  printf("%s: %lu chunks   %lu samples   %lu errors\n",
+         path, tf.chunks(), tf.samples(), errors);
+  return errors;
+}
+
+static std::vector<char> read_all(const char* path) {
+  std::vector<char> data;
+  FILE* fp = fopen(path, "rb");
+  if (fp == nullptr)
+    return data;
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    data.insert(data.end(), buf, buf + n);
+  }
+  fclose(fp);
+  return data;
+}
+
+static void write_all(const char* path, const std::vector<char>& data) {
+  FILE* fp = fopen(path, "wb");
+  fwrite(data.data(), 1, data.size(), fp);
+  fclose(fp);
+}
+
+// Damaged copies of a finished file are refused or read only as far as
+// they're intact, never read past the end.
+static size_t check_corrupt(const char* path) {
+  const char* bad = "test_trajectory_bad.bin";
+  std::vector<char> data = read_all(path);
+  ssm::TrajFileHeader h;
+  ssm::TrajIndexEntry e;
+  size_t errors = 0;
+  std::memcpy(&h, data.data(), sizeof(h));
+  char* first = data.data() + h.index_offset;
+
+  // An index entry running past the end of the file.
+  std::vector<char> d = data;
+  std::memcpy(&e, first, sizeof(e));
+  e.size = ~uint64_t(0) - e.offset + 64;
+  std::memcpy(d.data() + h.index_offset, &e, sizeof(e));
+  write_all(bad, d);
+  TrajectoryFile tf;
+  if (tf.open(bad) != -EINVAL)
+    errors++;
+
+  // An index entry pointing past the end of the file.
+  d = data;
+  e.offset = data.size();
+  e.size = 64;
+  std::memcpy(d.data() + h.index_offset, &e, sizeof(e));
+  write_all(bad, d);
+  if (tf.open(bad) != -EINVAL)
+    errors++;
+
+  // Cut off partway through the chunks: the index is gone, so the chunks
+  // before the cut are found by walking them.
+  d.assign(data.begin(), data.begin() + h.index_offset / 2);
+  write_all(bad, d);
+  if (tf.open(bad) != 0 || tf.chunks() == 0 ||
+      tf.entry(tf.chunks() - 1).offset + tf.entry(tf.chunks() - 1).size >
+          d.size()) {
+    errors++;
+  }
+  tf.close();
+
+  remove(bad);
+  printf("corrupt: %lu errors\n", errors);
+  return errors;
+}
+
+// Names of any length come out whole.
+static size_t check_csv() {
+  std::vector<std::string> names = { "sun", std::string(300, 'x') };
+  std::vector<BodyState> bodies(2);
+  std::vector<char> out;
+  bodies[1] = { { 1.5, 2, 3 }, { 4, 5, 6.25 } };
+
+  CsvEncoder enc(names);
+  enc.encode(7, 60, bodies.data(), &out);
+  std::string expect = "7,60,sun,0,0,0,0,0,0\n7,60," + names[1] +
+                       ",1.5,2,3,4,5,6.25\n";
+  size_t errors = std::string(out.begin(), out.end()) == expect ? 0 : 1;
+  printf("csv: %lu errors\n", errors);
+  return errors;
+}
+
+// Steps that jump across the whole range, so the deltas and their
+// differences wrap, round trip.
+static size_t check_delta() {
+  const uint64_t in[] = { 0, UINT64_MAX, 0, 1ull << 63, 5, (1ull << 63) - 1,
+                          UINT64_MAX - 3, 2 };
+  const size_t n = sizeof(in) / sizeof(in[0]);
+  uint64_t back[n];
+  std::vector<char> out;
+
+  ssm::delta_encode(in, n, &out);
+  const char* end = ssm::delta_decode(out.data(), out.data() + out.size(),
+                                      n, back);
+  size_t errors = end == out.data() + out.size() &&
+                  std::memcmp(in, back, sizeof(in)) == 0 ? 0 : 1;
+  printf("delta: %lu errors\n", errors);
+  return errors;
+}
+
+int main() {
+  size_t errors = 0;
+
+  errors += check_csv();
+  errors += check_delta();
+
+  if (!write_file("test_trajectory.bin", true, ssm::TRAJ_CODEC_RAW) ||
+      !write_file("test_trajectory_partial.bin", false, ssm::TRAJ_CODEC_RAW) ||
+      !write_file("test_trajectory_delta.bin", true, ssm::TRAJ_CODEC_DELTA)) {
+    printf("can't write test files\n");
+    return 1;
+  }
+
+  uint64_t t = hrtime();
+  errors += check_file("test_trajectory.bin");
+  errors += check_file("test_trajectory_partial.bin");
+  errors += check_file("test_trajectory_delta.bin");
+  t = hrtime() - t;
+  printf("%.2f ms\n", t / 1e6);
+  errors += check_corrupt("test_trajectory.bin");
+
+  remove("test_trajectory.bin");
+  remove("test_trajectory_partial.bin");
+  remove("test_trajectory_delta.bin");
+
+  printf("%s\n", errors == 0 ? "ok" : "FAILED");
+  return errors == 0 ? 0 : 1;
+}
@@ -11,7 +11,41 @@ void print_vector(Vector* v) {
   print_vector(*v);
 }
 
+static_assert(sizeof(ssm::PaddedVector) == 32, "padded to 4 lanes");
+static_assert(alignof(ssm::PaddedVector) == 32, "aligned to its size");
+static_assert(sizeof(ssm::PaddedVectorF) == 16, "padded to 4 lanes");
+static_assert(sizeof(ssm::VectorF) == 12, "unpadded float vector");
+
+// The float and padded forms should give the double result, to float
+// precision for the former. Returns false if they don't.
+template <typename V>
+bool check_variant(const char* name, double tolerance) {
+  V p1(42, 100, 57);
+  V p2(42, 100, 50);
+  V v(1, 2, 3);
+  V a;
+  a = -2 * (p1 - p2) / p1.mag_sq(p2) + v * 0.5;
+  a += v;
+  // The same by hand: p1 - p2 is (0, 0, 7), so mag_sq is 49.
+  const double want[4] = { 1.5, 3, -2.0 * 7 / 49 + 4.5,
+                           std::sqrt(1.5 * 1.5 + 3 * 3 +
+                                     (4.5 - 2.0 / 7) * (4.5 - 2.0 / 7)) };
+  const double got[4] = { a.x(), a.y(), a.z(), a.len() };
+  bool ok = true;
+  for (size_t i = 0; i < 4; i++) {
+    ok = ok && std::fabs(got[i] - want[i]) <= tolerance * std::fabs(want[i]);
+  }
+  std::printf("%-14s x: %.9g   y: %.9g   z: %.9g   len: %.9g   %s\n",
+              name, a.x(), a.y(), a.z(), a.len(), ok ? "ok" : "FAILED");
+  return ok;
+}
+
 int main() {
+  bool ok = check_variant<Vector>("Vector", 1e-15);
+  ok = check_variant<ssm::VectorF>("VectorF", 1e-6) && ok;
+  ok = check_variant<ssm::PaddedVector>("PaddedVector", 1e-15) && ok;
+  ok = check_variant<ssm::PaddedVectorF>("PaddedVectorF", 1e-6) && ok;
+
   Vector* p1 = new Vector(42, 100, 57);
   Vector* p2 = new Vector(42, 100, 50);
   Vector* v1 = new Vector(1, 2, 3);
@@ -29,13 +63,10 @@ int main() {
   for (size_t i = 0; i < ITER; i++) {
     double rsq = p1->mag_sq(p2);
     double r = std::sqrt(rsq);
-    double Fg = -G * rsq * 1e2;
 
     a1->zero();
     a2->zero();
 
-    //*a1 = (*p1 - *p2) * r * Fg;
-    //*a2 = (*p2 - *p1) * r * Fg;
     *a1 = -G * M * (*p1 - *p2) / (rsq * r);
     *a2 = -G * M * (*p2 - *p1) / (rsq * r);
 
@@ -59,9 +90,8 @@ int main() {
   print_vector(a2);
   printf("%lu ns/iter\n", hrt / ITER);
 
-
-
-  return 0;
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
 }
 
   /*
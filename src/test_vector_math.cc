@@ -1,68 +1,88 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++17 -o test_vector_math test_vector_math.cc
+
 #include "utils.h"
 #include "vector-math.h"
+
+#include <cmath>
 #include <cstdio>
+#include <type_traits>
 
+static_assert(std::is_same<Vector, ssm::Vector>::value,
+              "vector-math.h's Vector is ssm::Vector");
 
 void print_vector(const Vector& v) {
   std::printf("x: %g   y: %g   z: %g\n", v.x(), v.y(), v.z());
 }
-void print_vector(Vector* v) {
-  print_vector(*v);
+
+static bool close(const Vector& v, const double* d) {
+  for (size_t k = 0; k < 3; k++) {
+    if (std::fabs(v[k] - d[k]) > 1e-12 * std::fabs(d[k]))
+      return false;
+  }
+  return true;
 }
 
 int main() {
-  Vector* p1 = new Vector(42, 100, 57);
-  Vector* p2 = new Vector(42, 100, 50);
-  Vector* v1 = new Vector(1, 2, 3);
-  Vector* v2 = new Vector(4, 5, 6);
-  Vector* a1 = new Vector(0, 0, 0);
-  Vector* a2 = new Vector(0, 0, 0);
+  Vector p1(42, 100, 57);
+  Vector p2(42, 100, 50);
+  Vector v1(1, 2, 3);
+  Vector v2(4, 5, 6);
+  Vector a1;
+  Vector a2;
+  // The same two bodies written out by hand.
+  double q1[3] = { 42, 100, 57 };
+  double q2[3] = { 42, 100, 50 };
+  double w1[3] = { 1, 2, 3 };
+  double w2[3] = { 4, 5, 6 };
+  double b1[3];
+  double b2[3];
   size_t ITER = 1e6;
-  double t = 1;
+  double t = 1e-3;
+  double M = 1e9;
   uint64_t hrt = hrtime();
 
-  //printf("p1.dot(p2): %g\n", p1->dot(p2));
-  //printf("angle_rad: %g   angle_deg: %g\n", p1->angle_rad(p2), p1->angle_deg(p2));
-
   for (size_t i = 0; i < ITER; i++) {
-    double rsq = p1->mag_sq(p2);
+    // The pointer overloads the old class had still work.
+    double rsq = p1.mag_sq(&p2);
     double r = std::sqrt(rsq);
-    double Fg = -G * rsq * 1e2;
-
-    a1->zero();
-    a2->zero();
 
-    /*
-    *a1 = (*p1 - *p2) * r * Fg;
-    *a2 = (*p2 - *p1) * r * Fg;
-    *p1 = *v1 * t + *a1 * t * t / 2;
-    *p2 = *v2 * t + *a2 * t * t / 2;
-    *v1 = *a1 * t;
-    *v2 = *a2 * t;
-    */
+    a1.zero();
+    a2.zero();
+    a1 += -G * M * (p1 - p2) / (rsq * r);
+    a2 += -G * M * (p2 - p1) / (rsq * r);
+    p1 += v1 * t + a1 * t * t / 2;
+    p2 += v2 * t + a2 * t * t / 2;
+    v1 += a1 * t;
+    v2 += a2 * t;
   }
 
   hrt = hrtime() - hrt;
 
-  //print_vector(p1);
-  //print_vector(p2);
-  //print_vector(v1);
-  //print_vector(v2);
-  //print_vector(a1);
-  //print_vector(a2);
-  printf("%lu ns/iter\n", hrt / ITER);
-
-
-
-  return 0;
-}
+  for (size_t i = 0; i < ITER; i++) {
+    double d[3];
+    for (size_t k = 0; k < 3; k++) {
+      d[k] = q1[k] - q2[k];
+    }
+    double rsq = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    double r = std::sqrt(rsq);
+    for (size_t k = 0; k < 3; k++) {
+      b1[k] = -G * M * d[k] / (rsq * r);
+      b2[k] = -G * M * -d[k] / (rsq * r);
+      q1[k] += w1[k] * t + b1[k] * t * t / 2;
+      q2[k] += w2[k] * t + b2[k] * t * t / 2;
+      w1[k] += b1[k] * t;
+      w2[k] += b2[k] * t;
+    }
+  }
 
-  /*
   print_vector(p1);
   print_vector(p2);
   print_vector(v1);
   print_vector(v2);
-  print_vector(a1);
-  print_vector(a2);
-  */
+  printf("%lu ns/iter\n", hrt / ITER);
 
+  bool ok = close(p1, q1) && close(p2, q2) && close(v1, w1) && close(v2, w2);
+  printf("%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
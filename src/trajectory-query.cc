@@ -0,0 +1,123 @@
+// Built with:
+//  clang++ -O2 -Wall -std=c++14 -o trajectory-query src/trajectory-query.cc
+//
+// Print body states straight out of a columnar trajectory file, either at a
+// single epoch or over a time range, without reading the rest of the file.
+
+#include "deps/cxxopts.h"
+#include "trajectory.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+using ssm::BodyState;
+using ssm::TrajChunk;
+using ssm::TrajectoryFile;
+using std::string;
+
+#define AU 149597870700
+
+cxxopts::Options* retrieve_options() {
+  auto options = new cxxopts::Options(
+      "trajectory-query", "Read body states from a columnar trajectory file");
+  options->add_options()
+    ("f,file", "trajectory file", cxxopts::value<string>())
+    ("h,help", "print help")
+    ("b,body",
+     "only print this body",
+     cxxopts::value<string>()->default_value(""))
+    ("t,time",
+     "print the last sample at or before this time, in seconds",
+     cxxopts::value<double>()->default_value("0"))
+    ("to",
+     "print every sample from --time up to this time",
+     cxxopts::value<double>()->default_value("-1"))
+    ("i,info", "print a summary of the file");
+  return options;
+}
+
+
+static void print_state(const TrajectoryFile& tf,
+                        const TrajChunk& c,
+                        size_t idx,
+                        long body) {
+  printf("iter: %lu   time: %.17g\n", c.step[idx], c.time[idx]);
+  for (size_t b = 0; b < tf.bodies(); b++) {
+    if (body >= 0 && static_cast<size_t>(body) != b)
+      continue;
+    BodyState s = c.state(b, idx);
+    printf("[%s]\n", tf.name(b).c_str());
+    printf("  [position]  x: %-14.7f y: %-14.7f z: %.7f\n",
+           s.pos[0] / AU, s.pos[1] / AU, s.pos[2] / AU);
+    printf("  [velocity]  x: %-14.7f y: %-14.7f z: %.7f\n",
+           s.vel[0], s.vel[1], s.vel[2]);
+  }
+}
+
+
+int main(int argc, char* argv[]) {
+  cxxopts::Options* options = retrieve_options();
+  auto result = options->parse(argc, argv);
+  TrajectoryFile tf;
+  long body = -1;
+  size_t chunk;
+  size_t idx;
+  int err;
+
+  if (result.count("help") || !result.count("file")) {
+    printf("%s", options->help({""}).c_str());
+    return result.count("help") ? 0 : 1;
+  }
+
+  string path = result["file"].as<string>();
+  string name = result["body"].as<string>();
+  double from = result["time"].as<double>();
+  double to = result["to"].as<double>();
+  delete options;
+
+  err = tf.open(path.c_str());
+  if (err != 0) {
+    fprintf(stderr, "can't open '%s': %s\n", path.c_str(), strerror(-err));
+    return 1;
+  }
+
+  if (result.count("info")) {
+    printf("%lu bodies   %lu samples   %lu chunks\n",
+           tf.bodies(), tf.samples(), tf.chunks());
+    if (tf.chunks() > 0) {
+      printf("time: %.17g to %.17g\n",
+             tf.entry(0).t0, tf.entry(tf.chunks() - 1).t1);
+    }
+    return 0;
+  }
+
+  if (!name.empty()) {
+    body = tf.find(name);
+    if (body < 0) {
+      fprintf(stderr, "no body named '%s'\n", name.c_str());
+      return 1;
+    }
+  }
+
+  if (!tf.locate(from, &chunk, &idx)) {
+    fprintf(stderr, "no sample at or before %.17g\n", from);
+    return 1;
+  }
+
+  if (to < from) {
+    print_state(tf, tf.chunk(chunk), idx, body);
+    return 0;
+  }
+
+  for (; chunk < tf.chunks(); chunk++, idx = 0) {
+    const TrajChunk& c = tf.chunk(chunk);
+    for (; idx < c.count && c.time[idx] <= to; idx++) {
+      print_state(tf, c, idx, body);
+    }
+    if (idx < c.count)
+      break;
+  }
+
+  return 0;
+}
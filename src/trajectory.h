@@ -0,0 +1,559 @@
+#ifndef TRAJECTORY_H_
+#define TRAJECTORY_H_
+
+#include "delta_codec.h"
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace ssm {
+
+// Turns a stream of samples into file bytes. Every byte of the file comes out
+// of an encoder in order, except for header(), which is rewritten at offset 0
+// once the stream is finished.
+class TrajectoryEncoder {
+ public:
+  virtual ~TrajectoryEncoder() { }
+  virtual void begin(std::vector<char>* out) = 0;
+  virtual void encode(uint64_t step,
+                      double time,
+                      const BodyState* bodies,
+                      std::vector<char>* out) = 0;
+  virtual void finish(std::vector<char>* out) = 0;
+  // Final version of the file header. Returns false if there's nothing to
+  // rewrite.
+  virtual bool header(std::vector<char>*) { return false; }
+};
+
+
+// One line of text per body per sample.
+class CsvEncoder : public TrajectoryEncoder {
+ public:
+  explicit CsvEncoder(const std::vector<std::string>& names) : names_(names) { }
+
+  void begin(std::vector<char>* out) override {
+    static const char h[] = "iter,time,body,x,y,z,vx,vy,vz\n";
+    out->insert(out->end(), h, h + sizeof(h) - 1);
+  }
+
+  void encode(uint64_t step,
+              double time,
+              const BodyState* bodies,
+              std::vector<char>* out) override {
+    for (size_t i = 0; i < names_.size(); i++) {
+      const BodyState& b = bodies[i];
+      // Formatted in place. Room for the numbers plus the name is reserved
+      // first, and a line that still doesn't fit is written again.
+      size_t at = out->size();
+      size_t room = 256 + names_[i].size();
+      for (;;) {
+        out->resize(at + room);
+        int n = snprintf(out->data() + at, room,
+                         "%lu,%.17g,%s,%.17g,%.17g,%.17g,%.17g,%.17g,%.17g\n",
+                         step,
+                         time,
+                         names_[i].c_str(),
+                         b.pos[0], b.pos[1], b.pos[2],
+                         b.vel[0], b.vel[1], b.vel[2]);
+        if (n < 0) {
+          out->resize(at);
+          break;
+        }
+        if (static_cast<size_t>(n) < room) {
+          out->resize(at + n);
+          break;
+        }
+        room = n + 1;
+      }
+    }
+  }
+
+  void finish(std::vector<char>*) override { }
+
+ private:
+  std::vector<std::string> names_;
+};
+
+
+// Columnar binary trajectory. Layout:
+//
+//   TrajFileHeader
+//   name_offsets[bodies + 1]   uint64_t
+//   names                      char data, padded to 8 bytes
+//   chunk...
+//   TrajIndexEntry[chunk_count]
+//
+// Each chunk holds up to chunk_samples samples:
+//
+//   TrajChunkHeader
+//   step[count]                uint64_t
+//   time[count]                double
+//   column[bodies][6][count]   double   x y z vx vy vz per body
+//
+// or, when the chunk's codec is TRAJ_CODEC_DELTA, the same columns each run
+// through delta_encode() (see delta_codec.h):
+//
+//   TrajChunkHeader
+//   offsets[2 + bodies * 6 + 1]   uint64_t, from the start of the chunk
+//   step stream, time stream, column streams...
+//
+// The index at the end maps every chunk to its offset and time range, so a
+// reader can binary search straight to any epoch and then read only the
+// columns of the bodies it wants. If the writer never finished (index_offset
+// is 0) the chunks can still be found by walking their headers.
+struct TrajFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t bodies;
+  uint64_t chunk_samples;
+  uint64_t first_chunk;
+  uint64_t index_offset;
+  uint64_t index_count;
+  uint64_t reserved[3];
+};
+
+struct TrajChunkHeader {
+  uint32_t magic;
+  uint32_t codec;      // TRAJ_CODEC_*
+  uint64_t count;      // Samples in the chunk.
+  uint64_t size;       // Bytes, including this header.
+  uint64_t step0;
+  double t0;
+  double t1;
+};
+
+struct TrajIndexEntry {
+  uint64_t offset;
+  uint64_t size;
+  uint64_t count;
+  uint64_t step0;
+  double t0;
+  double t1;
+};
+
+static_assert(sizeof(TrajFileHeader) == 80, "trajectory header size");
+static_assert(sizeof(TrajChunkHeader) == 48, "trajectory chunk header size");
+static_assert(sizeof(TrajIndexEntry) == 48, "trajectory index entry size");
+
+constexpr char TRAJ_MAGIC[8] = { 'S', 'S', 'M', 'T', 'R', 'A', 'J', 0 };
+constexpr uint32_t TRAJ_VERSION = 1;
+constexpr uint32_t TRAJ_CHUNK_MAGIC = 0x4b4e4843;  // "CHNK"
+constexpr size_t TRAJ_COMPONENTS = 6;
+
+enum TrajComponent { TRAJ_X, TRAJ_Y, TRAJ_Z, TRAJ_VX, TRAJ_VY, TRAJ_VZ };
+
+enum TrajCodec { TRAJ_CODEC_RAW = 0, TRAJ_CODEC_DELTA = 1 };
+
+
+class ColumnarEncoder : public TrajectoryEncoder {
+ public:
+  ColumnarEncoder(const std::vector<std::string>& names,
+                  size_t chunk_samples = 1024,
+                  TrajCodec codec = TRAJ_CODEC_RAW)
+    : names_(names),
+      codec_(codec),
+      chunk_samples_(chunk_samples),
+      steps_(chunk_samples),
+      times_(chunk_samples),
+      cols_(names.size() * TRAJ_COMPONENTS * chunk_samples) { }
+
+  void begin(std::vector<char>* out) override {
+    std::vector<uint64_t> offsets(names_.size() + 1);
+    std::string blob;
+    offsets[0] = 0;
+    for (size_t i = 0; i < names_.size(); i++) {
+      blob += names_[i];
+      offsets[i + 1] = blob.size();
+    }
+    blob.resize((blob.size() + 7) & ~size_t(7));
+    first_chunk_ = sizeof(TrajFileHeader) +
+                   offsets.size() * sizeof(uint64_t) +
+                   blob.size();
+    header(out);
+    append(out, offsets.data(), offsets.size() * sizeof(uint64_t));
+    append(out, blob.data(), blob.size());
+    written_ = first_chunk_;
+  }
+
+  void encode(uint64_t step,
+              double time,
+              const BodyState* bodies,
+              std::vector<char>* out) override {
+    size_t n = count_;
+    steps_[n] = step;
+    times_[n] = time;
+    for (size_t b = 0; b < names_.size(); b++) {
+      double* col = &cols_[b * TRAJ_COMPONENTS * chunk_samples_];
+      col[TRAJ_X * chunk_samples_ + n] = bodies[b].pos[0];
+      col[TRAJ_Y * chunk_samples_ + n] = bodies[b].pos[1];
+      col[TRAJ_Z * chunk_samples_ + n] = bodies[b].pos[2];
+      col[TRAJ_VX * chunk_samples_ + n] = bodies[b].vel[0];
+      col[TRAJ_VY * chunk_samples_ + n] = bodies[b].vel[1];
+      col[TRAJ_VZ * chunk_samples_ + n] = bodies[b].vel[2];
+    }
+    if (++count_ == chunk_samples_)
+      flush(out);
+  }
+
+  void finish(std::vector<char>* out) override {
+    if (count_ > 0)
+      flush(out);
+    index_offset_ = written_;
+    append(out, index_.data(), index_.size() * sizeof(TrajIndexEntry));
+  }
+
+  bool header(std::vector<char>* out) override {
+    TrajFileHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, TRAJ_MAGIC, sizeof(h.magic));
+    h.version = TRAJ_VERSION;
+    h.bodies = names_.size();
+    h.chunk_samples = chunk_samples_;
+    h.first_chunk = first_chunk_;
+    h.index_offset = index_offset_;
+    h.index_count = index_offset_ > 0 ? index_.size() : 0;
+    append(out, &h, sizeof(h));
+    return true;
+  }
+
+ private:
+  // Write the count_ buffered samples as one chunk.
+  void flush(std::vector<char>* out) {
+    TrajChunkHeader ch;
+    size_t n = count_;
+    size_t ncols = names_.size() * TRAJ_COMPONENTS;
+    size_t start = out->size();
+
+    std::memset(&ch, 0, sizeof(ch));
+    ch.magic = TRAJ_CHUNK_MAGIC;
+    ch.codec = codec_;
+    ch.count = n;
+    ch.step0 = steps_[0];
+    ch.t0 = times_[0];
+    ch.t1 = times_[n - 1];
+    append(out, &ch, sizeof(ch));
+
+    if (codec_ == TRAJ_CODEC_DELTA) {
+      // Offsets are filled in once each stream's length is known.
+      size_t table = out->size();
+      std::vector<uint64_t> offsets;
+      out->resize(table + (2 + ncols + 1) * sizeof(uint64_t));
+      offsets.push_back(out->size() - start);
+      delta_encode(steps_.data(), n, out);
+      offsets.push_back(out->size() - start);
+      delta_encode(times_.data(), n, out);
+      for (size_t c = 0; c < ncols; c++) {
+        offsets.push_back(out->size() - start);
+        delta_encode(&cols_[c * chunk_samples_], n, out);
+      }
+      offsets.push_back(out->size() - start);
+      std::memcpy(out->data() + table,
+                  offsets.data(),
+                  offsets.size() * sizeof(uint64_t));
+      // Pad to 8 bytes so the next chunk's header stays aligned.
+      out->resize(start + ((out->size() - start + 7) & ~size_t(7)));
+    } else {
+      append(out, steps_.data(), n * sizeof(uint64_t));
+      append(out, times_.data(), n * sizeof(double));
+      for (size_t c = 0; c < ncols; c++) {
+        append(out, &cols_[c * chunk_samples_], n * sizeof(double));
+      }
+    }
+
+    ch.size = out->size() - start;
+    std::memcpy(out->data() + start, &ch, sizeof(ch));
+    index_.push_back({ written_, ch.size, ch.count, ch.step0, ch.t0, ch.t1 });
+    written_ += ch.size;
+    count_ = 0;
+  }
+
+  static inline void append(std::vector<char>* out, const void* p, size_t n) {
+    const char* c = static_cast<const char*>(p);
+    out->insert(out->end(), c, c + n);
+  }
+
+  std::vector<std::string> names_;
+  TrajCodec codec_;
+  size_t chunk_samples_;
+  size_t count_ = 0;
+  std::vector<uint64_t> steps_;
+  std::vector<double> times_;
+  // [body][component][sample], chunk_samples_ wide.
+  std::vector<double> cols_;
+  std::vector<TrajIndexEntry> index_;
+  uint64_t first_chunk_ = 0;
+  uint64_t written_ = 0;
+  uint64_t index_offset_ = 0;
+};
+
+
+// Decoded view of a single chunk. Pointers are valid until the next call to
+// TrajectoryFile::chunk(). For raw chunks they point straight into the
+// mapping; compressed chunks are decoded into a buffer owned by the reader.
+struct TrajChunk {
+  size_t count = 0;
+  size_t bodies = 0;
+  const uint64_t* step = nullptr;
+  const double* time = nullptr;
+  const double* cols = nullptr;
+
+  inline const double* column(size_t body, TrajComponent c) const {
+    return cols + (body * TRAJ_COMPONENTS + c) * count;
+  }
+
+  inline BodyState state(size_t body, size_t i) const {
+    const double* col = cols + body * TRAJ_COMPONENTS * count;
+    return { { col[i], col[count + i], col[count * 2 + i] },
+             { col[count * 3 + i], col[count * 4 + i], col[count * 5 + i] } };
+  }
+};
+
+
+// Memory mapped, random access reader for columnar trajectory files.
+class TrajectoryFile {
+ public:
+  TrajectoryFile() { }
+  ~TrajectoryFile() { close(); }
+
+  TrajectoryFile(const TrajectoryFile&) = delete;
+  TrajectoryFile& operator=(const TrajectoryFile&) = delete;
+
+  // Returns 0, a negative errno, or -EINVAL if the file isn't valid.
+  int open(const char* path) {
+    struct stat st;
+    int fd;
+
+    close();
+    fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+      return -errno;
+    if (::fstat(fd, &st) != 0) {
+      int err = -errno;
+      ::close(fd);
+      return err;
+    }
+    if (static_cast<size_t>(st.st_size) < sizeof(TrajFileHeader)) {
+      ::close(fd);
+      return -EINVAL;
+    }
+    void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+      return -errno;
+    base_ = static_cast<const char*>(addr);
+    size_ = st.st_size;
+
+    const TrajFileHeader* h = header();
+    if (std::memcmp(h->magic, TRAJ_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != TRAJ_VERSION ||
+        h->first_chunk > size_ ||
+        h->bodies >= size_ / sizeof(uint64_t) ||
+        sizeof(TrajFileHeader) + (h->bodies + 1) * sizeof(uint64_t) >
+            h->first_chunk ||
+        !valid_names()) {
+      close();
+      return -EINVAL;
+    }
+    if (h->index_offset != 0 &&
+        h->index_offset <= size_ &&
+        h->index_count <=
+            (size_ - h->index_offset) / sizeof(TrajIndexEntry)) {
+      const TrajIndexEntry* e =
+          reinterpret_cast<const TrajIndexEntry*>(base_ + h->index_offset);
+      index_.assign(e, e + h->index_count);
+      for (auto& entry : index_) {
+        if (!valid_chunk(entry.offset, entry.size) ||
+            chunk_header(entry.offset)->count != entry.count) {
+          close();
+          return -EINVAL;
+        }
+      }
+    } else {
+      scan();
+    }
+    for (auto& e : index_) {
+      samples_ += e.count;
+    }
+    return 0;
+  }
+
+  void close() {
+    if (base_ != nullptr)
+      ::munmap(const_cast<char*>(base_), size_);
+    base_ = nullptr;
+    size_ = 0;
+    samples_ = 0;
+    current_index_ = -1;
+    index_.clear();
+  }
+
+  inline const TrajFileHeader* header() const {
+    return reinterpret_cast<const TrajFileHeader*>(base_);
+  }
+  inline size_t bodies() const { return header()->bodies; }
+  inline size_t chunks() const { return index_.size(); }
+  inline size_t samples() const { return samples_; }
+  inline const TrajIndexEntry& entry(size_t i) const { return index_[i]; }
+
+  inline std::string name(size_t i) const {
+    const uint64_t* off = name_offsets();
+    const char* names = reinterpret_cast<const char*>(off + bodies() + 1);
+    return std::string(names + off[i], off[i + 1] - off[i]);
+  }
+
+  // Index of the body called name, or -1.
+  long find(const std::string& name) const {
+    for (size_t i = 0; i < bodies(); i++) {
+      if (this->name(i) == name)
+        return i;
+    }
+    return -1;
+  }
+
+  // Locate the last sample at or before time. Returns false if time is before
+  // the first sample.
+  bool locate(double time, size_t* chunk, size_t* sample) {
+    auto it = std::upper_bound(
+        index_.begin(), index_.end(), time,
+        [](double t, const TrajIndexEntry& e) { return t < e.t0; });
+    if (it == index_.begin())
+      return false;
+    *chunk = it - index_.begin() - 1;
+    const TrajChunk& c = this->chunk(*chunk);
+    *sample = std::upper_bound(c.time, c.time + c.count, time) - c.time - 1;
+    return true;
+  }
+
+  // Decode chunk i. Raw chunks are returned in place, without copying. A
+  // corrupt compressed chunk comes back with a count of 0.
+  const TrajChunk& chunk(size_t i) {
+    const TrajIndexEntry& e = index_[i];
+    const TrajChunkHeader* ch = chunk_header(e.offset);
+    const char* p = base_ + e.offset + sizeof(TrajChunkHeader);
+    if (current_index_ == i && current_.count > 0)
+      return current_;
+    current_index_ = i;
+    current_.count = ch->count;
+    current_.bodies = bodies();
+    if (ch->codec == TRAJ_CODEC_DELTA) {
+      if (!decode(ch))
+        current_.count = 0;
+      return current_;
+    }
+    current_.step = reinterpret_cast<const uint64_t*>(p);
+    current_.time = reinterpret_cast<const double*>(
+        p + ch->count * sizeof(uint64_t));
+    current_.cols = current_.time + ch->count;
+    return current_;
+  }
+
+ private:
+  bool decode(const TrajChunkHeader* ch) {
+    const char* base = reinterpret_cast<const char*>(ch);
+    const char* end = base + ch->size;
+    const uint64_t* off =
+        reinterpret_cast<const uint64_t*>(base + sizeof(TrajChunkHeader));
+    size_t n = ch->count;
+    size_t ncols = bodies() * TRAJ_COMPONENTS;
+
+    if (sizeof(TrajChunkHeader) + (ncols + 3) * sizeof(uint64_t) > ch->size)
+      return false;
+    for (size_t c = 0; c < ncols + 3; c++) {
+      if (off[c] > ch->size)
+        return false;
+    }
+    steps_.resize(n);
+    // Time and body columns share one buffer to match the raw layout.
+    values_.resize(n * (1 + ncols));
+    if (delta_decode(base + off[0], end, n, steps_.data()) == nullptr)
+      return false;
+    for (size_t c = 0; c < ncols + 1; c++) {
+      if (delta_decode(base + off[c + 1], end, n, &values_[c * n]) == nullptr)
+        return false;
+    }
+    current_.step = steps_.data();
+    current_.time = values_.data();
+    current_.cols = values_.data() + n;
+    return true;
+  }
+
+  // Rebuild the chunk index by walking chunk headers, for files whose writer
+  // never got to write the index.
+  void scan() {
+    uint64_t off = header()->first_chunk;
+    while (off + sizeof(TrajChunkHeader) <= size_) {
+      const TrajChunkHeader* ch = chunk_header(off);
+      if (!valid_chunk(off, ch->size))
+        break;
+      index_.push_back({ off, ch->size, ch->count, ch->step0, ch->t0, ch->t1 });
+      off += ch->size;
+    }
+  }
+
+  inline const uint64_t* name_offsets() const {
+    return reinterpret_cast<const uint64_t*>(base_ + sizeof(TrajFileHeader));
+  }
+
+  inline const TrajChunkHeader* chunk_header(uint64_t offset) const {
+    return reinterpret_cast<const TrajChunkHeader*>(base_ + offset);
+  }
+
+  // Whether the name offsets ascend and stay before the first chunk.
+  bool valid_names() const {
+    const uint64_t* off = name_offsets();
+    size_t n = bodies();
+    uint64_t room = header()->first_chunk - sizeof(TrajFileHeader) -
+                    (n + 1) * sizeof(uint64_t);
+    for (size_t i = 0; i < n; i++) {
+      if (off[i] > off[i + 1])
+        return false;
+    }
+    return off[0] == 0 && off[n] <= room;
+  }
+
+  // Whether size bytes at offset lie within the chunks, written without
+  // overflow, and hold a chunk header that agrees with them and, for a raw
+  // chunk, room for all its columns. decode() checks delta streams.
+  bool valid_chunk(uint64_t offset, uint64_t size) const {
+    if (offset < header()->first_chunk ||
+        offset > size_ ||
+        size > size_ - offset ||
+        size < sizeof(TrajChunkHeader)) {
+      return false;
+    }
+    const TrajChunkHeader* ch = chunk_header(offset);
+    if (ch->magic != TRAJ_CHUNK_MAGIC || ch->size != size)
+      return false;
+    if (ch->codec == TRAJ_CODEC_DELTA)
+      return true;
+    if (ch->codec != TRAJ_CODEC_RAW)
+      return false;
+    uint64_t row = (2 + bodies() * TRAJ_COMPONENTS) * sizeof(double);
+    return ch->count <= (size - sizeof(TrajChunkHeader)) / row;
+  }
+
+  const char* base_ = nullptr;
+  size_t size_ = 0;
+  size_t samples_ = 0;
+  std::vector<TrajIndexEntry> index_;
+  TrajChunk current_;
+  size_t current_index_ = -1;
+  std::vector<uint64_t> steps_;
+  std::vector<double> values_;
+};
+
+}  // namespace ssm
+
+#endif  // TRAJECTORY_H_
@@ -0,0 +1,291 @@
+#ifndef TRAJECTORY_WRITER_H_
+#define TRAJECTORY_WRITER_H_
+
+#include "ring_buffer.h"
+#include "snapshot.h"
+#include "trajectory.h"
+
+#include <uv.h>
+#include <fcntl.h>
+
+#include <atomic>
+#include <cerrno>
+#include <memory>
+#include <vector>
+
+namespace ssm {
+
+// Streams sampled body states to a file without the integrator ever waiting
+// on disk. The integrator fills preallocated frames and hands them to a libuv
+// loop running on its own thread. The loop encodes frames into large chunks
+// and writes them with uv_fs_write. When every frame is in flight (disk can't
+// keep up) begin() returns nullptr and the sample is counted as dropped.
+class TrajectoryWriter {
+ public:
+  // bodies - number of bodies in every frame.
+  // encoder - output format, owned by the writer from here on.
+  // depth - number of frames that can be queued between integrator and disk.
+  // chunk_size - bytes to buffer before issuing a write.
+  TrajectoryWriter(size_t bodies,
+                   TrajectoryEncoder* encoder,
+                   size_t depth = 64,
+                   size_t chunk_size = 1 << 20)
+    : encoder_(encoder),
+      chunk_size_(chunk_size),
+      frames_(depth),
+      free_(depth),
+      full_(depth),
+      writes_(kMaxWrites) {
+    for (auto& f : frames_) {
+      f.bodies.resize(bodies);
+      free_.push(&f);
+    }
+    for (auto& w : writes_) {
+      w.self = this;
+      w.data.reserve(chunk_size_);
+      free_writes_.push_back(&w);
+    }
+  }
+
+  ~TrajectoryWriter() { stop(); }
+
+  TrajectoryWriter(const TrajectoryWriter&) = delete;
+  TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+  // Open (and truncate) path and start the loop thread. Returns 0 or a libuv
+  // error code.
+  int start(const char* path) {
+    uv_fs_t req;
+    int err;
+
+    err = uv_loop_init(&loop_);
+    if (err)
+      return err;
+    fd_ = uv_fs_open(nullptr, &req, path, O_WRONLY | O_CREAT | O_TRUNC, 0644,
+                     nullptr);
+    uv_fs_req_cleanup(&req);
+    if (fd_ < 0) {
+      uv_loop_close(&loop_);
+      return fd_;
+    }
+    async_.data = this;
+    uv_async_init(&loop_, &async_, on_async);
+    err = uv_thread_create(&thread_, run, this);
+    if (err) {
+      uv_close(reinterpret_cast<uv_handle_t*>(&async_), nullptr);
+      uv_run(&loop_, UV_RUN_DEFAULT);
+      uv_loop_close(&loop_);
+      uv_fs_close(nullptr, &req, fd_, nullptr);
+      uv_fs_req_cleanup(&req);
+      return err;
+    }
+    running_ = true;
+    return 0;
+  }
+
+  // Integrator: storage for the next sample, or nullptr if the queue is full
+  // and the sample has to be dropped.
+  inline BodyState* begin() {
+    if (!free_.pop(&pending_)) {
+      dropped_++;
+      return nullptr;
+    }
+    return pending_->bodies.data();
+  }
+
+  // Integrator: hand the frame returned by begin() to the loop thread.
+  inline void commit(uint64_t step, double time) {
+    pending_->step = step;
+    pending_->time = time;
+    full_.push(pending_);
+    pending_ = nullptr;
+    uv_async_send(&async_);
+  }
+
+  // Flush everything that's been committed, close the file and join the loop
+  // thread. Returns the first write error seen, or 0.
+  int stop() {
+    if (!running_)
+      return error_;
+    running_ = false;
+    stopping_ = true;
+    uv_async_send(&async_);
+    uv_thread_join(&thread_);
+    uv_loop_close(&loop_);
+    return error_;
+  }
+
+  inline uint64_t written() const { return written_.load(); }
+  inline uint64_t dropped() const { return dropped_; }
+  inline uint64_t bytes() const { return offset_; }
+
+ private:
+  // Bound on chunks being written at once. Once they're all in flight frames
+  // stay queued, and when those run out the integrator starts dropping.
+  static constexpr size_t kMaxWrites = 4;
+
+  struct Frame {
+    uint64_t step = 0;
+    double time = 0;
+    std::vector<BodyState> bodies;
+  };
+
+  struct WriteReq {
+    uv_fs_t req;
+    uv_buf_t buf;
+    // File offset of what's left of buf.
+    int64_t offset;
+    TrajectoryWriter* self;
+    std::vector<char> data;
+  };
+
+  static void run(void* arg) {
+    TrajectoryWriter* self = static_cast<TrajectoryWriter*>(arg);
+    uv_run(&self->loop_, UV_RUN_DEFAULT);
+  }
+
+  static void on_async(uv_async_t* handle) {
+    static_cast<TrajectoryWriter*>(handle->data)->drain();
+  }
+
+  static void on_write(uv_fs_t* req) {
+    WriteReq* w = reinterpret_cast<WriteReq*>(req);
+    TrajectoryWriter* self = w->self;
+    ssize_t r = req->result;
+    uv_fs_req_cleanup(req);
+    // A short write goes on from where it stopped. One that wrote nothing
+    // would never finish.
+    if (r > 0 && static_cast<size_t>(r) < w->buf.len) {
+      w->buf.base += r;
+      w->buf.len -= r;
+      w->offset += r;
+      uv_fs_write(&self->loop_, &w->req, self->fd_, &w->buf, 1, w->offset,
+                  on_write);
+      return;
+    }
+    if (r == 0 && w->buf.len > 0)
+      r = -EIO;
+    if (r < 0 && self->error_ == 0)
+      self->error_ = r;
+    self->outstanding_--;
+    self->free_writes_.push_back(w);
+    self->drain();
+  }
+
+  // Move queued frames into the current chunk. A partly filled chunk is only
+  // written when the disk is idle, so frames arriving while a write is in
+  // flight get batched into the next one.
+  void drain() {
+    Frame* f;
+    while (true) {
+      if (current_ == nullptr) {
+        if (free_writes_.empty())
+          break;
+        current_ = free_writes_.back();
+        free_writes_.pop_back();
+        current_->data.clear();
+      }
+      if (!began_) {
+        encoder_->begin(&current_->data);
+        began_ = true;
+      }
+      if (!full_.pop(&f))
+        break;
+      encoder_->encode(f->step, f->time, f->bodies.data(), &current_->data);
+      free_.push(f);
+      written_++;
+      if (current_->data.size() >= chunk_size_)
+        flush();
+    }
+    if (current_ != nullptr &&
+        !current_->data.empty() &&
+        (outstanding_ == 0 || stopping_)) {
+      flush();
+    }
+    maybe_finish();
+  }
+
+  void flush() {
+    WriteReq* w = current_;
+    current_ = nullptr;
+    w->buf = uv_buf_init(w->data.data(), w->data.size());
+    w->offset = offset_;
+    uv_fs_write(&loop_, &w->req, fd_, &w->buf, 1, offset_, on_write);
+    offset_ += w->data.size();
+    outstanding_++;
+  }
+
+  // Once everything is written let the encoder emit its trailer, then rewrite
+  // the header (the trailer's offset usually lives there) and close up.
+  void maybe_finish() {
+    if (!stopping_ || outstanding_ > 0 || !full_.empty())
+      return;
+    if (current_ != nullptr && !current_->data.empty())
+      return;
+    if (!finished_) {
+      finished_ = true;
+      if (current_ == nullptr) {
+        current_ = free_writes_.back();
+        free_writes_.pop_back();
+        current_->data.clear();
+      }
+      if (!began_) {
+        encoder_->begin(&current_->data);
+        began_ = true;
+      }
+      encoder_->finish(&current_->data);
+      if (!current_->data.empty()) {
+        flush();
+        return;
+      }
+    }
+    if (fd_ >= 0) {
+      uv_fs_t req;
+      std::vector<char> header;
+      if (encoder_->header(&header)) {
+        uv_buf_t buf = uv_buf_init(header.data(), header.size());
+        int r = uv_fs_write(nullptr, &req, fd_, &buf, 1, 0, nullptr);
+        if (r >= 0 && static_cast<size_t>(r) != header.size())
+          r = -EIO;
+        if (r < 0 && error_ == 0)
+          error_ = r;
+        uv_fs_req_cleanup(&req);
+      }
+      uv_fs_close(nullptr, &req, fd_, nullptr);
+      uv_fs_req_cleanup(&req);
+      fd_ = -1;
+      uv_close(reinterpret_cast<uv_handle_t*>(&async_), nullptr);
+    }
+  }
+
+  std::unique_ptr<TrajectoryEncoder> encoder_;
+  size_t chunk_size_;
+
+  // Shared between the two threads only through the rings.
+  std::vector<Frame> frames_;
+  RingBuffer<Frame*> free_;
+  RingBuffer<Frame*> full_;
+  Frame* pending_ = nullptr;
+  uint64_t dropped_ = 0;
+  std::atomic<uint64_t> written_{0};
+  std::atomic<bool> stopping_{false};
+  bool running_ = false;
+
+  // Loop thread only.
+  uv_loop_t loop_;
+  uv_async_t async_;
+  uv_thread_t thread_;
+  uv_file fd_ = -1;
+  int64_t offset_ = 0;
+  int error_ = 0;
+  bool began_ = false;
+  bool finished_ = false;
+  size_t outstanding_ = 0;
+  WriteReq* current_ = nullptr;
+  std::vector<WriteReq> writes_;
+  std::vector<WriteReq*> free_writes_;
+};
+
+}  // namespace ssm
+
+#endif  // TRAJECTORY_WRITER_H_